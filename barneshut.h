@@ -0,0 +1,88 @@
+// Barnes-Hut gravity solver: distant groups of bodies act through their center of mass,
+// which reduces the cost of a step to O(N log N)
+class BarnesHutSolver : public GravitySolver
+{
+public:
+	BarnesHutSolver() : theta(0.5)
+	{
+	}
+
+	const char* name() const override
+	{
+		return "Barnes-Hut";
+	}
+
+	void computeAccelerations(BodySystem& bodies) override
+	{
+		tree.build(bodies, bodies.size());
+
+		// visit bodies in tree order, so that consecutive walks touch the same nodes
+		parallelFor(bodies.size(), 256, [&](int begin, int end, int)
+		{
+			for (int k = begin; k < end; k++)
+				walk(bodies, tree.index[k]);
+		});
+	}
+
+	double theta; // opening angle, smaller is more accurate
+	Octree tree;
+
+private:
+	void walk(BodySystem& bodies, int i)
+	{
+		const double xi = bodies.x[i], yi = bodies.y[i], zi = bodies.z[i];
+		const double* x = tree.x.data();
+		const double* y = tree.y.data();
+		const double* z = tree.z.data();
+		const double* m = tree.m.data();
+		const double theta2 = theta * theta;
+		double ax = 0, ay = 0, az = 0;
+
+		// depth-first traversal with an explicit stack
+		int stack[8 * 64];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const OctreeNode& node = tree.nodes[stack[--top]];
+			double dx = node.mx - xi, dy = node.my - yi, dz = node.mz - zi;
+			double r2 = dx * dx + dy * dy + dz * dz;
+			double width = 2 * node.size;
+
+			if (width * width < theta2 * r2 && r2 > node.radius * node.radius)
+			{
+				// far enough: use the center of mass of the whole node
+				double s = node.mass / (r2 * sqrt(r2));
+				ax += dx * s;
+				ay += dy * s;
+				az += dz * s;
+			}
+			else if (node.childCount == 0)
+			{
+				// leaf: sum its bodies directly
+				for (int k = node.begin; k < node.end; k++)
+				{
+					double ex = x[k] - xi, ey = y[k] - yi, ez = z[k] - zi;
+					double d2 = ex * ex + ey * ey + ez * ez;
+					if (d2 > 0)
+					{
+						double s = m[k] / (d2 * sqrt(d2));
+						ax += ex * s;
+						ay += ey * s;
+						az += ez * s;
+					}
+				}
+			}
+			else
+			{
+				// too close: open the node
+				for (int c = 0; c < node.childCount; c++)
+					stack[top++] = node.firstChild + c;
+			}
+		}
+
+		bodies.ax[i] = gravity * ax;
+		bodies.ay[i] = gravity * ay;
+		bodies.az[i] = gravity * az;
+	}
+};
@@ -0,0 +1,1300 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <random>
+#include <complex>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <type_traits>
+
+#include "linmath.h"
+#include "dvec3.h"
+#include "body.h"
+#include "checkpoint.h"
+#include "bodysystem.h"
+#include "threadpool.h"
+#include "gravity.h"
+#include "octree.h"
+#include "barneshut.h"
+#include "fmm.h"
+#include "fft.h"
+#include "particlemesh.h"
+#include "kepler.h"
+#include "integrator.h"
+#include "blockstep.h"
+#include "regularization.h"
+#include "subsystem.h"
+#include "ephemeris.h"
+#include "timeline.h"
+#include "trajectory.h"
+
+// wall-clock time in seconds
+double now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// processor time of the calling thread in seconds, which other threads and processes do not inflate
+double cpuTime()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+	uint64_t kernelTime = (uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime;
+	uint64_t userTime = (uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime;
+	return (kernelTime + userTime) * 1e-7;
+#else
+	timespec time;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+// self-gravitating Plummer sphere of equal masses, the hardest case for tree codes
+void createCluster(BodySystem& bodies, int count)
+{
+	std::mt19937_64 random(count);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	const double scale = 1e12;  // Plummer radius (m)
+	const double mass = 1e24;   // mass of each body (kg)
+
+	bodies.clear();
+	for (int i = 0; i < count; i++)
+	{
+		// radius from the inverse cumulative mass profile, direction uniform on the sphere
+		double r = scale / sqrt(pow(uniform(random) * 0.999 + 1e-6, -2.0 / 3.0) - 1);
+		double cosTheta = 2 * uniform(random) - 1;
+		double sinTheta = sqrt(1 - cosTheta * cosTheta);
+		double phi = 2 * 3.14159265358979 * uniform(random);
+
+		Body body("", 0, 0, 1, mass, 0, 0, false, 0);
+		body.position = dvec3(r * sinTheta * cos(phi), r * sinTheta * sin(phi), r * cosTheta);
+		bodies.add(body);
+	}
+}
+
+// relative acceleration errors of the current solution against direct summation, on a sample of bodies
+void measureErrors(BodySystem& bodies, double& median, double& percentile99)
+{
+	const int samples = std::min(bodies.size(), 1000);
+	std::vector<double> errors;
+	for (int k = 0; k < samples; k++)
+	{
+		int i = (int)((long long)k * bodies.size() / samples);
+		double ax = bodies.ax[i], ay = bodies.ay[i], az = bodies.az[i];
+		accelerationRows(bodies, i, i + 1);
+		double ex = ax - bodies.ax[i], ey = ay - bodies.ay[i], ez = az - bodies.az[i];
+		double exact = sqrt(bodies.ax[i] * bodies.ax[i] + bodies.ay[i] * bodies.ay[i] + bodies.az[i] * bodies.az[i]);
+		errors.push_back(sqrt(ex * ex + ey * ey + ez * ez) / exact);
+	}
+	std::sort(errors.begin(), errors.end());
+	median = errors[errors.size() / 2];
+	percentile99 = errors[errors.size() * 99 / 100];
+}
+
+void benchmarkBarnesHut(int maxCount)
+{
+	BodySystem bodies;
+	BarnesHutSolver solver;
+	DirectSolver direct;
+
+	printf("Barnes-Hut scaling (Plummer sphere, theta %.2f, %s kernel)\n", solver.theta, simdLevelNames[simdLevel]);
+	printf("%10s %12s %12s %12s %14s %12s %12s\n", "N", "build (ms)", "total (ms)", "ns/body", "direct (ms)", "median err", "99% err");
+	for (int count = 1000; count <= maxCount; count *= 10)
+	{
+		createCluster(bodies, count);
+
+		// direct summation for comparison while it is affordable
+		double directTime = -1;
+		if (count <= 100000)
+		{
+			double start = now();
+			direct.computeAccelerations(bodies);
+			directTime = now() - start;
+		}
+
+		double start = now();
+		solver.tree.build(bodies, bodies.size());
+		double buildTime = now() - start;
+
+		start = now();
+		solver.computeAccelerations(bodies);
+		double totalTime = now() - start;
+
+		double median, percentile99;
+		measureErrors(bodies, median, percentile99);
+
+		printf("%10d %12.2f %12.2f %12.1f ", count, buildTime * 1e3, totalTime * 1e3, totalTime * 1e9 / count);
+		if (directTime >= 0)
+			printf("%14.2f ", directTime * 1e3);
+		else
+			printf("%14s ", "-");
+		printf("%12.2e %12.2e\n", median, percentile99);
+	}
+
+	// accuracy against cost for a range of opening angles
+	const int count = std::min(maxCount, 100000);
+	createCluster(bodies, count);
+	printf("\nBarnes-Hut accuracy (Plummer sphere, N = %d)\n", count);
+	printf("%10s %12s %12s %12s\n", "theta", "total (ms)", "median err", "99% err");
+	const double thetas[] = { 0.2, 0.3, 0.5, 0.7, 1.0 };
+	for (double theta : thetas)
+	{
+		solver.theta = theta;
+		double start = now();
+		solver.computeAccelerations(bodies);
+		double totalTime = now() - start;
+
+		double median, percentile99;
+		measureErrors(bodies, median, percentile99);
+		printf("%10.2f %12.2f %12.2e %12.2e\n", theta, totalTime * 1e3, median, percentile99);
+	}
+}
+
+void benchmarkFmm(int maxCount)
+{
+	BodySystem bodies;
+	FmmSolver solver;
+
+	printf("\nFMM scaling (Plummer sphere, theta %.2f, order %d)\n", solver.theta, solver.getOrder());
+	printf("%10s %12s %12s %12s %12s\n", "N", "total (ms)", "ns/body", "median err", "99% err");
+	for (int count = 1000; count <= maxCount; count *= 10)
+	{
+		createCluster(bodies, count);
+
+		double start = now();
+		solver.computeAccelerations(bodies);
+		double totalTime = now() - start;
+
+		double median, percentile99;
+		measureErrors(bodies, median, percentile99);
+		printf("%10d %12.2f %12.1f %12.2e %12.2e\n", count, totalTime * 1e3, totalTime * 1e9 / count, median, percentile99);
+	}
+
+	// accuracy against cost for each expansion order
+	const int count = std::min(maxCount, 100000);
+	createCluster(bodies, count);
+	printf("\nFMM accuracy (Plummer sphere, N = %d, theta %.2f)\n", count, solver.theta);
+	printf("%10s %12s %12s %12s\n", "order", "total (ms)", "median err", "99% err");
+	for (int order = 1; order <= 8; order++)
+	{
+		solver.setOrder(order);
+		double start = now();
+		solver.computeAccelerations(bodies);
+		double totalTime = now() - start;
+
+		double median, percentile99;
+		measureErrors(bodies, median, percentile99);
+		printf("%10d %12.2f %12.2e %12.2e\n", order, totalTime * 1e3, median, percentile99);
+	}
+}
+
+// uniform spherical cloud of light bodies
+void createCloud(BodySystem& bodies, int count)
+{
+	std::mt19937_64 random(count);
+	std::uniform_real_distribution<double> uniform(-1, 1);
+	const double radius = 1e12; // cloud radius (m)
+	const double mass = 1e16;   // mass of each body (kg)
+
+	bodies.clear();
+	while (bodies.size() < count)
+	{
+		dvec3 p(uniform(random), uniform(random), uniform(random));
+		if (p.x * p.x + p.y * p.y + p.z * p.z > 1)
+			continue;
+		Body body("", 0, 0, 1, mass, 0, 0, false, 0);
+		body.position = p * radius;
+		bodies.add(body);
+	}
+}
+
+// thick debris disc of light bodies around a star and a giant planet
+void createDisc(BodySystem& bodies, int count)
+{
+	std::mt19937_64 random(count);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	const double inner = 3e11, outer = 1e12; // disc radii (m)
+	const double mass = 1e16;                // mass of each debris body (kg)
+
+	bodies.clear();
+	bodies.add(Body("Star", 0, 0, 7e8, 2e30, 0, 0, false, 0));
+	bodies.add(Body("Planet", 6e11, 0, 7e7, 2e27, 0, 0, false, 0));
+	for (int i = 0; i < count; i++)
+	{
+		double r = inner + (outer - inner) * uniform(random);
+		double phi = 2 * 3.14159265358979 * uniform(random);
+		Body body("", 0, 0, 1, mass, 0, 0, false, 0);
+		body.position = dvec3(r * cos(phi), r * sin(phi), 0.05 * r * (2 * uniform(random) - 1));
+		bodies.add(body);
+	}
+}
+
+void benchmarkParticleMesh(int maxCount)
+{
+	BodySystem bodies;
+	ParticleMeshSolver solver;
+
+	printf("\nParticle-mesh scaling (debris disc with 2 massive bodies, %d^3 grid)\n", solver.getGridSize());
+	printf("%10s %12s %12s %12s %12s\n", "N", "total (ms)", "ns/body", "median err", "99% err");
+	for (int count = 1000; count <= maxCount; count *= 10)
+	{
+		createDisc(bodies, count);
+		if (count == 1000)
+			solver.computeAccelerations(bodies); // first call prepares the Green's function
+
+		double start = now();
+		solver.computeAccelerations(bodies);
+		double totalTime = now() - start;
+
+		double median, percentile99;
+		measureErrors(bodies, median, percentile99);
+		printf("%10d %12.2f %12.1f %12.2e %12.2e\n", count, totalTime * 1e3, totalTime * 1e9 / count, median, percentile99);
+	}
+
+	// accuracy of the mesh alone for each grid size
+	const int count = std::min(maxCount, 100000);
+	createCloud(bodies, count);
+	printf("\nParticle-mesh accuracy (uniform cloud, N = %d, padding %.2f)\n", count, solver.padding);
+	printf("%10s %12s %12s %12s\n", "grid", "total (ms)", "median err", "99% err");
+	for (int size = 16; size <= 128; size *= 2)
+	{
+		solver.setGridSize(size);
+		solver.computeAccelerations(bodies);
+		double start = now();
+		solver.computeAccelerations(bodies);
+		double totalTime = now() - start;
+
+		double median, percentile99;
+		measureErrors(bodies, median, percentile99);
+		printf("%10d %12.2f %12.2e %12.2e\n", size, totalTime * 1e3, median, percentile99);
+	}
+}
+
+// force throughput of each solver for growing thread counts, and whether repeated runs agree bit for bit
+void benchmarkThreads(int maxCount)
+{
+	BodySystem bodies;
+	ThreadPool pool(1);
+	DirectSolver direct;
+	BarnesHutSolver barnesHut;
+	FmmSolver fmm;
+	ParticleMeshSolver particleMesh;
+	GravitySolver* solvers[] = { &direct, &barnesHut, &fmm, &particleMesh };
+
+	const int maxThreads = ThreadPool::defaultThreadCount();
+	printf("\nThread scaling (%d hardware threads)\n", maxThreads);
+	printf("%14s %10s %10s %12s %10s %14s\n", "solver", "N", "threads", "total (ms)", "speedup", "reproducible");
+	for (GravitySolver* solver : solvers)
+	{
+		// the particle-mesh solver is meant for light bodies
+		const int count = std::min(maxCount, solver == &direct ? 20000 : 100000);
+		if (solver == &particleMesh)
+			createCloud(bodies, count);
+		else
+			createCluster(bodies, count);
+		solver->pool = &pool;
+
+		double serialTime = 0;
+		for (int threads = 1; ; threads = std::min(2 * threads, maxThreads))
+		{
+			pool.setThreadCount(threads);
+			solver->computeAccelerations(bodies);
+			std::vector<double> first(bodies.ax.data(), bodies.ax.data() + count);
+
+			double start = now();
+			solver->computeAccelerations(bodies);
+			double totalTime = now() - start;
+			if (threads == 1)
+				serialTime = totalTime;
+
+			bool reproducible = std::equal(first.begin(), first.end(), bodies.ax.data());
+			printf("%14s %10d %10d %12.2f %10.2f %14s\n", solver->name(), count, threads, totalTime * 1e3, serialTime / totalTime, reproducible ? "yes" : "no");
+			if (threads == maxThreads)
+				break;
+		}
+	}
+}
+
+// Sun and planets with the parameters of the application
+void createPlanets(BodySystem& bodies)
+{
+	bodies.clear();
+	bodies.add(Body("Sun", 0, 0, 6.957e8, 1.9885e30, 0.13, 2.90308e-6, false, 0));
+	bodies.add(Body("Mercury", 5.790905e10, 47360, 2.4397e6, 3.3011e23, 0.00, 1.24002e-6, true, 0));
+	bodies.add(Body("Venus", 1.08208e11, 35020, 6.0518e6, 4.8675e24, 3.10, 2.99240e-7, true, 0));
+	bodies.add(Body("Earth", 1.49598023e11, 29780, 6.371e6, 5.97237e24, 0.41, 7.29212e-5, false, 0));
+	bodies.add(Body("Mars", 2.27939366e11, 24070, 3.3895e6, 6.4171e23, 0.44, 7.08822e-5, true, 0));
+	bodies.add(Body("Jupiter", 7.78479e11, 13070, 6.9911e7, 1.8982e27, 0.05, 1.75852e-4, true, 0));
+	bodies.add(Body("Saturn", 1.43353e12, 9680, 5.8232e7, 5.6834e26, 0.47, 1.65269e-4, true, 0));
+	bodies.add(Body("Uranus", 2.870972e12, 6800, 2.5362e7, 8.681e25, 1.71, 1.01238e-4, true, 0));
+	bodies.add(Body("Neptune", 4.5e12, 5430, 2.4622e7, 1.02413e26, 0.49, 1.08330e-4, true, 0));
+}
+
+// the bodies of the application: Sun, planets, and the Moon
+void createApplicationBodies(BodySystem& bodies)
+{
+	createPlanets(bodies);
+	Body moon("Moon", 1.49982422e11, 30802, 1.7374e6, 7.342e22, 0.03, 2.66170e-6, false, 0);
+	moon.host = 3;
+	bodies.insert(4, moon);
+}
+
+// satellite on a circular orbit around a body, in the orbital plane of the planets
+void addSatellite(BodySystem& bodies, const char* name, int host, double distance, double radius, double mass)
+{
+	Body satellite(name, 0, 0, radius, mass, 0, 0, false, 0);
+	double speed = sqrt(gravity * (bodies.m[host] + mass) / distance);
+	satellite.position = bodies.position(host) + dvec3(0, 0, distance);
+	satellite.velocity = bodies.velocity(host) + dvec3(speed, 0, 0);
+	satellite.host = host;
+	bodies.add(satellite);
+}
+
+// Sun and planets with the Moon, the Galilean moons, and Titan
+void createMoons(BodySystem& bodies)
+{
+	createPlanets(bodies);
+	addSatellite(bodies, "Moon", 3, 3.844e8, 1.7374e6, 7.342e22);
+	addSatellite(bodies, "Io", 5, 4.217e8, 1.8216e6, 8.932e22);
+	addSatellite(bodies, "Europa", 5, 6.709e8, 1.5608e6, 4.800e22);
+	addSatellite(bodies, "Ganymede", 5, 1.0704e9, 2.6341e6, 1.4819e23);
+	addSatellite(bodies, "Callisto", 5, 1.8827e9, 2.4103e6, 1.0759e23);
+	addSatellite(bodies, "Titan", 6, 1.22187e9, 2.5747e6, 1.3452e23);
+}
+
+// kinetic plus potential energy
+double totalEnergy(const BodySystem& bodies)
+{
+	double energy = 0;
+	for (int i = 0; i < bodies.size(); i++)
+	{
+		double v2 = bodies.vx[i] * bodies.vx[i] + bodies.vy[i] * bodies.vy[i] + bodies.vz[i] * bodies.vz[i];
+		energy += 0.5 * bodies.m[i] * v2;
+		for (int j = i + 1; j < bodies.size(); j++)
+		{
+			double dx = bodies.x[j] - bodies.x[i], dy = bodies.y[j] - bodies.y[i], dz = bodies.z[j] - bodies.z[i];
+			energy -= gravity * bodies.m[i] * bodies.m[j] / sqrt(dx * dx + dy * dy + dz * dz);
+		}
+	}
+	return energy;
+}
+
+// largest relative energy error over a century of the planets for each integrator and step size
+void benchmarkIntegrators()
+{
+	BodySystem bodies;
+	DirectSolver solver;
+	EulerIntegrator euler;
+	LeapfrogIntegrator leapfrog;
+	VerletIntegrator verlet;
+	CompositionIntegrator yoshida4("Yoshida 4th order", 4, yoshida4Weights());
+	CompositionIntegrator yoshida6("Yoshida 6th order", 6, yoshida6Weights());
+	WisdomHolmanIntegrator wisdomHolman;
+	Ias15Integrator ias15;
+	BlockHermiteIntegrator blockHermite;
+	Integrator* integrators[] = { &euler, &leapfrog, &verlet, &yoshida4, &yoshida6, &wisdomHolman, &ias15, &blockHermite };
+
+	const double day = 86400;
+	const double duration = 100 * 365.25 * day;
+	printf("\nIntegrators (Sun and planets, 100 years)\n");
+	printf("%20s %10s %14s %12s %14s\n", "integrator", "step (d)", "evaluations", "total (ms)", "energy error");
+	for (Integrator* integrator : integrators)
+	{
+		for (double step = 16; step >= 0.5; step /= 2)
+		{
+			createPlanets(bodies);
+			integrator->reset();
+			integrator->forceEvaluations = 0;
+			const double initial = totalEnergy(bodies);
+			const int steps = (int)(duration / (step * day));
+
+			// sample the energy a hundred times along the way
+			double error = 0;
+			double start = now();
+			for (int k = 1; k <= steps; k++)
+			{
+				integrator->step(bodies, solver, step * day);
+				if (k % (steps / 100) == 0)
+					error = std::max(error, fabs(totalEnergy(bodies) / initial - 1));
+			}
+			double totalTime = now() - start;
+			printf("%20s %10.1f %14lld %12.2f %14.2e\n", integrator->name(), step, integrator->forceEvaluations, totalTime * 1e3, error);
+		}
+	}
+}
+
+// moons in local frames against the same outer integrator stepping all bodies together; errors
+// are the largest relative moon offsets from their hosts after a year, against IAS15
+void benchmarkSubsystems()
+{
+	BodySystem bodies, reference;
+	DirectSolver solver;
+	Ias15Integrator ias15;
+	LeapfrogIntegrator leapfrog;
+	SubsystemIntegrator subsystems;
+	subsystems.outer = &leapfrog;
+
+	const double day = 86400;
+	const int days = 360;
+	createMoons(reference);
+	for (int k = 0; k < days; k++)
+		ias15.step(reference, solver, day);
+
+	printf("\nMoons in local frames (Sun, planets, and 6 moons, 1 year, leapfrog)\n");
+	printf("%20s %10s %14s %12s %14s %14s\n", "integration", "step (d)", "evaluations", "total (ms)", "energy error", "moon error");
+	Integrator* integrators[] = { &leapfrog, &subsystems };
+	const char* names[] = { "all bodies", "local frames" };
+	const double steps[][3] = { { 0.02, 0.005, 0.002 }, { 4, 1, 0.25 } };
+	for (int i = 0; i < 2; i++)
+	{
+		for (double step : steps[i])
+		{
+			createMoons(bodies);
+			integrators[i]->reset();
+			leapfrog.forceEvaluations = 0;
+			const double initial = totalEnergy(bodies);
+			const int count = (int)(days / step + 0.5);
+
+			double error = 0;
+			double start = now();
+			for (int k = 1; k <= count; k++)
+			{
+				integrators[i]->step(bodies, solver, step * day);
+				if (k % std::max(1, count / 100) == 0)
+					error = std::max(error, fabs(totalEnergy(bodies) / initial - 1));
+			}
+			double totalTime = now() - start;
+
+			double moonError = 0;
+			for (int j = 0; j < bodies.size(); j++)
+			{
+				int host = bodies.properties(j).host;
+				if (host < 0)
+					continue;
+				dvec3 offset = bodies.position(j) - bodies.position(host);
+				dvec3 exact = reference.position(j) - reference.position(host);
+				moonError = std::max(moonError, (offset - exact).length() / exact.length());
+			}
+			printf("%20s %10.3f %14lld %12.2f %14.2e %14.2e\n", names[i], step, leapfrog.forceEvaluations, totalTime * 1e3, error, moonError);
+		}
+	}
+}
+
+// planets and the Moon with an asteroid passing the Earth at 20000 km
+void createFlyby(BodySystem& bodies)
+{
+	createPlanets(bodies);
+	addSatellite(bodies, "Moon", 3, 3.844e8, 1.7374e6, 7.342e22);
+
+	Body asteroid("Asteroid", 0, 0, 1e4, 1e15, 0, 0, false, 0);
+	asteroid.position = bodies.position(3) + dvec3(-3e9, 2e7, 0);
+	asteroid.velocity = bodies.velocity(3) + dvec3(1e4, 0, 0);
+	bodies.add(asteroid);
+}
+
+// the flyby with a tight eccentric binary asteroid (pericenter about 100 km) beyond Mars
+void createEncounters(BodySystem& bodies)
+{
+	createFlyby(bodies);
+
+	Body first("Binary A", 0, 0, 5e4, 1e20, 0, 0, false, 0), second("Binary B", 0, 0, 5e4, 1e20, 0, 0, false, 0);
+	first.position = dvec3(0, 0, 3e11);
+	first.velocity = dvec3(sqrt(gravity * bodies.m[0] / 3e11), 0, 0);
+	second.position = first.position + dvec3(2e6, 0, 0);
+	second.velocity = first.velocity + dvec3(0, 0, 0.3 * sqrt(gravity * 2e20 / 2e6));
+	bodies.add(first);
+	bodies.add(second);
+}
+
+// the Earth, the asteroid of the flyby, and a massive body far enough that its tides stay weak
+void createSeparation(BodySystem& bodies)
+{
+	bodies.clear();
+	Body earth("Earth", 0, 0, 6.371e6, 5.972e24, 0, 0, false, 0), asteroid("Asteroid", 0, 0, 1e4, 1e15, 0, 0, false, 0), far("Far", 0, 0, 1e7, 1e25, 0, 0, false, 0);
+	asteroid.position = dvec3(-3e9, 2e7, 0);
+	asteroid.velocity = dvec3(1e4, 0, 0);
+	far.position = dvec3(0, 0, 1e12);
+	bodies.add(earth);
+	bodies.add(asteroid);
+	bodies.add(far);
+}
+
+// energy of the relative orbit of two bodies per reduced mass
+double pairEnergy(const BodySystem& bodies, int i, int j)
+{
+	dvec3 r = bodies.position(j) - bodies.position(i), v = bodies.velocity(j) - bodies.velocity(i);
+	return 0.5 * (v.x * v.x + v.y * v.y + v.z * v.z) - gravity * (bodies.m[i] + bodies.m[j]) / r.length();
+}
+
+// leapfrog with and without KS regularization of close pairs over 20 days: the binary error is the
+// relative change of the binary's orbital energy, the flyby the asteroid's distance from the Earth
+// at the end, which converges with shorter steps; then whether a pair that only separates is resolved
+void benchmarkEncounters()
+{
+	BodySystem bodies;
+	DirectSolver solver;
+	LeapfrogIntegrator leapfrog;
+	EncounterIntegrator encounters;
+	encounters.outer = &leapfrog;
+
+	const double day = 86400;
+	const int days = 20;
+
+	printf("\nClose encounters (Sun, planets, Moon, flyby, and binary asteroid, 20 days, leapfrog)\n");
+	printf("%20s %10s %14s %12s %14s %14s %14s\n", "integration", "step (d)", "evaluations", "total (ms)", "energy error", "binary error", "flyby (km)");
+	Integrator* integrators[] = { &leapfrog, &encounters };
+	const char* names[] = { "plain", "KS pairs" };
+	const double steps[][3] = { { 1.0 / 24, 1.0 / 96, 1.0 / 384 }, { 1, 1.0 / 4, 1.0 / 24 } };
+	for (int i = 0; i < 2; i++)
+	{
+		for (double step : steps[i])
+		{
+			createEncounters(bodies);
+			integrators[i]->reset();
+			leapfrog.forceEvaluations = 0;
+			const int n = bodies.size();
+			const double initial = totalEnergy(bodies), binary = pairEnergy(bodies, n - 2, n - 1);
+			const int count = (int)(days / step + 0.5);
+
+			double error = 0;
+			double start = now();
+			for (int k = 1; k <= count; k++)
+			{
+				integrators[i]->step(bodies, solver, step * day);
+				if (k % std::max(1, count / 100) == 0)
+					error = std::max(error, fabs(totalEnergy(bodies) / initial - 1));
+			}
+			double totalTime = now() - start;
+
+			double binaryError = fabs(pairEnergy(bodies, n - 2, n - 1) / binary - 1);
+			double flyby = (bodies.position(n - 3) - bodies.position(3)).length();
+			printf("%20s %10.3f %14lld %12.2f %14.2e %14.2e %14.0f\n", names[i], step, leapfrog.forceEvaluations, totalTime * 1e3, error, binaryError, flyby * 1e-3);
+		}
+	}
+
+	// the flyby without the Sun, whose tides would end the pair: the separation alone has to resolve
+	// it; plain steps of 15 min and of a minute for comparison
+	const double separationSteps[3] = { 900, 900, 56.25 };
+	double distances[3];
+	int pairs = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		Integrator* integrator = i == 1 ? (Integrator*)&encounters : &leapfrog;
+		createSeparation(bodies);
+		integrator->reset();
+		for (int k = 0; k < (int)(days * day / separationSteps[i]); k++)
+			integrator->step(bodies, solver, separationSteps[i]);
+		distances[i] = (bodies.position(1) - bodies.position(0)).length();
+		if (i == 1)
+			pairs = encounters.pairCount();
+	}
+	printf("Separating pair (Earth, flyby, and a distant massive body, 15 min steps): %s, flyby %.0f km with KS, %.0f km plain, %.0f km with 1 min steps\n",
+		pairs == 0 ? "resolved" : "NOT RESOLVED", distances[1] * 1e-3, distances[0] * 1e-3, distances[2] * 1e-3);
+}
+
+// Sun and planets with a main belt of asteroids on circular orbits between 2.1 and 3.3 AU
+void createAsteroids(BodySystem& bodies, int count, double mass)
+{
+	std::mt19937_64 random(count);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	const double inner = 3.1e11, outer = 4.9e11; // belt radii (m)
+
+	createPlanets(bodies);
+	for (int i = 0; i < count; i++)
+	{
+		double r = inner + (outer - inner) * uniform(random);
+		double phi = 2 * 3.14159265358979 * uniform(random);
+		double speed = sqrt(gravity * bodies.m[0] / r);
+		Body body("", 0, 0, 1e4, mass, 0, 0, false, 0);
+		body.position = dvec3(r * sin(phi), 0.05 * r * (2 * uniform(random) - 1), r * cos(phi));
+		body.velocity = dvec3(speed * cos(phi), 0, -speed * sin(phi));
+		bodies.add(body);
+	}
+}
+
+// direct forces on massless asteroids, which only the Sun and planets attract, for one thread
+// and all of them; for comparison the same asteroids with mass, which attract each other
+void benchmarkTestParticles(int maxCount)
+{
+	BodySystem bodies;
+	ThreadPool pool;
+	DirectSolver serial, parallel;
+	parallel.pool = &pool;
+
+	printf("\nTest particles (Sun, planets, and massless asteroids, direct summation)\n");
+	printf("%10s %12s %12s %14s %14s %12s\n", "N", "total (ms)", "ns/body", "threads (ms)", "massive (ms)", "max err");
+	for (int count = 1000; count <= maxCount; count *= 10)
+	{
+		createAsteroids(bodies, count, 0);
+		serial.computeAccelerations(bodies);
+		double start = now();
+		serial.computeAccelerations(bodies);
+		double serialTime = now() - start;
+
+		start = now();
+		parallel.computeAccelerations(bodies);
+		double parallelTime = now() - start;
+
+		double median, percentile99;
+		measureErrors(bodies, median, percentile99);
+
+		printf("%10d %12.2f %12.1f %14.2f", count, serialTime * 1e3, serialTime * 1e9 / count, parallelTime * 1e3);
+
+		// all pairs only while affordable
+		if (count <= 10000)
+		{
+			createAsteroids(bodies, count, 1e15);
+			start = now();
+			serial.computeAccelerations(bodies);
+			printf(" %14.2f", (now() - start) * 1e3);
+		}
+		else
+			printf(" %14s", "-");
+		printf(" %12.2e\n", percentile99);
+	}
+}
+
+// the Sun and massless bodies on random orbits around it, from the main belt to the Kuiper belt
+// with eccentricities up to 0.99, and every tenth on a hyperbolic orbit, entered into a catalog
+void createCatalog(BodySystem& bodies, KeplerCatalog& catalog, int count)
+{
+	std::mt19937_64 random(count);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	const double mu = gravity * 1.9885e30;
+
+	bodies.clear();
+	catalog.clear();
+	bodies.add(Body("Sun", 0, 0, 6.957e8, 1.9885e30, 0, 0, false, 0));
+	for (int i = 0; i < count; i++)
+	{
+		// pericenter state of a random orientation, then moved along the orbit
+		double e = i % 10 == 9 ? 1 + 2 * uniform(random) : 0.99 * uniform(random);
+		double pericenter = 3e11 + 7e12 * uniform(random) * uniform(random);
+		dvec3 position(pericenter, 0, 0), velocity(0, 0, sqrt(mu * (1 + e) / pericenter));
+		double node = 2 * 3.14159265358979 * uniform(random), inclination = 0.5 * uniform(random);
+		position.rotate(inclination, dvec3(1, 0, 0));
+		velocity.rotate(inclination, dvec3(1, 0, 0));
+		position.rotate(node, dvec3(0, 1, 0));
+		velocity.rotate(node, dvec3(0, 1, 0));
+		double r[3] = { position.x, position.y, position.z }, v[3] = { velocity.x, velocity.y, velocity.z };
+		keplerDrift(mu, r, v, 3e8 * (2 * uniform(random) - 1));
+
+		Body body("", 0, 0, 1e4, 0, 0, 0, false, 0);
+		body.position = dvec3(r[0], r[1], r[2]);
+		body.velocity = dvec3(v[0], v[1], v[2]);
+		bodies.add(body);
+		catalog.add(mu, body.position, body.velocity, 0, i + 1);
+	}
+}
+
+// all orbits of a catalog evaluated at once at a given time, on one thread and all of them; the
+// error is the largest relative position difference on a sample, against the universal-variable drift
+void benchmarkKeplerCatalog(int maxCount)
+{
+	BodySystem bodies;
+	KeplerCatalog catalog;
+	ThreadPool pool;
+	const double mu = gravity * 1.9885e30, time = 1e9;
+
+	printf("\nKepler catalog (elliptic and hyperbolic orbits around the Sun, evaluated 30 years ahead)\n");
+	printf("%10s %12s %12s %14s %12s\n", "N", "total (ms)", "ns/orbit", "threads (ms)", "max err");
+	for (int count = 1000; count <= maxCount; count *= 10)
+	{
+		createCatalog(bodies, catalog, count);
+		std::vector<double> initial(6 * count);
+		for (int i = 0; i < count; i++)
+		{
+			dvec3 position = bodies.position(i + 1), velocity = bodies.velocity(i + 1);
+			double state[6] = { position.x, position.y, position.z, velocity.x, velocity.y, velocity.z };
+			std::copy(state, state + 6, initial.begin() + 6 * i);
+		}
+
+		double start = now();
+		catalog.evaluate(time, bodies, nullptr);
+		double serialTime = now() - start;
+		start = now();
+		catalog.evaluate(time, bodies, &pool);
+		double parallelTime = now() - start;
+
+		double error = 0;
+		for (int i = 0; i < count; i += std::max(1, count / 1000))
+		{
+			double* r = &initial[6 * i];
+			keplerDrift(mu, r, r + 3, time);
+			dvec3 exact(r[0], r[1], r[2]);
+			error = std::max(error, (bodies.position(i + 1) - exact).length() / exact.length());
+		}
+		printf("%10d %12.2f %12.1f %14.2f %12.2e\n", count, serialTime * 1e3, serialTime * 1e9 / count, parallelTime * 1e3, error);
+	}
+}
+
+// error and cost of a Chebyshev ephemeris of a year of the application bodies against the states
+// it was fitted to, for several granule lengths
+void benchmarkEphemeris()
+{
+	BodySystem bodies;
+	DirectSolver solver;
+	CompositionIntegrator yoshida6("Yoshida 6th order", 6, yoshida6Weights());
+	EphemerisRecorder recorder;
+	Ephemeris ephemeris;
+	const char* path = "benchmark-ephemeris.bin";
+	const double day = 86400, step = 3600, duration = 365.25 * day;
+
+	printf("\nChebyshev ephemeris (Sun, planets, and the Moon, 1 year of Yoshida 6th order in steps of 1 h)\n");
+	printf("%12s %10s %16s %16s %12s\n", "granule (d)", "size (kB)", "position (m)", "velocity (m/s)", "ns/lookup");
+	for (double granule = 2; granule <= 32; granule *= 2)
+	{
+		createApplicationBodies(bodies);
+		yoshida6.reset();
+		double time = 0;
+		recorder.open(path, bodies, time, granule * day);
+
+		// exact states every 5 hours, which falls between the granule boundaries
+		std::vector<double> times;
+		std::vector<dvec3> positions, velocities;
+		for (int k = 1; time < duration; k++)
+		{
+			yoshida6.step(bodies, solver, step);
+			time += step;
+			recorder.sample(bodies, time);
+			if (k % 5 == 0)
+			{
+				times.push_back(time);
+				for (int i = 0; i < bodies.size(); i++)
+				{
+					positions.push_back(bodies.position(i));
+					velocities.push_back(bodies.velocity(i));
+				}
+			}
+		}
+		recorder.close();
+		ephemeris.load(path);
+
+		const int n = bodies.size();
+		double positionError = 0, velocityError = 0;
+		int lookups = 0;
+		double start = now();
+		for (size_t s = 0; s < times.size() && times[s] <= ephemeris.end(); s++)
+		{
+			for (int i = 0; i < n; i++)
+			{
+				dvec3 position, velocity;
+				ephemeris.state(i, times[s], position, velocity);
+				positionError = std::max(positionError, (position - positions[s * n + i]).length());
+				velocityError = std::max(velocityError, (velocity - velocities[s * n + i]).length());
+				lookups++;
+			}
+		}
+		double totalTime = now() - start;
+		FILE* file = fopen(path, "rb");
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fclose(file);
+		printf("%12.0f %10.1f %16.3e %16.3e %12.1f\n", granule, size / 1024.0, positionError, velocityError, totalTime * 1e9 / lookups);
+	}
+	remove(path);
+}
+
+// memory of timeline keyframes against the raw state, and the time to restore the one before the
+// latest, which decodes a whole group; the restored state is compared to a copy taken at the same step
+void benchmarkTimeline(int maxCount)
+{
+	BodySystem bodies, copy;
+	DirectSolver solver;
+	LeapfrogIntegrator leapfrog;
+	Timeline timeline;
+	const double day = 86400;
+	const int steps = 256;
+	timeline.budget = (size_t)1 << 30;
+
+	printf("\nTimeline (Sun, planets, and massless asteroids, a keyframe every 16 steps of 1 day)\n");
+	printf("%10s %10s %12s %12s %8s %14s %8s\n", "N", "keyframes", "raw (kB)", "kept (kB)", "ratio", "restore (ms)", "exact");
+	for (int count = 1000; count <= maxCount; count *= 10)
+	{
+		createAsteroids(bodies, count, 0);
+		leapfrog.reset();
+		timeline.clear();
+		double time = 0;
+		timeline.record(bodies, time);
+		for (int k = 1; k <= steps; k++)
+		{
+			leapfrog.step(bodies, solver, day);
+			time += day;
+			timeline.record(bodies, time);
+			if (k == steps - timeline.interval)
+				copy = bodies;
+		}
+
+		const double raw = (double)timeline.size() * bodies.size() * timelineValues * sizeof(double);
+		const int keyframes = timeline.size();
+		const double kept = (double)timeline.memory();
+		double start = now();
+		timeline.restore(time - timeline.interval * day, bodies, time);
+		double restoreTime = now() - start;
+		bool exact = true;
+		for (int i = 0; i < bodies.size(); i++)
+			exact &= bodies.x[i] == copy.x[i] && bodies.y[i] == copy.y[i] && bodies.z[i] == copy.z[i] &&
+				bodies.vx[i] == copy.vx[i] && bodies.vy[i] == copy.vy[i] && bodies.vz[i] == copy.vz[i] && bodies.rotAngle[i] == copy.rotAngle[i];
+		printf("%10d %10d %12.0f %12.0f %8.2f %14.2f %8s\n", count, keyframes, raw / 1024, kept / 1024, raw / kept, restoreTime * 1e3, exact ? "yes" : "no");
+	}
+}
+
+// cost of recording trajectories on the simulating thread, chunks dropped because the writer thread
+// fell behind, the size of the file against the raw states it holds, and the time to read one body
+// over a tenth of the run back from the mapped file, which must find every state of the range
+// unchanged and no dropped ones
+void benchmarkTrajectory(int maxCount)
+{
+	BodySystem bodies;
+	DirectSolver solver;
+	LeapfrogIntegrator leapfrog;
+	TrajectoryWriter writer;
+	TrajectoryReader reader;
+	const char* path = "benchmark-trajectory.bin";
+	const double hour = 3600;
+	const int steps = 2048;
+
+	printf("\nTrajectory store (Sun, planets, and massless asteroids, %d steps of 1 h)\n", steps);
+	printf("%10s %14s %14s %10s %12s %12s %8s %12s %8s\n", "N", "ns/body/step", "max step (ms)", "dropped", "raw (MB)", "file (MB)", "ratio", "read (ms)", "exact");
+	for (int count = 100; count <= std::min(maxCount, 10000); count *= 10)
+	{
+		createAsteroids(bodies, count, 0);
+		leapfrog.reset();
+		double time = 0;
+		const int body = bodies.size() / 2;
+		std::vector<dvec3> positions(1, bodies.position(body)), velocities(1, bodies.velocity(body));
+
+		// only the sampling counts, not the steps
+		double total = 0, longest = 0;
+		writer.open(path, bodies, time);
+		for (int k = 1; k <= steps; k++)
+		{
+			leapfrog.step(bodies, solver, hour);
+			time += hour;
+			double start = now();
+			writer.sample(bodies, time);
+			double sampleTime = now() - start;
+			total += sampleTime;
+			longest = std::max(longest, sampleTime);
+			positions.push_back(bodies.position(body));
+			velocities.push_back(bodies.velocity(body));
+		}
+		writer.close();
+		writer.finish();
+
+		reader.open(path);
+		std::vector<double> times;
+		std::vector<dvec3> readPositions, readVelocities;
+		std::vector<TrajectoryGap> gaps;
+		const int first = steps / 2, last = first + steps / 10;
+		double start = now();
+		int samples = reader.read(body, first * hour, last * hour, times, readPositions, readVelocities, gaps);
+		double readTime = now() - start;
+		bool exact = samples == last - first + 1 && gaps.empty();
+		for (int k = 0; exact && k < samples; k++)
+		{
+			int step = (int)(times[k] / hour + 0.5);
+			dvec3 position = positions[step], velocity = velocities[step];
+			exact = times[k] == step * hour && readPositions[k].x == position.x && readPositions[k].y == position.y && readPositions[k].z == position.z &&
+				readVelocities[k].x == velocity.x && readVelocities[k].y == velocity.y && readVelocities[k].z == velocity.z;
+		}
+
+		FILE* file = fopen(path, "rb");
+		fseek(file, 0, SEEK_END);
+		double size = ftell(file) / 1048576.0;
+		fclose(file);
+		const double raw = (double)reader.samples() * (1 + 6 * bodies.size()) * sizeof(double) / 1048576.0;
+		reader.close();
+		printf("%10d %14.2f %14.3f %10lld %12.1f %12.1f %8.2f %12.2f %8s\n", count, total * 1e9 / steps / bodies.size(), longest * 1e3, writer.droppedChunks(), raw, size,
+			raw / size, readTime * 1e3, exact ? "yes" : "no");
+	}
+	remove(path);
+}
+
+// pause of the simulating thread while a checkpoint is copied, the time of the writer thread, and
+// whether a run continued from the file ends on the same bits as the run that saved it
+void benchmarkCheckpoint(int maxCount)
+{
+	BodySystem bodies, resumed;
+	DirectSolver solver;
+	Ias15Integrator ias15, restored;
+	CheckpointWriter writer;
+	const char* path = "benchmark-checkpoint.bin";
+	const double day = 86400;
+	const int steps = 8;
+	writer.path = path;
+	writer.state = [&](Archive& archive)
+	{
+		bodies.serialize(archive);
+		ias15.serialize(archive);
+	};
+
+	printf("\nCheckpoints (Sun, planets, and massless asteroids, IAS15, resumed for %d steps of 1 day)\n", steps);
+	printf("%10s %12s %12s %12s %8s\n", "N", "copy (ms)", "write (ms)", "file (MB)", "exact");
+	for (int count = 100; count <= std::min(maxCount, 10000); count *= 10)
+	{
+		createAsteroids(bodies, count, 0);
+		ias15.reset();
+		for (int k = 0; k < steps; k++)
+			ias15.step(bodies, solver, day);
+
+		// the copy is made by save, the file is written while the run goes on
+		double start = now();
+		writer.save();
+		double copyTime = now() - start;
+		writer.finish();
+		double writeTime = now() - start - copyTime;
+		for (int k = 0; k < steps; k++)
+			ias15.step(bodies, solver, day);
+
+		std::vector<unsigned char> payload;
+		Archive archive(payload, false);
+		bool exact = readCheckpoint(path, payload);
+		resumed.serialize(archive);
+		restored.serialize(archive);
+		exact &= archive.isComplete();
+		for (int k = 0; exact && k < steps; k++)
+			restored.step(resumed, solver, day);
+		for (int i = 0; exact && i < bodies.size(); i++)
+			exact = resumed.x[i] == bodies.x[i] && resumed.y[i] == bodies.y[i] && resumed.z[i] == bodies.z[i] &&
+				resumed.vx[i] == bodies.vx[i] && resumed.vy[i] == bodies.vy[i] && resumed.vz[i] == bodies.vz[i] && resumed.rotAngle[i] == bodies.rotAngle[i];
+		printf("%10d %12.2f %12.2f %12.2f %8s\n", count, copyTime * 1e3, writeTime * 1e3, (payload.size() + 24) / 1048576.0, exact ? "yes" : "no");
+	}
+	remove(path);
+}
+
+// Sun and planets with Mercury on an orbit of eccentricity 0.82, its pericenter at a tenth of its distance
+void createEccentric(BodySystem& bodies)
+{
+	createPlanets(bodies);
+	const double apocenter = bodies.position(1).length(), pericenter = 0.1 * apocenter;
+	double speed = sqrt(2 * gravity * bodies.m[0] * pericenter / (apocenter * (apocenter + pericenter)));
+	bodies.setVelocity(1, dvec3(speed, 0, 0));
+}
+
+// total angular momentum about the origin
+dvec3 angularMomentum(const BodySystem& bodies)
+{
+	dvec3 total(0, 0, 0);
+	for (int i = 0; i < bodies.size(); i++)
+	{
+		double x = bodies.x[i], y = bodies.y[i], z = bodies.z[i];
+		double vx = bodies.vx[i], vy = bodies.vy[i], vz = bodies.vz[i];
+		total += dvec3(y * vz - z * vy, z * vx - x * vz, x * vy - y * vx) * bodies.m[i];
+	}
+	return total;
+}
+
+// largest angle between the offsets of the bodies from their hosts (the Sun for bodies without
+// one) in two states of the same system
+double phaseError(const BodySystem& bodies, const BodySystem& reference)
+{
+	double error = 0;
+	for (int i = 1; i < bodies.size(); i++)
+	{
+		int host = bodies.properties(i).host >= 0 ? bodies.properties(i).host : 0;
+		dvec3 a = bodies.position(i) - bodies.position(host);
+		dvec3 b = reference.position(i) - reference.position(host);
+		dvec3 normal(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+		error = std::max(error, atan2(normal.length(), a.x * b.x + a.y * b.y + a.z * b.z));
+	}
+	return error;
+}
+
+// accuracy against cost: the Solar system of the application and stress scenarios under every
+// integrator and a range of steps. Errors are the largest relative energy error along the way,
+// the relative change of the angular momentum, and the phase error against IAS15 at the end;
+// one line of CSV per run. The time is the processor time of the steps alone.
+void benchmarkAccuracy(FILE* output)
+{
+	struct Scenario
+	{
+		const char* name;
+		void (*create)(BodySystem&);
+		double days;
+		double steps[4]; // in days
+	};
+	const Scenario scenarios[] =
+	{
+		{ "solar system", createApplicationBodies, 3652.5, { 8, 2, 0.5, 0.125 } },
+		{ "eccentric Mercury", createEccentric, 3652.5, { 4, 1, 0.25, 0.0625 } },
+		{ "six moons", createMoons, 365.25, { 1, 0.25, 0.0625, 0.015625 } },
+		{ "Earth flyby", createFlyby, 20, { 1.0 / 24, 1.0 / 96, 1.0 / 384, 1.0 / 1536 } },
+	};
+
+	BodySystem bodies, reference;
+	DirectSolver solver;
+	EulerIntegrator euler;
+	LeapfrogIntegrator leapfrog;
+	VerletIntegrator verlet;
+	CompositionIntegrator yoshida4("Yoshida 4th order", 4, yoshida4Weights());
+	CompositionIntegrator yoshida6("Yoshida 6th order", 6, yoshida6Weights());
+	WisdomHolmanIntegrator wisdomHolman;
+	Ias15Integrator ias15;
+	BlockHermiteIntegrator blockHermite;
+	Integrator* integrators[] = { &euler, &leapfrog, &verlet, &yoshida4, &yoshida6, &wisdomHolman, &ias15, &blockHermite };
+	const double day = 86400;
+
+	fprintf(output, "scenario,integrator,step_days,force_evaluations,time_s,energy_error,angular_momentum_error,phase_error_rad\n");
+	for (const Scenario& scenario : scenarios)
+	{
+		// reference: IAS15 asked for a quarter of the shortest step, taking shorter ones itself where
+		// needed, so that no run is compared to itself
+		const double shortest = scenario.steps[3] / 4;
+		const int referenceSteps = (int)(scenario.days / shortest + 0.5);
+		scenario.create(reference);
+		ias15.reset();
+		for (int k = 0; k < referenceSteps; k++)
+			ias15.step(reference, solver, shortest * day);
+
+		for (Integrator* integrator : integrators)
+		{
+			for (double step : scenario.steps)
+			{
+				scenario.create(bodies);
+				integrator->reset();
+				integrator->forceEvaluations = 0;
+				const double initial = totalEnergy(bodies);
+				const dvec3 initialMomentum = angularMomentum(bodies);
+				const int count = (int)(scenario.days / step + 0.5);
+
+				// the steps between two samples of the energy are timed, not the sampling
+				const int interval = std::max(1, count / 100);
+				double error = 0, totalTime = 0;
+				for (int k = 0; k < count;)
+				{
+					const int next = std::min(count, k + interval);
+					double start = cpuTime();
+					for (; k < next; k++)
+						integrator->step(bodies, solver, step * day);
+					totalTime += cpuTime() - start;
+					if (k % interval == 0)
+						error = std::max(error, fabs(totalEnergy(bodies) / initial - 1));
+				}
+
+				dvec3 momentum = angularMomentum(bodies);
+				double momentumError = (momentum - initialMomentum).length() / dvec3(initialMomentum).length();
+				fprintf(output, "%s,%s,%.6g,%lld,%.6g,%.3e,%.3e,%.3e\n", scenario.name, integrator->name(), step, integrator->forceEvaluations,
+					totalTime, error, momentumError, phaseError(bodies, reference));
+				fflush(output);
+			}
+		}
+	}
+}
+
+// seconds per call of a task, repeated until at least the given time has passed
+double timePerCall(const std::function<void()>& task, double minimum)
+{
+	task();
+	int calls = 0;
+	double start = now(), elapsed = 0;
+	do
+	{
+		task();
+		calls++;
+		elapsed = now() - start;
+	} while (elapsed < minimum);
+	return elapsed / calls;
+}
+
+// machine-readable suite: pair kernels alone, one leapfrog step of growing systems with every
+// solver, and every integrator over ten years of the planets; rates as JSON
+void benchmarkSuite(FILE* output, int maxCount)
+{
+	BodySystem bodies;
+	ThreadPool pool;
+	const double minimum = 0.2;
+	fprintf(output, "{\n");
+	fprintf(output, "  \"machine\": { \"threads\": %d, \"simd\": \"%s\" },\n", pool.getThreadCount(), simdLevelNames[supportedSimdLevel]);
+
+	// pair kernels on one thread: each pair once (accelerationPairs) or from both sides (accelerationRows),
+	// and the object-oriented Body::calcForce with dvec3 arithmetic for comparison
+	const int kernelCount = std::min(maxCount, 2000);
+	createCluster(bodies, kernelCount);
+	const double pairs = 0.5 * kernelCount * (kernelCount - 1.0);
+	fprintf(output, "  \"kernels\": [\n");
+	const SimdLevel level = simdLevel;
+	for (int k = 0; k <= supportedSimdLevel; k++)
+	{
+		simdLevel = (SimdLevel)k;
+		double once = timePerCall([&]() { accelerationPairs(bodies); }, minimum);
+		double both = timePerCall([&]() { accelerationRows(bodies, 0, bodies.size()); }, minimum);
+		fprintf(output, "    { \"kernel\": \"%s\", \"method\": \"pairs\", \"bodies\": %d, \"pairs_per_second\": %.4g },\n", simdLevelNames[k], kernelCount, pairs / once);
+		fprintf(output, "    { \"kernel\": \"%s\", \"method\": \"rows\", \"bodies\": %d, \"pairs_per_second\": %.4g },\n", simdLevelNames[k], kernelCount, pairs / both);
+	}
+	simdLevel = level;
+	std::vector<Body> objects;
+	for (int i = 0; i < kernelCount; i++)
+		objects.push_back(bodies.get(i));
+	std::vector<dvec3> forces(kernelCount);
+	double objectTime = timePerCall([&]()
+	{
+		for (int i = 0; i < kernelCount; i++)
+			forces[i] = dvec3(0, 0, 0);
+		for (int i = 0; i < kernelCount; i++)
+			for (int j = i + 1; j < kernelCount; j++)
+			{
+				dvec3 force = objects[i].calcForce(objects[j]);
+				forces[i] += force;
+				forces[j] -= force;
+			}
+	}, minimum);
+	fprintf(output, "    { \"kernel\": \"Body::calcForce\", \"method\": \"pairs\", \"bodies\": %d, \"pairs_per_second\": %.4g }\n", kernelCount, pairs / objectTime);
+	fprintf(output, "  ],\n");
+
+	// one leapfrog step on all threads; direct summation only up to 10^4 bodies
+	DirectSolver direct;
+	BarnesHutSolver barnesHut;
+	FmmSolver fmm;
+	ParticleMeshSolver particleMesh;
+	GravitySolver* solvers[] = { &direct, &barnesHut, &fmm, &particleMesh };
+	LeapfrogIntegrator leapfrog;
+	fprintf(output, "  \"steps\": [\n");
+	bool first = true;
+	for (int count = 10; count <= std::min(maxCount, 100000); count *= 10)
+	{
+		for (GravitySolver* solver : solvers)
+		{
+			if (solver == &direct && count > 10000)
+				continue;
+			createCluster(bodies, count);
+			solver->pool = &pool;
+			leapfrog.reset();
+			double step = timePerCall([&]() { leapfrog.step(bodies, *solver, 3600); }, minimum);
+			fprintf(output, "%s    { \"solver\": \"%s\", \"bodies\": %d, \"steps_per_second\": %.4g, \"ns_per_body_step\": %.4g }",
+				first ? "" : ",\n", solver->name(), count, 1 / step, step * 1e9 / count);
+			first = false;
+		}
+	}
+	fprintf(output, "\n  ],\n");
+
+	// each integrator over ten years of the planets in 1-day steps, on one thread
+	EulerIntegrator euler;
+	VerletIntegrator verlet;
+	CompositionIntegrator yoshida4("Yoshida 4th order", 4, yoshida4Weights());
+	CompositionIntegrator yoshida6("Yoshida 6th order", 6, yoshida6Weights());
+	WisdomHolmanIntegrator wisdomHolman;
+	Ias15Integrator ias15;
+	BlockHermiteIntegrator blockHermite;
+	Integrator* integrators[] = { &euler, &leapfrog, &verlet, &yoshida4, &yoshida6, &wisdomHolman, &ias15, &blockHermite };
+	const double day = 86400;
+	const int integratorCount = sizeof(integrators) / sizeof(integrators[0]);
+	const int steps = 3653;
+	fprintf(output, "  \"integrators\": [\n");
+	for (int i = 0; i < integratorCount; i++)
+	{
+		Integrator* integrator = integrators[i];
+		createPlanets(bodies);
+		integrator->reset();
+		integrator->forceEvaluations = 0;
+		const double initial = totalEnergy(bodies);
+		double start = now();
+		for (int k = 0; k < steps; k++)
+			integrator->step(bodies, direct, day);
+		double totalTime = now() - start;
+		fprintf(output, "    { \"integrator\": \"%s\", \"bodies\": %d, \"step_days\": 1, \"steps\": %d, \"force_evaluations\": %lld, \"steps_per_second\": %.4g, \"ns_per_body_step\": %.4g, \"energy_error\": %.3e }%s\n",
+			integrator->name(), bodies.size(), steps, integrator->forceEvaluations, steps / totalTime, totalTime * 1e9 / (steps * (double)bodies.size()),
+			fabs(totalEnergy(bodies) / initial - 1), i + 1 < integratorCount ? "," : "");
+	}
+	fprintf(output, "  ]\n}\n");
+}
+
+void usage()
+{
+	fprintf(stderr,
+		"usage: benchmark [N] [--json FILE] [--csv FILE]\n"
+		"  N           largest number of bodies of the scenarios (default 1000000)\n"
+		"  --json FILE only the machine-readable suite, written to FILE or - for the standard output\n"
+		"  --csv FILE  only the accuracy harness, written to FILE or - for the standard output\n"
+		"              (with both, each into its own file)\n");
+}
+
+int main(int argc, char* argv[])
+{
+	// largest scenario size from the command line; with --json or --csv and a file (- for the
+	// standard output) only the machine-readable suite, the accuracy harness, or both
+	int maxCount = 1000000;
+	const char* json = nullptr;
+	const char* csv = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		const char* option = argv[i];
+		if (strcmp(option, "--json") == 0 || strcmp(option, "--csv") == 0)
+		{
+			// a number after the option is the body count, with the file forgotten
+			const char* path = i + 1 < argc ? argv[++i] : "";
+			if ((path[0] == '-' && path[1] != 0) || strspn(path, "0123456789") == strlen(path))
+			{
+				usage();
+				return 1;
+			}
+			(option[2] == 'j' ? json : csv) = path;
+		}
+		else
+		{
+			char* rest = nullptr;
+			long count = strtol(option, &rest, 10);
+			if (!isdigit((unsigned char)option[0]) || *rest != 0 || count <= 0 || count > 1000000000)
+			{
+				usage();
+				return 1;
+			}
+			maxCount = (int)count;
+		}
+	}
+	if (json && csv && strcmp(json, "-") == 0 && strcmp(csv, "-") == 0)
+	{
+		usage();
+		return 1;
+	}
+	if (json || csv)
+	{
+		const char* paths[2] = { json, csv };
+		for (int k = 0; k < 2; k++)
+		{
+			if (!paths[k])
+				continue;
+			FILE* output = strcmp(paths[k], "-") == 0 ? stdout : fopen(paths[k], "w");
+			if (!output)
+			{
+				fprintf(stderr, "cannot write %s\n", paths[k]);
+				return 1;
+			}
+			if (k == 0)
+				benchmarkSuite(output, maxCount);
+			else
+				benchmarkAccuracy(output);
+			if (output != stdout)
+				fclose(output);
+		}
+		return 0;
+	}
+
+	benchmarkBarnesHut(maxCount);
+	benchmarkFmm(maxCount);
+	benchmarkParticleMesh(maxCount);
+	benchmarkThreads(maxCount);
+	benchmarkTestParticles(maxCount);
+	benchmarkKeplerCatalog(maxCount);
+	benchmarkEphemeris();
+	benchmarkTimeline(maxCount);
+	benchmarkTrajectory(maxCount);
+	benchmarkCheckpoint(maxCount);
+	benchmarkIntegrators();
+	benchmarkSubsystems();
+	benchmarkEncounters();
+	return 0;
+}
@@ -0,0 +1,302 @@
+// accelerations and jerks (time derivatives of the accelerations) of the bodies listed in active,
+// summed directly over the listed attractors (the bodies with mass) at the given positions and velocities
+void accelerationJerkRows(const double* const* position, const double* const* velocity, const double* m, const int* attractors,
+	int attractorCount, const int* active, int begin, int end, double* const* acceleration, double* const* jerk)
+{
+	for (int k = begin; k < end; k++)
+	{
+		const int i = active[k];
+		double a[3] = { 0, 0, 0 }, j[3] = { 0, 0, 0 };
+		for (int source = 0; source < attractorCount; source++)
+		{
+			const int other = attractors[source];
+			double dx = position[0][other] - position[0][i];
+			double dy = position[1][other] - position[1][i];
+			double dz = position[2][other] - position[2][i];
+			double r2 = dx * dx + dy * dy + dz * dz;
+			if (r2 == 0)
+				continue;
+			double dvx = velocity[0][other] - velocity[0][i];
+			double dvy = velocity[1][other] - velocity[1][i];
+			double dvz = velocity[2][other] - velocity[2][i];
+
+			double inverse2 = 1 / r2;
+			double s = m[other] * inverse2 * sqrt(inverse2);
+			double rv = 3 * (dx * dvx + dy * dvy + dz * dvz) * inverse2;
+			a[0] += s * dx;
+			a[1] += s * dy;
+			a[2] += s * dz;
+			j[0] += s * (dvx - rv * dx);
+			j[1] += s * (dvy - rv * dy);
+			j[2] += s * (dvz - rv * dz);
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			acceleration[c][i] = gravity * a[c];
+			jerk[c][i] = gravity * j[c];
+		}
+	}
+}
+
+// fourth-order Hermite predictor-corrector with individual block time steps (Aarseth's scheme).
+//
+// Each body steps with its own power-of-two fraction of the requested step, chosen from its
+// acceleration, jerk, and their higher derivatives, so that close moons take steps of hours while
+// distant planets take the whole step. At every block time only the bodies due then get their
+// forces recomputed, from the positions and velocities of all bodies predicted to that time by
+// their Taylor series. A body's step halves whenever its criterion demands and doubles only when
+// its time is a multiple of the doubled step, which keeps the blocks aligned. All bodies are
+// synchronized at the end of a requested step; with few substeps the slow bodies save the most.
+//
+// Forces and jerks are summed directly (the selected solver only lends its threads), and
+// force evaluations are counted in units of all bodies: n body updates make one evaluation.
+class BlockHermiteIntegrator : public Integrator
+{
+public:
+	static const int maxLevel = 30; // shortest step: the requested step / 2^maxLevel
+
+	BlockHermiteIntegrator() : eta(0.02), startEta(0.01), count(-1), updates(0), lastEvaluations(0)
+	{
+	}
+
+	const char* name() const override
+	{
+		return "Hermite block steps";
+	}
+
+	int order() const override
+	{
+		return 4;
+	}
+
+	// in the most recent step, rounded up
+	int evaluationsPerStep() const override
+	{
+		return lastEvaluations;
+	}
+
+	void serialize(Archive& archive) override
+	{
+		Integrator::serialize(archive);
+		archive.value(eta);
+		archive.value(startEta);
+		for (int c = 0; c < 3; c++)
+		{
+			archive.value(acceleration[c]);
+			archive.value(jerk[c]);
+			archive.value(predicted[c]);
+			archive.value(predictedVelocity[c]);
+		}
+		archive.value(desired);
+		archive.value(level);
+		archive.value(last);
+		archive.value(count);
+		archive.value(updates);
+		archive.value(lastEvaluations);
+	}
+
+	void step(BodySystem& bodies, GravitySolver& solver, double dt) override
+	{
+		const int n = bodies.size();
+		if (dt == 0 || n == 0)
+			return;
+		if (n != count)
+		{
+			count = n;
+			for (int c = 0; c < 3; c++)
+			{
+				acceleration[c].assign(n, 0);
+				jerk[c].assign(n, 0);
+				predicted[c].resize(n);
+				predictedVelocity[c].resize(n);
+			}
+			desired.assign(n, 0);
+			level.resize(n);
+			last.resize(n);
+			cached = false;
+		}
+		const double* position[3] = { bodies.x.data(), bodies.y.data(), bodies.z.data() };
+		double* velocity[3] = { bodies.vx.data(), bodies.vy.data(), bodies.vz.data() };
+		double* a[3] = { acceleration[0].data(), acceleration[1].data(), acceleration[2].data() };
+		double* j[3] = { jerk[0].data(), jerk[1].data(), jerk[2].data() };
+		long long stepUpdates = 0;
+
+		// massless bodies attract nothing and are left out of the sums
+		attractors.clear();
+		for (int i = 0; i < n; i++)
+			if (bodies.m[i] != 0)
+				attractors.push_back(i);
+
+		// forces and jerks of all bodies, if the bodies changed since the last step
+		if (!cached)
+		{
+			active.resize(n);
+			for (int i = 0; i < n; i++)
+				active[i] = i;
+			evaluateActive(bodies, solver, position, velocity);
+			for (int i = 0; i < n; i++)
+			{
+				double a2 = 0, j2 = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					a2 += a[c][i] * a[c][i];
+					j2 += j[c][i] * j[c][i];
+				}
+				desired[i] = j2 > 0 ? startEta * sqrt(a2 / j2) : fabs(dt);
+			}
+			cached = true;
+		}
+
+		// levels for this step; times count in units of the shortest step
+		const long long end = 1LL << maxLevel;
+		for (int i = 0; i < n; i++)
+		{
+			level[i] = levelOf(desired[i], dt);
+			last[i] = 0;
+		}
+
+		long long now = 0;
+		while (now < end)
+		{
+			// the next block: bodies whose steps end soonest
+			long long next = end;
+			for (int i = 0; i < n; i++)
+				next = std::min(next, last[i] + (end >> level[i]));
+			active.clear();
+			for (int i = 0; i < n; i++)
+				if (last[i] + (end >> level[i]) == next)
+					active.push_back(i);
+
+			// all bodies predicted to the block time
+			for (int i = 0; i < n; i++)
+			{
+				const double h = (next - last[i]) * dt / end;
+				for (int c = 0; c < 3; c++)
+				{
+					predicted[c][i] = position[c][i] + h * (velocity[c][i] + h * (a[c][i] / 2 + h * j[c][i] / 6));
+					predictedVelocity[c][i] = velocity[c][i] + h * (a[c][i] + h * j[c][i] / 2);
+				}
+			}
+
+			// old derivatives of the active bodies, then the new ones at the predicted state
+			old.resize(6 * active.size());
+			for (int k = 0; k < (int)active.size(); k++)
+				for (int c = 0; c < 3; c++)
+				{
+					old[6 * k + c] = a[c][active[k]];
+					old[6 * k + 3 + c] = j[c][active[k]];
+				}
+			const double* predictedPosition[3] = { predicted[0].data(), predicted[1].data(), predicted[2].data() };
+			double* velocityAtBlock[3] = { predictedVelocity[0].data(), predictedVelocity[1].data(), predictedVelocity[2].data() };
+			evaluateActive(bodies, solver, predictedPosition, velocityAtBlock);
+
+			// Hermite correction and the next step of each active body
+			for (int k = 0; k < (int)active.size(); k++)
+			{
+				const int i = active[k];
+				const double h = (next - last[i]) * dt / end;
+				double snap[3], crackle[3];
+				double p[3];
+				for (int c = 0; c < 3; c++)
+				{
+					// second and third derivatives of the acceleration at the start of the step
+					double a0 = old[6 * k + c], j0 = old[6 * k + 3 + c];
+					double a1 = a[c][i], j1 = j[c][i];
+					double s = (-6 * (a0 - a1) - h * (4 * j0 + 2 * j1)) / (h * h);
+					double q = (12 * (a0 - a1) + 6 * h * (j0 + j1)) / (h * h * h);
+					p[c] = predicted[c][i] + h * h * h * h * (s / 24 + h * q / 120);
+					velocity[c][i] = predictedVelocity[c][i] + h * h * h * (s / 6 + h * q / 24);
+
+					// at the end of the step
+					snap[c] = s + h * q;
+					crackle[c] = q;
+				}
+				bodies.x[i] = p[0];
+				bodies.y[i] = p[1];
+				bodies.z[i] = p[2];
+				last[i] = next;
+
+				// Aarseth's criterion, allowing one doubling when the time is aligned with it
+				double na = 0, nj = 0, ns = 0, nc = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					na += a[c][i] * a[c][i];
+					nj += j[c][i] * j[c][i];
+					ns += snap[c] * snap[c];
+					nc += crackle[c] * crackle[c];
+				}
+				na = sqrt(na);
+				nj = sqrt(nj);
+				ns = sqrt(ns);
+				nc = sqrt(nc);
+				double denominator = nj * nc + ns * ns;
+				desired[i] = denominator > 0 ? sqrt(eta * (na * ns + nj * nj) / denominator) : fabs(dt);
+
+				int wanted = levelOf(desired[i], dt);
+				if (wanted > level[i])
+					level[i] = wanted;
+				else if (wanted < level[i] && level[i] > 0 && next % (end >> (level[i] - 1)) == 0)
+					level[i]--;
+			}
+			stepUpdates += active.size();
+			now = next;
+		}
+
+		for (int i = 0; i < n; i++)
+			bodies.rotAngle[i] += bodies.rotSpeed[i] * dt;
+
+		// count force evaluations in units of all bodies
+		updates += stepUpdates;
+		forceEvaluations += updates / n;
+		updates %= n;
+		lastEvaluations = (int)((stepUpdates + n - 1) / n);
+	}
+
+	double eta;      // accuracy parameter of the step criterion
+	double startEta; // for the first step, from acceleration and jerk only
+
+private:
+	// level whose step, dt / 2^level, is the longest not exceeding the desired one
+	static int levelOf(double desired, double dt)
+	{
+		int result = 0;
+		double step = fabs(dt);
+		while (step > desired && result < maxLevel)
+		{
+			step /= 2;
+			result++;
+		}
+		return result;
+	}
+
+	// accelerations and jerks of the active bodies, on the solver's threads
+	void evaluateActive(BodySystem& bodies, GravitySolver& solver, const double* const* position, const double* const* velocity)
+	{
+		const double* m = bodies.m.data();
+		const int* sources = attractors.data();
+		const int sourceCount = (int)attractors.size();
+		const int* list = active.data();
+		double* a[3] = { acceleration[0].data(), acceleration[1].data(), acceleration[2].data() };
+		double* j[3] = { jerk[0].data(), jerk[1].data(), jerk[2].data() };
+		std::function<void(int, int, int)> task = [&](int begin, int end, int)
+		{
+			accelerationJerkRows(position, velocity, m, sources, sourceCount, list, begin, end, a, j);
+		};
+		if (solver.pool)
+			solver.pool->parallelFor((int)active.size(), 16, task);
+		else
+			task(0, (int)active.size(), 0);
+	}
+
+	std::vector<double> acceleration[3], jerk[3];           // at each body's own time
+	std::vector<double> predicted[3], predictedVelocity[3]; // of all bodies at the block time
+	std::vector<double> desired;                            // step wanted by each body (s)
+	std::vector<int> level;                                 // step of each body: dt / 2^level
+	std::vector<long long> last;                            // time of each body within the step
+	std::vector<int> active;                                // bodies due at the current block
+	std::vector<int> attractors;                            // bodies with mass
+	std::vector<double> old;                                // their previous derivatives
+	int count;                                              // bodies the state belongs to
+	long long updates;                                      // body updates not counted yet
+	int lastEvaluations;
+};
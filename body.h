@@ -16,6 +16,7 @@ public:
 		texture = texture_;
 		visible = true;
 		moonOption = moonOption_;
+		host = -1;
 	}
 
 	dvec3 calcForce(Body& other)
@@ -31,17 +32,6 @@ public:
 		return direction * k;
 	}
 
-	void update(dvec3 force, double timeStep)
-	{
-		// acceleration is force/mass
-		dvec3 acceleration = force * (1 / mass);
-
-		// update velocity, position, and rotational angle
-		velocity += acceleration * timeStep;
-		position += velocity * timeStep;
-		rotAngle += rotSpeed * timeStep;
-	}
-
 	std::string name;
 	dvec3 position, velocity;        // orbital properties
 	double radius, mass;             // physical properties
@@ -49,4 +39,5 @@ public:
 	unsigned int texture;            // texture ID
 	bool visible;
 	bool moonOption;                 // moon can be added
+	int host;                        // index of the body this one orbits, or -1
 };
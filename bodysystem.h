@@ -0,0 +1,277 @@
+// array of doubles aligned to a cache line and padded to a whole number of SIMD lanes
+class AlignedArray
+{
+public:
+	static const int alignment = 64; // bytes
+
+	AlignedArray() : block(nullptr), values(nullptr), capacity(0)
+	{
+	}
+
+	AlignedArray(const AlignedArray& other) : block(nullptr), values(nullptr), capacity(0)
+	{
+		*this = other;
+	}
+
+	~AlignedArray()
+	{
+		delete[] block;
+	}
+
+	AlignedArray& operator=(const AlignedArray& other)
+	{
+		if (this != &other)
+		{
+			reserve(other.capacity);
+			for (int i = 0; i < other.capacity; i++)
+				values[i] = other.values[i];
+		}
+		return *this;
+	}
+
+	void reserve(int size)
+	{
+		if (size <= capacity)
+			return;
+
+		// grow geometrically so that adding bodies one by one stays cheap
+		if (size < capacity * 2)
+			size = capacity * 2;
+
+		// over-allocate and round the start up to the alignment boundary
+		const int extra = alignment / sizeof(double);
+		double* newBlock = new double[size + extra];
+		double* newValues = (double*)(((uintptr_t)newBlock + alignment - 1) & ~(uintptr_t)(alignment - 1));
+
+		// keep old contents, zero the rest
+		for (int i = 0; i < size; i++)
+			newValues[i] = i < capacity ? values[i] : 0;
+
+		delete[] block;
+		block = newBlock;
+		values = newValues;
+		capacity = size;
+	}
+
+	double& operator[](int i)
+	{
+		return values[i];
+	}
+
+	const double& operator[](int i) const
+	{
+		return values[i];
+	}
+
+	double* data()
+	{
+		return values;
+	}
+
+	const double* data() const
+	{
+		return values;
+	}
+
+private:
+	double* block;  // allocated memory
+	double* values; // aligned start inside the block
+	int capacity;
+};
+
+// properties that are not touched by the physics hot loop
+struct BodyInfo
+{
+	std::string name;
+	double radius;        // physical radius (m)
+	double tilt;          // axial tilt (rad)
+	unsigned int texture; // texture ID
+	bool visible;
+	bool moonOption;      // moon can be added
+	int host;             // index of the body this one orbits, or -1
+};
+
+// structure-of-arrays storage for all bodies of a simulation
+class BodySystem
+{
+public:
+	static const int lanes = 8; // padding granularity (doubles per AVX-512 register)
+
+	BodySystem() : count(0), padded(0)
+	{
+	}
+
+	int size() const
+	{
+		return count;
+	}
+
+	// number of array entries including zero-mass padding at the end
+	int paddedSize() const
+	{
+		return padded;
+	}
+
+	void add(const Body& body)
+	{
+		insert(count, body);
+	}
+
+	void insert(int index, const Body& body)
+	{
+		resize(count + 1);
+
+		// shift following bodies one slot up
+		for (int i = count - 1; i > index; i--)
+			copyState(i, i - 1);
+		for (int i = count - 1; i > index; i--)
+			info[i] = info[i - 1];
+
+		// hosts behind the new body moved too (none when appending)
+		if (index < count - 1)
+			for (int i = 0; i < count; i++)
+				if (info[i].host >= index)
+					info[i].host++;
+
+		set(index, body);
+	}
+
+	void clear()
+	{
+		resize(0);
+	}
+
+	// gather hot and cold data into a standalone body
+	Body get(int i) const
+	{
+		Body body(info[i].name, 0, 0, info[i].radius, m[i], info[i].tilt, rotSpeed[i], info[i].moonOption, info[i].texture);
+		body.position = position(i);
+		body.velocity = velocity(i);
+		body.rotAngle = rotAngle[i];
+		body.visible = info[i].visible;
+		body.host = info[i].host;
+		return body;
+	}
+
+	void set(int i, const Body& body)
+	{
+		setPosition(i, body.position);
+		setVelocity(i, body.velocity);
+		m[i] = body.mass;
+		rotAngle[i] = body.rotAngle;
+		rotSpeed[i] = body.rotSpeed;
+
+		info[i].name = body.name;
+		info[i].radius = body.radius;
+		info[i].tilt = body.tilt;
+		info[i].texture = body.texture;
+		info[i].visible = body.visible;
+		info[i].moonOption = body.moonOption;
+		info[i].host = body.host;
+	}
+
+	dvec3 position(int i) const
+	{
+		return dvec3(x[i], y[i], z[i]);
+	}
+
+	void setPosition(int i, const dvec3& p)
+	{
+		x[i] = p.x;
+		y[i] = p.y;
+		z[i] = p.z;
+	}
+
+	dvec3 velocity(int i) const
+	{
+		return dvec3(vx[i], vy[i], vz[i]);
+	}
+
+	void setVelocity(int i, const dvec3& v)
+	{
+		vx[i] = v.x;
+		vy[i] = v.y;
+		vz[i] = v.z;
+	}
+
+	double& mass(int i)
+	{
+		return m[i];
+	}
+
+	double& spin(int i)
+	{
+		return rotSpeed[i];
+	}
+
+	BodyInfo& properties(int i)
+	{
+		return info[i];
+	}
+
+	const BodyInfo& properties(int i) const
+	{
+		return info[i];
+	}
+
+	// writes or reads all bodies with their properties
+	void serialize(Archive& archive)
+	{
+		int n = count;
+		archive.value(n);
+		if (!archive.isWriting())
+			resize(archive.isValid() && n >= 0 ? n : 0);
+
+		AlignedArray* arrays[] = { &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &m, &rotAngle, &rotSpeed };
+		for (AlignedArray* array : arrays)
+			archive.bytes(array->data(), count * sizeof(double));
+		for (BodyInfo& body : info)
+		{
+			archive.value(body.name);
+			archive.value(body.radius);
+			archive.value(body.tilt);
+			archive.value(body.texture);
+			archive.value(body.visible);
+			archive.value(body.moonOption);
+			archive.value(body.host);
+		}
+	}
+
+	// hot state, one aligned array per component
+	AlignedArray x, y, z;    // position (m)
+	AlignedArray vx, vy, vz; // velocity (m/s)
+	AlignedArray ax, ay, az; // acceleration (m/s^2)
+	AlignedArray m;          // mass (kg)
+
+	// spinning state
+	AlignedArray rotAngle, rotSpeed;
+
+private:
+	void resize(int newCount)
+	{
+		int newPadded = (newCount + lanes - 1) / lanes * lanes;
+		AlignedArray* arrays[] = { &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &m, &rotAngle, &rotSpeed };
+		for (AlignedArray* array : arrays)
+		{
+			array->reserve(newPadded);
+
+			// padding entries are massless bodies at rest at the origin
+			for (int i = newCount; i < newPadded; i++)
+				(*array)[i] = 0;
+		}
+
+		info.resize(newCount);
+		count = newCount;
+		padded = newPadded;
+	}
+
+	void copyState(int to, int from)
+	{
+		AlignedArray* arrays[] = { &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &m, &rotAngle, &rotSpeed };
+		for (AlignedArray* array : arrays)
+			(*array)[to] = (*array)[from];
+	}
+
+	std::vector<BodyInfo> info; // cold side table
+	int count, padded;
+};
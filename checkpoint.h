@@ -0,0 +1,246 @@
+// checkpoints: the whole state of a run in a binary file, from which it continues bit for bit.
+//
+// What a checkpoint holds is written and read by the same code, which passes each value to an
+// archive that either appends it to a buffer or takes it from one, so the two cannot disagree
+// about the layout. Saving runs that code on the simulating thread, which only copies the state
+// into memory; a thread of its own then writes the copy to a temporary file and renames it over
+// the previous checkpoint, so a crash while writing leaves the previous one intact.
+//
+// File layout (host byte order): the magic "CHECKPT", a version byte, uint64 size of the payload,
+// the payload, and its uint64 FNV-1a hash. A checkpoint of another version is not read.
+
+const char checkpointMagic[8] = { 'C', 'H', 'E', 'C', 'K', 'P', 'T', 1 };
+
+// 64-bit FNV-1a hash, to find truncated or damaged checkpoints
+uint64_t checkpointHash(const unsigned char* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	return hash;
+}
+
+// writes values to a buffer or reads them from it, in the order they are passed
+class Archive
+{
+public:
+	Archive(std::vector<unsigned char>& buffer, bool writing) : buffer(buffer), writing(writing), position(0), failed(false)
+	{
+	}
+
+	bool isWriting() const
+	{
+		return writing;
+	}
+
+	// all values read so far were there
+	bool isValid() const
+	{
+		return !failed;
+	}
+
+	// the whole buffer was read
+	bool isComplete() const
+	{
+		return !failed && position == buffer.size();
+	}
+
+	void bytes(void* data, size_t size)
+	{
+		if (writing)
+		{
+			const unsigned char* begin = (const unsigned char*)data;
+			buffer.insert(buffer.end(), begin, begin + size);
+		}
+		else if (!failed && size <= buffer.size() - position)
+		{
+			memcpy(data, buffer.data() + position, size);
+			position += size;
+		}
+		else
+		{
+			failed = true;
+			memset(data, 0, size);
+		}
+	}
+
+	// plain values without pointers, copied byte by byte
+	template<typename T>
+	void value(T& v)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only plain values can be archived directly");
+		bytes(&v, sizeof(T));
+	}
+
+	template<typename T>
+	void value(std::vector<T>& v)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only vectors of plain values can be archived directly");
+		uint64_t size = v.size();
+		value(size);
+		if (!writing)
+		{
+			if (failed || size > (buffer.size() - position) / sizeof(T))
+			{
+				failed = true;
+				size = 0;
+			}
+			v.resize((size_t)size);
+		}
+		if (size > 0)
+			bytes(v.data(), (size_t)size * sizeof(T));
+	}
+
+	void value(std::vector<bool>& v)
+	{
+		std::vector<unsigned char> flags(v.begin(), v.end());
+		value(flags);
+		v.assign(flags.begin(), flags.end());
+	}
+
+	void value(std::string& s)
+	{
+		std::vector<char> characters(s.begin(), s.end());
+		value(characters);
+		s.assign(characters.begin(), characters.end());
+	}
+
+private:
+	std::vector<unsigned char>& buffer;
+	bool writing;
+	size_t position; // of reading
+	bool failed;
+};
+
+// saves checkpoints at intervals of simulated time; the files are written on a thread of its own
+class CheckpointWriter
+{
+public:
+	CheckpointWriter() : interval(0), path("checkpoint.bin"), failed(false), next(0), reserved(0), busy(false)
+	{
+	}
+
+	~CheckpointWriter()
+	{
+		finish();
+	}
+
+	// saves when the time has reached the next multiple of the interval after the start; call after
+	// every step. While the previous checkpoint is still being written, the next step tries again.
+	void update(double time)
+	{
+		if (interval <= 0 || time < next || busy)
+			return;
+		save();
+		next = (floor(time / interval) + 1) * interval;
+	}
+
+	// copies the state and writes it in the background, unless the previous one is still being
+	// written; false in that case
+	bool save()
+	{
+		if (busy || !state)
+			return false;
+		finish();
+
+		// as large as the previous one, so that the copy rarely grows while it is made
+		std::vector<unsigned char> payload;
+		payload.reserve(reserved);
+		Archive archive(payload, true);
+		state(archive);
+		reserved = payload.size();
+		busy = true;
+		thread = std::thread(&CheckpointWriter::write, this, path, std::move(payload));
+		return true;
+	}
+
+	// waits until the latest checkpoint is written
+	void finish()
+	{
+		if (thread.joinable())
+			thread.join();
+	}
+
+	// sets the time of the start or of a loaded checkpoint, which the next one follows
+	void start(double time)
+	{
+		next = interval > 0 ? (floor(time / interval) + 1) * interval : 0;
+	}
+
+	double interval;                           // simulated time between checkpoints (s), 0 for none
+	std::string path;                          // change while nothing is being written
+	std::function<void(Archive&)> state;       // writes or reads everything a checkpoint holds
+	std::atomic<bool> failed;                  // the latest write did not succeed
+
+private:
+	void write(std::string target, std::vector<unsigned char> payload)
+	{
+		std::string temporary = target + ".tmp";
+		FILE* file = fopen(temporary.c_str(), "wb");
+		bool written = file != nullptr;
+		if (file)
+		{
+			uint64_t size = payload.size(), hash = checkpointHash(payload.data(), payload.size());
+			written = fwrite(checkpointMagic, 1, sizeof(checkpointMagic), file) == sizeof(checkpointMagic) && fwrite(&size, sizeof(size), 1, file) == 1 &&
+				fwrite(payload.data(), 1, payload.size(), file) == payload.size() && fwrite(&hash, sizeof(hash), 1, file) == 1;
+			written = fclose(file) == 0 && written;
+		}
+
+		// replacing fails on Windows while the target exists
+		if (written && rename(temporary.c_str(), target.c_str()) != 0)
+		{
+			remove(target.c_str());
+			written = rename(temporary.c_str(), target.c_str()) == 0;
+		}
+		failed = !written;
+		busy = false;
+	}
+
+	double next;     // time of the next checkpoint (s)
+	size_t reserved; // bytes of the previous checkpoint
+	std::thread thread;
+	std::atomic<bool> busy;
+};
+
+// bytes from the current position to the end of a file, which stays at that position
+uint64_t remainingBytes(FILE* file)
+{
+#ifdef _WIN32
+	const long long position = _ftelli64(file);
+	const bool found = position >= 0 && _fseeki64(file, 0, SEEK_END) == 0;
+	const long long end = found ? _ftelli64(file) : -1;
+	if (position >= 0)
+		_fseeki64(file, position, SEEK_SET);
+#else
+	const long long position = ftello(file);
+	const bool found = position >= 0 && fseeko(file, 0, SEEK_END) == 0;
+	const long long end = found ? (long long)ftello(file) : -1;
+	if (position >= 0)
+		fseeko(file, position, SEEK_SET);
+#endif
+	return end >= position && position >= 0 ? (uint64_t)(end - position) : 0;
+}
+
+// reads the payload of a checkpoint file; false if it is missing, of another version, or damaged
+bool readCheckpoint(const char* path, std::vector<unsigned char>& payload)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+	char magic[8];
+	uint64_t size = 0, hash = 0;
+	bool valid = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && std::equal(magic, magic + 8, checkpointMagic) &&
+		fread(&size, sizeof(size), 1, file) == 1;
+
+	// a damaged size must not make it allocate more than the file holds
+	const uint64_t remaining = valid ? remainingBytes(file) : 0;
+	valid = valid && remaining >= sizeof(hash) && size <= remaining - sizeof(hash);
+	if (valid)
+	{
+		payload.resize((size_t)size);
+		valid = fread(payload.data(), 1, payload.size(), file) == payload.size() && fread(&hash, sizeof(hash), 1, file) == 1 &&
+			hash == checkpointHash(payload.data(), payload.size());
+	}
+	fclose(file);
+	return valid;
+}
@@ -0,0 +1,347 @@
+// Chebyshev ephemeris in the style of the JPL DE files.
+//
+// Time is cut into granules of equal length, and within each granule every coordinate of every body
+// is a Chebyshev series in the time mapped to [-1, 1]. The recorder fits the series by least squares
+// to the positions and velocities of the steps as the simulation integrates, and appends each
+// finished granule to a binary file. The evaluator finds the granule of any time by a division and
+// sums one series per coordinate, so a state at any time costs the same however far away it is.
+//
+// File layout (host byte order): the magic "CHEBEPH", a version byte, then int32 body count,
+// int32 coefficients per coordinate, double start time (s), double granule length (s), the body
+// names (int32 length and characters each), and then the granules, each holding for every body
+// x, y, z coefficients in order of degree.
+
+const int ephemerisCoefficients = 14;  // per coordinate and granule, degree 13
+const int ephemerisSamples = ephemerisCoefficients / 2 + 1; // per granule at least, with two equations each
+const char ephemerisMagic[8] = { 'C', 'H', 'E', 'B', 'E', 'P', 'H', 1 };
+
+// Chebyshev polynomials T_k(x) and their derivatives for k < ephemerisCoefficients
+void chebyshevBasis(double x, double* t, double* dt)
+{
+	t[0] = 1;
+	t[1] = x;
+	dt[0] = 0;
+	dt[1] = 1;
+	for (int k = 2; k < ephemerisCoefficients; k++)
+	{
+		t[k] = 2 * x * t[k - 1] - t[k - 2];
+		dt[k] = 2 * t[k - 1] + 2 * x * dt[k - 1] - dt[k - 2];
+	}
+}
+
+// writes an ephemeris while the simulation integrates
+class EphemerisRecorder
+{
+public:
+	EphemerisRecorder() : file(nullptr), count(0), start(0), granule(0), granules(0)
+	{
+	}
+
+	~EphemerisRecorder()
+	{
+		close();
+	}
+
+	// starts a file for the bodies with their state at the given time as the first sample
+	bool open(const char* path, const BodySystem& bodies, double time, double granuleLength)
+	{
+		close();
+		file = fopen(path, "wb");
+		if (!file)
+			return false;
+		count = bodies.size();
+		start = time;
+		granule = granuleLength;
+		granules = 0;
+
+		const int coefficients = ephemerisCoefficients;
+		fwrite(ephemerisMagic, 1, sizeof(ephemerisMagic), file);
+		fwrite(&count, sizeof(count), 1, file);
+		fwrite(&coefficients, sizeof(coefficients), 1, file);
+		fwrite(&start, sizeof(start), 1, file);
+		fwrite(&granule, sizeof(granule), 1, file);
+		for (int i = 0; i < count; i++)
+		{
+			const std::string& name = bodies.properties(i).name;
+			int length = (int)name.size();
+			fwrite(&length, sizeof(length), 1, file);
+			fwrite(name.data(), 1, length, file);
+		}
+		fflush(file);
+
+		times.clear();
+		states.clear();
+		sample(bodies, time);
+		return true;
+	}
+
+	// adds the state after a step, which should be shorter than an eighth of a granule; a granule is
+	// fitted and written once a step reaches its end. Stops recording and returns false when bodies
+	// were added or removed, the time went back, or a granule got too few samples to be fitted.
+	bool sample(const BodySystem& bodies, double time)
+	{
+		if (!file)
+			return false;
+		if (bodies.size() != count || (!times.empty() && time < times.back()))
+		{
+			close();
+			return false;
+		}
+
+		times.push_back(time);
+		for (int i = 0; i < count; i++)
+		{
+			double state[6] = { bodies.x[i], bodies.y[i], bodies.z[i], bodies.vx[i], bodies.vy[i], bodies.vz[i] };
+			states.insert(states.end(), state, state + 6);
+		}
+
+		// the sample at or past the end closes the granule and also opens the next one
+		const double end = start + (granules + 1) * granule;
+		if (time >= end && times.size() >= 2)
+		{
+			if ((int)times.size() < ephemerisSamples || !fit(end - granule))
+			{
+				close();
+				return false;
+			}
+			times.erase(times.begin(), times.end() - 1);
+			states.erase(states.begin(), states.end() - 6 * count);
+			granules++;
+
+			// a step over the whole next granule leaves nothing to fit it to
+			if (time >= end + granule)
+			{
+				close();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// the samples of an unfinished granule are dropped
+	void close()
+	{
+		if (file)
+			fclose(file);
+		file = nullptr;
+	}
+
+	bool isOpen() const
+	{
+		return file != nullptr;
+	}
+
+	// time covered by the granules written so far
+	double end() const
+	{
+		return start + granules * granule;
+	}
+
+private:
+	// least-squares coefficients of the granule starting at the given time from its samples: the
+	// positions, and the velocities times the sample spacing, against the series and their
+	// derivatives. Weighting the velocities by the spacing rather than the granule keeps integrators
+	// whose velocities do not quite match their positions, like leapfrog, from pulling the positions
+	// off. All coordinates share the normal matrix, which is factored once. Writes nothing and returns
+	// false when the samples do not determine the series.
+	bool fit(double begin)
+	{
+		const int K = ephemerisCoefficients;
+		const int samples = (int)times.size();
+		const double spacing = (times.back() - times.front()) / (samples - 1);
+		std::vector<double> basis(samples * K), derivative(samples * K);
+		double normal[K][K] = {};
+		for (int s = 0; s < samples; s++)
+		{
+			double x = 2 * (times[s] - begin) / granule - 1;
+			chebyshevBasis(x, &basis[s * K], &derivative[s * K]);
+			for (int k = 0; k < K; k++)
+				derivative[s * K + k] *= 2 * spacing / granule;
+			for (int j = 0; j < K; j++)
+				for (int k = 0; k < K; k++)
+					normal[j][k] += basis[s * K + j] * basis[s * K + k] + derivative[s * K + j] * derivative[s * K + k];
+		}
+
+		// Cholesky factor L with L L^T = normal, in the lower triangle
+		for (int j = 0; j < K; j++)
+		{
+			for (int k = 0; k < j; k++)
+				normal[j][j] -= normal[j][k] * normal[j][k];
+			if (!(normal[j][j] > 0))
+				return false;
+			normal[j][j] = sqrt(normal[j][j]);
+			for (int i = j + 1; i < K; i++)
+			{
+				for (int k = 0; k < j; k++)
+					normal[i][j] -= normal[i][k] * normal[j][k];
+				normal[i][j] /= normal[j][j];
+			}
+		}
+
+		record.resize(count * 3 * K);
+		for (int i = 0; i < count; i++)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				double* coefficients = &record[(i * 3 + c) * K];
+				for (int j = 0; j < K; j++)
+				{
+					double sum = 0;
+					for (int s = 0; s < samples; s++)
+					{
+						const double* state = &states[(s * count + i) * 6];
+						sum += basis[s * K + j] * state[c] + derivative[s * K + j] * state[3 + c] * spacing;
+					}
+					coefficients[j] = sum;
+				}
+
+				// forward and back substitution
+				for (int j = 0; j < K; j++)
+				{
+					for (int k = 0; k < j; k++)
+						coefficients[j] -= normal[j][k] * coefficients[k];
+					coefficients[j] /= normal[j][j];
+				}
+				for (int j = K - 1; j >= 0; j--)
+				{
+					for (int k = j + 1; k < K; k++)
+						coefficients[j] -= normal[k][j] * coefficients[k];
+					coefficients[j] /= normal[j][j];
+				}
+			}
+		}
+		fwrite(record.data(), sizeof(double), record.size(), file);
+		fflush(file);
+		return true;
+	}
+
+	FILE* file;
+	int count;                  // bodies
+	double start, granule;      // time of the first granule and length of each (s)
+	int granules;               // written so far
+	std::vector<double> times;  // samples of the current granule
+	std::vector<double> states; // position and velocity of each body per sample
+	std::vector<double> record; // coefficients of one granule
+};
+
+// reads an ephemeris and evaluates it at any time it covers
+class Ephemeris
+{
+public:
+	Ephemeris() : count(0), granules(0), start(0), granule(0)
+	{
+	}
+
+	// reads the whole file; false if it cannot be read or is not an ephemeris
+	bool load(const char* path)
+	{
+		count = granules = 0;
+		names.clear();
+		coefficients.clear();
+		FILE* file = fopen(path, "rb");
+		if (!file)
+			return false;
+
+		char magic[8];
+		int order = 0;
+		bool valid = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && std::equal(magic, magic + 8, ephemerisMagic) &&
+			fread(&count, sizeof(count), 1, file) == 1 && fread(&order, sizeof(order), 1, file) == 1 &&
+			fread(&start, sizeof(start), 1, file) == 1 && fread(&granule, sizeof(granule), 1, file) == 1 &&
+			count > 0 && order == ephemerisCoefficients && granule > 0;
+		for (int i = 0; valid && i < count; i++)
+		{
+			int length = 0;
+			valid = fread(&length, sizeof(length), 1, file) == 1 && length >= 0 && length < 4096;
+			std::string name(valid ? length : 0, ' ');
+			valid = valid && (int)fread(&name[0], 1, length, file) == length;
+			names.push_back(name);
+		}
+
+		// whole granules up to the end of the file
+		const size_t recordSize = (size_t)count * 3 * ephemerisCoefficients;
+		std::vector<double> record(recordSize);
+		while (valid && fread(record.data(), sizeof(double), recordSize, file) == recordSize)
+			coefficients.insert(coefficients.end(), record.begin(), record.end());
+		fclose(file);
+		if (!valid)
+		{
+			count = 0;
+			names.clear();
+			coefficients.clear();
+			return false;
+		}
+		granules = (int)(coefficients.size() / recordSize);
+		return true;
+	}
+
+	int size() const
+	{
+		return count;
+	}
+
+	const std::string& name(int i) const
+	{
+		return names[i];
+	}
+
+	// covered time span (s)
+	double begin() const
+	{
+		return start;
+	}
+
+	double end() const
+	{
+		return start + granules * granule;
+	}
+
+	// position and velocity of a body at a time, clamped to the covered span
+	void state(int i, double time, dvec3& position, dvec3& velocity) const
+	{
+		const int K = ephemerisCoefficients;
+		int index = (int)floor((time - start) / granule);
+		index = std::max(0, std::min(granules - 1, index));
+		double x = 2 * (time - start - index * granule) / granule - 1;
+		x = std::max(-1.0, std::min(1.0, x));
+
+		double t[K], dt[K];
+		chebyshevBasis(x, t, dt);
+		const double* series = &coefficients[((size_t)index * count + i) * 3 * K];
+		double p[3], v[3];
+		for (int c = 0; c < 3; c++)
+		{
+			double sum = 0, rate = 0;
+			for (int k = K - 1; k >= 0; k--)
+			{
+				sum += series[c * K + k] * t[k];
+				rate += series[c * K + k] * dt[k];
+			}
+			p[c] = sum;
+			v[c] = rate * 2 / granule;
+		}
+		position = dvec3(p[0], p[1], p[2]);
+		velocity = dvec3(v[0], v[1], v[2]);
+	}
+
+	// sets the positions and velocities of all bodies to the given time; false if the number of
+	// bodies differs or nothing was loaded
+	bool apply(BodySystem& bodies, double time) const
+	{
+		if (granules == 0 || bodies.size() != count)
+			return false;
+		for (int i = 0; i < count; i++)
+		{
+			dvec3 position, velocity;
+			state(i, time, position, velocity);
+			bodies.setPosition(i, position);
+			bodies.setVelocity(i, velocity);
+		}
+		return true;
+	}
+
+private:
+	int count, granules;
+	double start, granule;
+	std::vector<std::string> names;
+	std::vector<double> coefficients; // granule by granule, body by body, x y z series
+};
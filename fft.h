@@ -0,0 +1,73 @@
+// in-place radix-2 fast Fourier transform for power-of-two lengths
+class Fft
+{
+public:
+	Fft() : n(0)
+	{
+	}
+
+	// prepares twiddle factors and the bit reversal permutation for length n (a power of two)
+	void setSize(int n_)
+	{
+		if (n_ == n)
+			return;
+		n = n_;
+
+		twiddles.resize(n / 2);
+		for (int k = 0; k < n / 2; k++)
+		{
+			double angle = -2 * 3.14159265358979323846 * k / n;
+			twiddles[k] = std::complex<double>(cos(angle), sin(angle));
+		}
+
+		reversed.resize(n);
+		int bits = 0;
+		while ((1 << bits) < n)
+			bits++;
+		for (int i = 0; i < n; i++)
+		{
+			int r = 0;
+			for (int b = 0; b < bits; b++)
+				if (i & (1 << b))
+					r |= 1 << (bits - 1 - b);
+			reversed[i] = r;
+		}
+	}
+
+	int size() const
+	{
+		return n;
+	}
+
+	// forward transform with exp(-i...), or inverse without the 1/n normalization
+	void transform(std::complex<double>* data, bool inverse) const
+	{
+		for (int i = 0; i < n; i++)
+			if (i < reversed[i])
+				std::swap(data[i], data[reversed[i]]);
+
+		// butterflies of growing length, twiddles taken with a stride from the full table
+		for (int length = 2; length <= n; length *= 2)
+		{
+			int half = length / 2;
+			int stride = n / length;
+			for (int start = 0; start < n; start += length)
+				for (int k = 0; k < half; k++)
+				{
+					// complex product written out, std::complex multiplication checks for infinities
+					double wr = twiddles[k * stride].real();
+					double wi = inverse ? -twiddles[k * stride].imag() : twiddles[k * stride].imag();
+					std::complex<double> u = data[start + k];
+					std::complex<double> b = data[start + k + half];
+					std::complex<double> v(b.real() * wr - b.imag() * wi, b.real() * wi + b.imag() * wr);
+					data[start + k] = u + v;
+					data[start + k + half] = u - v;
+				}
+		}
+	}
+
+private:
+	int n;
+	std::vector<std::complex<double> > twiddles;
+	std::vector<int> reversed;
+};
@@ -0,0 +1,425 @@
+// Fast multipole gravity solver with Cartesian Taylor expansions of order p.
+//
+// Each octree node carries multipole moments M_a = sum m (x - c)^a / a! about its center of mass c
+// and local coefficients L_b of the potential around the same point. Well separated node pairs
+// interact through M2L translations using the derivatives D_a of 1/r, close leaf pairs and
+// pairs of small nodes are summed directly. The interaction lists are found by a dual tree traversal, so the cost of a step grows
+// linearly with N, and each list entry only writes to its target node.
+class FmmSolver : public GravitySolver
+{
+public:
+	FmmSolver() : theta(0.6), order(0)
+	{
+		tree.leafSize = 24;
+		setOrder(4);
+	}
+
+	const char* name() const override
+	{
+		return "FMM";
+	}
+
+	// expansion order p, between 1 (monopole forces) and 10
+	void setOrder(int p)
+	{
+		p = std::max(1, std::min(p, 10));
+		if (p == order)
+			return;
+		order = p;
+
+		// multi-indices in graded order, with lookup table and 1/a!
+		powers.clear();
+		indices.assign((p + 1) * (p + 1) * (p + 1), -1);
+		for (int n = 0; n <= p; n++)
+			for (int a = n; a >= 0; a--)
+				for (int b = n - a; b >= 0; b--)
+				{
+					int c = n - a - b;
+					indices[(a * (p + 1) + b) * (p + 1) + c] = (int)powers.size();
+					powers.push_back(MultiIndex(a, b, c));
+				}
+		terms = (int)powers.size();
+
+		// M2L: L_b += sum over a of (-1)^|a| M_a D_(a+b)
+		translation.clear();
+		for (int b = 0; b < terms; b++)
+			for (int a = 0; a < terms; a++)
+				if (powers[a].n + powers[b].n <= p)
+					translation.push_back(Term(b, a, find(powers[a] + powers[b]), powers[a].n % 2 ? -1 : 1));
+
+		// M2M and L2L: shifts by a vector s use s^(g - a) / (g - a)! for a <= g
+		shift.clear();
+		for (int g = 0; g < terms; g++)
+			for (int a = 0; a < terms; a++)
+				if (powers[a] <= powers[g])
+					shift.push_back(Term(g, a, find(powers[g] - powers[a]), 1));
+
+		// L2P: acceleration component k uses L_(g + e_k) for |g| < p
+		gradient.clear();
+		for (int g = 0; g < terms; g++)
+			if (powers[g].n < p)
+				for (int k = 0; k < 3; k++)
+					gradient.push_back(Term(k, g, find(powers[g] + MultiIndex(k == 0, k == 1, k == 2)), 1));
+
+		// derivatives of 1/r: n r^2 D_a = -(2n - 1) sum_j a_j x_j D_(a - e_j) - (n - 1) sum_j a_j (a_j - 1) D_(a - 2 e_j)
+		recurrence.clear();
+		for (int t = 1; t < terms; t++)
+		{
+			const MultiIndex& index = powers[t];
+			const int exponents[3] = { index.a, index.b, index.c };
+			for (int j = 0; j < 3; j++)
+			{
+				if (exponents[j] == 0)
+					continue;
+				MultiIndex unit(j == 0, j == 1, j == 2);
+				Step step;
+				step.target = t;
+				step.axis = j;
+				step.first = find(index - unit);
+				step.firstFactor = -(double)(2 * index.n - 1) * exponents[j] / index.n;
+				step.second = exponents[j] > 1 ? find(index - unit - unit) : 0;
+				step.secondFactor = exponents[j] > 1 ? -(double)(index.n - 1) * exponents[j] * (exponents[j] - 1) / index.n : 0;
+				recurrence.push_back(step);
+			}
+		}
+
+		// node pairs with fewer body pairs than this are cheaper to sum directly
+		directLimit = 2 * terms;
+	}
+
+	int getOrder() const
+	{
+		return order;
+	}
+
+	void computeAccelerations(BodySystem& bodies) override
+	{
+		const int n = bodies.size();
+		tree.build(bodies, n);
+		if (n == 0)
+			return;
+
+		// upward pass: children come after their parents in the node array
+		const int nodeCount = (int)tree.nodes.size();
+		workspace.resize(threadCount() * terms);
+		multipoles.assign(nodeCount * terms, 0);
+		locals.assign(nodeCount * terms, 0);
+		for (int node = nodeCount - 1; node >= 0; node--)
+			upward(node);
+
+		// interaction lists grouped by target node, the targets of near pairs are leaves
+		farPairs.clear();
+		nearPairs.clear();
+		interact(0, 0);
+		groupByTarget(farPairs, farBegin);
+		groupByTarget(nearPairs, nearBegin);
+
+		// far field: multipole to local translations, each target node on one thread
+		parallelFor(nodeCount, 16, [&](int begin, int end, int thread)
+		{
+			for (int k = farBegin[begin]; k < farBegin[end]; k++)
+				multipoleToLocal(farPairs[k].first, farPairs[k].second, thread);
+		});
+
+		// downward pass from parents to children
+		for (int node = 0; node < nodeCount; node++)
+			downward(node);
+
+		// local expansions to bodies, then direct sums with neighboring leaves and small nodes
+		leaves.clear();
+		for (int node = 0; node < nodeCount; node++)
+			if (tree.nodes[node].childCount == 0)
+				leaves.push_back(node);
+		parallelFor((int)leaves.size(), 8, [&](int begin, int end, int thread)
+		{
+			for (int k = begin; k < end; k++)
+			{
+				const int leaf = leaves[k];
+				localToBodies(bodies, leaf, thread);
+				for (int l = nearBegin[leaf]; l < nearBegin[leaf + 1]; l++)
+					leafToLeaf(bodies, leaf, nearPairs[l].second);
+			}
+		});
+	}
+
+	double theta; // opening angle, smaller is more accurate
+	Octree tree;
+
+private:
+	struct MultiIndex
+	{
+		MultiIndex(int a_, int b_, int c_) : a(a_), b(b_), c(c_), n(a_ + b_ + c_)
+		{
+		}
+
+		MultiIndex operator+(const MultiIndex& other) const
+		{
+			return MultiIndex(a + other.a, b + other.b, c + other.c);
+		}
+
+		MultiIndex operator-(const MultiIndex& other) const
+		{
+			return MultiIndex(a - other.a, b - other.b, c - other.c);
+		}
+
+		bool operator<=(const MultiIndex& other) const
+		{
+			return a <= other.a && b <= other.b && c <= other.c;
+		}
+
+		int a, b, c, n;
+	};
+
+	// coefficient entry: target term, source term, table term, sign
+	struct Term
+	{
+		Term(int target_, int source_, int table_, int sign_) : target(target_), source(source_), table(table_), sign(sign_)
+		{
+		}
+
+		int target, source, table, sign;
+	};
+
+	int find(const MultiIndex& index) const
+	{
+		return indices[(index.a * (order + 1) + index.b) * (order + 1) + index.c];
+	}
+
+	// t^a / a! for all multi-indices
+	void monomials(double x, double y, double z, double* result) const
+	{
+		result[0] = 1;
+		for (int t = 1; t < terms; t++)
+		{
+			// extend a lower monomial by one factor, dividing by the new exponent
+			const MultiIndex& p = powers[t];
+			if (p.a > 0)
+				result[t] = result[find(p - MultiIndex(1, 0, 0))] * x / p.a;
+			else if (p.b > 0)
+				result[t] = result[find(p - MultiIndex(0, 1, 0))] * y / p.b;
+			else
+				result[t] = result[find(p - MultiIndex(0, 0, 1))] * z / p.c;
+		}
+	}
+
+	// one term of the recurrence for derivatives of 1/r
+	struct Step
+	{
+		int target, axis, first, second;
+		double firstFactor, secondFactor;
+	};
+
+	// derivatives D_a of 1/r at r = (x, y, z), terms in graded order
+	void derivativesOfInverse(double x, double y, double z, double* result) const
+	{
+		const double r[3] = { x, y, z };
+		double r2 = x * x + y * y + z * z;
+		double inverseR2 = 1 / r2;
+		result[0] = sqrt(inverseR2);
+		for (int t = 1; t < terms; t++)
+			result[t] = 0;
+		for (const Step& step : recurrence)
+			result[step.target] += (step.firstFactor * r[step.axis] * result[step.first] + step.secondFactor * result[step.second]) * inverseR2;
+	}
+
+	void upward(int node)
+	{
+		const OctreeNode& n = tree.nodes[node];
+		double* moments = &multipoles[node * terms];
+		double* powersOfShift = workspace.data();
+
+		if (n.childCount == 0)
+		{
+			// bodies to multipole
+			for (int k = n.begin; k < n.end; k++)
+			{
+				monomials(tree.x[k] - n.mx, tree.y[k] - n.my, tree.z[k] - n.mz, powersOfShift);
+				for (int t = 0; t < terms; t++)
+					moments[t] += tree.m[k] * powersOfShift[t];
+			}
+		}
+		else
+		{
+			// children multipoles shifted to the parent center
+			for (int c = n.firstChild; c < n.firstChild + n.childCount; c++)
+			{
+				const OctreeNode& child = tree.nodes[c];
+				const double* childMoments = &multipoles[c * terms];
+				monomials(child.mx - n.mx, child.my - n.my, child.mz - n.mz, powersOfShift);
+				for (const Term& term : shift)
+					moments[term.target] += childMoments[term.source] * powersOfShift[term.table];
+			}
+		}
+	}
+
+	// dual tree traversal collecting well separated pairs and neighboring leaves
+	void interact(int a, int b)
+	{
+		const OctreeNode& na = tree.nodes[a];
+		const OctreeNode& nb = tree.nodes[b];
+
+		if (a == b)
+		{
+			if (na.childCount == 0)
+				nearPairs.push_back(std::make_pair(a, a));
+			else
+				for (int i = na.firstChild; i < na.firstChild + na.childCount; i++)
+					for (int j = i; j < na.firstChild + na.childCount; j++)
+						interact(i, j);
+			return;
+		}
+
+		double dx = na.mx - nb.mx, dy = na.my - nb.my, dz = na.mz - nb.mz;
+		double distance = sqrt(dx * dx + dy * dy + dz * dz);
+		if ((double)(na.end - na.begin) * (nb.end - nb.begin) <= directLimit)
+		{
+			// few bodies: direct summation is cheaper than expansions
+			nearPair(a, b);
+			nearPair(b, a);
+		}
+		else if (na.radius + nb.radius < theta * distance)
+		{
+			farPairs.push_back(std::make_pair(a, b));
+			farPairs.push_back(std::make_pair(b, a));
+		}
+		else if (na.childCount == 0 && nb.childCount == 0)
+		{
+			nearPairs.push_back(std::make_pair(a, b));
+			nearPairs.push_back(std::make_pair(b, a));
+		}
+		else if (nb.childCount == 0 || (na.childCount > 0 && na.radius >= nb.radius))
+		{
+			// split the larger node
+			for (int i = na.firstChild; i < na.firstChild + na.childCount; i++)
+				interact(i, b);
+		}
+		else
+		{
+			for (int j = nb.firstChild; j < nb.firstChild + nb.childCount; j++)
+				interact(a, j);
+		}
+	}
+
+	// near field pair, with the target split into its leaves
+	void nearPair(int target, int source)
+	{
+		const OctreeNode& t = tree.nodes[target];
+		if (t.childCount == 0)
+			nearPairs.push_back(std::make_pair(target, source));
+		else
+			for (int c = t.firstChild; c < t.firstChild + t.childCount; c++)
+				nearPair(c, source);
+	}
+
+	// stable counting sort of (target, source) pairs by target, with the start of each target's pairs
+	void groupByTarget(std::vector<std::pair<int, int> >& pairs, std::vector<int>& begin)
+	{
+		const int nodeCount = (int)tree.nodes.size();
+		begin.assign(nodeCount + 1, 0);
+		for (const std::pair<int, int>& pair : pairs)
+			begin[pair.first + 1]++;
+		for (int node = 0; node < nodeCount; node++)
+			begin[node + 1] += begin[node];
+
+		grouped.resize(pairs.size());
+		std::vector<int> next(begin.begin(), begin.end() - 1);
+		for (const std::pair<int, int>& pair : pairs)
+			grouped[next[pair.first]++] = pair;
+		pairs.swap(grouped);
+	}
+
+	void multipoleToLocal(int target, int source, int thread)
+	{
+		const OctreeNode& t = tree.nodes[target];
+		const OctreeNode& s = tree.nodes[source];
+		double* derivatives = &workspace[thread * terms];
+		derivativesOfInverse(t.mx - s.mx, t.my - s.my, t.mz - s.mz, derivatives);
+
+		const double* moments = &multipoles[source * terms];
+		double* coefficients = &locals[target * terms];
+		for (const Term& term : translation)
+			coefficients[term.target] += term.sign * moments[term.source] * derivatives[term.table];
+	}
+
+	void downward(int node)
+	{
+		const OctreeNode& n = tree.nodes[node];
+		const double* coefficients = &locals[node * terms];
+		double* powersOfShift = workspace.data();
+
+		// parent locals shifted to each child center
+		for (int c = n.firstChild; c < n.firstChild + n.childCount; c++)
+		{
+			const OctreeNode& child = tree.nodes[c];
+			double* childCoefficients = &locals[c * terms];
+			monomials(child.mx - n.mx, child.my - n.my, child.mz - n.mz, powersOfShift);
+			for (const Term& term : shift)
+				childCoefficients[term.source] += coefficients[term.target] * powersOfShift[term.table];
+		}
+	}
+
+	void localToBodies(BodySystem& bodies, int node, int thread)
+	{
+		const OctreeNode& n = tree.nodes[node];
+		const double* coefficients = &locals[node * terms];
+		double* powersOfOffset = &workspace[thread * terms];
+
+		// a = G * sum over g of y^g / g! * L_(g + e_k)
+		for (int k = n.begin; k < n.end; k++)
+		{
+			monomials(tree.x[k] - n.mx, tree.y[k] - n.my, tree.z[k] - n.mz, powersOfOffset);
+			double a[3] = { 0, 0, 0 };
+			for (const Term& term : gradient)
+				a[term.target] += powersOfOffset[term.source] * coefficients[term.table];
+
+			int i = tree.index[k];
+			bodies.ax[i] = gravity * a[0];
+			bodies.ay[i] = gravity * a[1];
+			bodies.az[i] = gravity * a[2];
+		}
+	}
+
+	void leafToLeaf(BodySystem& bodies, int target, int source)
+	{
+		const OctreeNode& t = tree.nodes[target];
+		const OctreeNode& s = tree.nodes[source];
+		const double* x = tree.x.data();
+		const double* y = tree.y.data();
+		const double* z = tree.z.data();
+		const double* m = tree.m.data();
+
+		for (int k = t.begin; k < t.end; k++)
+		{
+			double ax = 0, ay = 0, az = 0;
+			for (int l = s.begin; l < s.end; l++)
+			{
+				double dx = x[l] - x[k], dy = y[l] - y[k], dz = z[l] - z[k];
+				double r2 = dx * dx + dy * dy + dz * dz;
+				if (r2 > 0)
+				{
+					double f = m[l] / (r2 * sqrt(r2));
+					ax += dx * f;
+					ay += dy * f;
+					az += dz * f;
+				}
+			}
+
+			int i = tree.index[k];
+			bodies.ax[i] += gravity * ax;
+			bodies.ay[i] += gravity * ay;
+			bodies.az[i] += gravity * az;
+		}
+	}
+
+	int order, terms;
+	double directLimit;
+	std::vector<MultiIndex> powers;           // multi-indices in graded order
+	std::vector<int> indices;                 // multi-index to term lookup
+	std::vector<Term> translation, shift, gradient;
+	std::vector<Step> recurrence;
+	std::vector<double> multipoles, locals;   // per node, terms each
+	std::vector<double> workspace;            // monomials or derivatives of one expansion per thread
+	std::vector<std::pair<int, int> > farPairs, nearPairs, grouped; // (target, source) node pairs
+	std::vector<int> farBegin, nearBegin;     // start of each target's pairs
+	std::vector<int> leaves;
+};
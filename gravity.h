@@ -0,0 +1,756 @@
+#if defined(_M_X64) || defined(__x86_64__)
+#define GRAVITY_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_TARGET(features)
+#else
+#define SIMD_TARGET(features) __attribute__((target(features)))
+#endif
+#endif
+
+// gravitational constant (m^3 kg^-1 s^-2)
+const double gravity = 6.6743e-11;
+
+// instruction sets supported by the acceleration kernels
+enum SimdLevel
+{
+	simdScalar,
+	simdSSE2,
+	simdAVX2,
+	simdAVX512
+};
+
+const char* simdLevelNames[] = { "scalar", "SSE2", "AVX2", "AVX-512" };
+
+SimdLevel detectSimdLevel()
+{
+#if defined(GRAVITY_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	bool sse2 = (info[3] >> 26) & 1;
+	bool fma = (info[2] >> 12) & 1;
+	bool osxsave = (info[2] >> 27) & 1;
+
+	// the OS must save YMM (and ZMM) registers on context switches
+	unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool ymmEnabled = (xcr0 & 0x06) == 0x06;
+	bool zmmEnabled = (xcr0 & 0xe6) == 0xe6;
+
+	bool avx2 = false, avx512 = false;
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] >> 5) & 1;
+		avx512 = (info[1] >> 16) & 1;
+	}
+
+	if (avx512 && zmmEnabled && avx2 && fma)
+		return simdAVX512;
+	if (avx2 && fma && ymmEnabled)
+		return simdAVX2;
+	if (sse2)
+		return simdSSE2;
+#elif defined(GRAVITY_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return simdAVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return simdAVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return simdSSE2;
+#endif
+	return simdScalar;
+}
+
+// best kernel of this CPU, and the kernel currently in use (may be lowered for comparisons)
+const SimdLevel supportedSimdLevel = detectSimdLevel();
+SimdLevel simdLevel = supportedSimdLevel;
+
+// Acceleration kernels: for each body i in [begin, end), sum G*m_j*(p_j - p_i)/r^3 over all
+// other bodies and store it in ax, ay, az. Padding entries are massless and contribute nothing;
+// pairs at zero distance (the body itself) are skipped.
+//
+// The AVX2 and AVX-512 kernels start from a hardware reciprocal square root estimate
+// (12 and 14 bits) and refine it with two Newton steps. Their results match the scalar kernel
+// to a relative error below 1e-12 per acceleration. The AVX2 estimate is computed in single
+// precision, so separations must stay between 1e-18 m and 1e18 m (far beyond any scenario).
+
+void accelerationRowsScalar(BodySystem& bodies, int begin, int end)
+{
+	const double* x = bodies.x.data();
+	const double* y = bodies.y.data();
+	const double* z = bodies.z.data();
+	const double* m = bodies.m.data();
+	const int n = bodies.size();
+
+	for (int i = begin; i < end; i++)
+	{
+		double ax = 0, ay = 0, az = 0;
+		for (int j = 0; j < n; j++)
+		{
+			double dx = x[j] - x[i];
+			double dy = y[j] - y[i];
+			double dz = z[j] - z[i];
+			double r2 = dx * dx + dy * dy + dz * dz;
+			if (r2 > 0)
+			{
+				double s = m[j] / (r2 * sqrt(r2));
+				ax += dx * s;
+				ay += dy * s;
+				az += dz * s;
+			}
+		}
+		bodies.ax[i] = gravity * ax;
+		bodies.ay[i] = gravity * ay;
+		bodies.az[i] = gravity * az;
+	}
+}
+
+#ifdef GRAVITY_X86
+SIMD_TARGET("sse2")
+double horizontalSum(__m128d v)
+{
+	return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+SIMD_TARGET("avx2,fma")
+double horizontalSum(__m256d v)
+{
+	__m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+// 1/r^3 from squared distances, zero where the distance is zero
+SIMD_TARGET("sse2")
+inline __m128d inverseCube(__m128d r2)
+{
+	// exact square root and division
+	__m128d s = _mm_div_pd(_mm_set1_pd(1.0), _mm_mul_pd(r2, _mm_sqrt_pd(r2)));
+	return _mm_and_pd(s, _mm_cmpgt_pd(r2, _mm_setzero_pd()));
+}
+
+SIMD_TARGET("avx2,fma")
+inline __m256d inverseCube(__m256d r2)
+{
+	// single precision estimate of 1/r, then two Newton steps y *= 1.5 - r2/2 * y^2
+	const __m256d threeHalves = _mm256_set1_pd(1.5);
+	__m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+	__m256d halfR2 = _mm256_mul_pd(_mm256_set1_pd(0.5), r2);
+	inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(_mm256_mul_pd(halfR2, inv), inv, threeHalves));
+	inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(_mm256_mul_pd(halfR2, inv), inv, threeHalves));
+
+	__m256d s = _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv));
+	return _mm256_and_pd(s, _mm256_cmp_pd(r2, _mm256_setzero_pd(), _CMP_GT_OQ));
+}
+
+SIMD_TARGET("sse2")
+void accelerationRowsSSE2(BodySystem& bodies, int begin, int end)
+{
+	const double* x = bodies.x.data();
+	const double* y = bodies.y.data();
+	const double* z = bodies.z.data();
+	const double* m = bodies.m.data();
+	const int n = bodies.paddedSize();
+	const __m128d zero = _mm_setzero_pd();
+
+	for (int i = begin; i < end; i++)
+	{
+		__m128d xi = _mm_set1_pd(x[i]), yi = _mm_set1_pd(y[i]), zi = _mm_set1_pd(z[i]);
+		__m128d ax = zero, ay = zero, az = zero;
+		for (int j = 0; j < n; j += 2)
+		{
+			__m128d dx = _mm_sub_pd(_mm_load_pd(x + j), xi);
+			__m128d dy = _mm_sub_pd(_mm_load_pd(y + j), yi);
+			__m128d dz = _mm_sub_pd(_mm_load_pd(z + j), zi);
+			__m128d r2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+			__m128d s = _mm_mul_pd(_mm_load_pd(m + j), inverseCube(r2));
+
+			ax = _mm_add_pd(ax, _mm_mul_pd(s, dx));
+			ay = _mm_add_pd(ay, _mm_mul_pd(s, dy));
+			az = _mm_add_pd(az, _mm_mul_pd(s, dz));
+		}
+		bodies.ax[i] = gravity * horizontalSum(ax);
+		bodies.ay[i] = gravity * horizontalSum(ay);
+		bodies.az[i] = gravity * horizontalSum(az);
+	}
+}
+
+SIMD_TARGET("avx2,fma")
+void accelerationRowsAVX2(BodySystem& bodies, int begin, int end)
+{
+	const double* x = bodies.x.data();
+	const double* y = bodies.y.data();
+	const double* z = bodies.z.data();
+	const double* m = bodies.m.data();
+	const int n = bodies.paddedSize();
+	const __m256d zero = _mm256_setzero_pd();
+
+	for (int i = begin; i < end; i++)
+	{
+		__m256d xi = _mm256_set1_pd(x[i]), yi = _mm256_set1_pd(y[i]), zi = _mm256_set1_pd(z[i]);
+		__m256d ax = zero, ay = zero, az = zero;
+		for (int j = 0; j < n; j += 4)
+		{
+			__m256d dx = _mm256_sub_pd(_mm256_load_pd(x + j), xi);
+			__m256d dy = _mm256_sub_pd(_mm256_load_pd(y + j), yi);
+			__m256d dz = _mm256_sub_pd(_mm256_load_pd(z + j), zi);
+			__m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz)));
+			__m256d s = _mm256_mul_pd(_mm256_load_pd(m + j), inverseCube(r2));
+
+			ax = _mm256_fmadd_pd(s, dx, ax);
+			ay = _mm256_fmadd_pd(s, dy, ay);
+			az = _mm256_fmadd_pd(s, dz, az);
+		}
+		bodies.ax[i] = gravity * horizontalSum(ax);
+		bodies.ay[i] = gravity * horizontalSum(ay);
+		bodies.az[i] = gravity * horizontalSum(az);
+	}
+}
+
+SIMD_TARGET("avx512f,avx2,fma")
+double horizontalSum(__m512d v)
+{
+	__m256d sum = _mm256_add_pd(_mm512_castpd512_pd256(v), _mm512_extractf64x4_pd(v, 1));
+	__m128d half = _mm_add_pd(_mm256_castpd256_pd128(sum), _mm256_extractf128_pd(sum, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+
+SIMD_TARGET("avx512f,avx2,fma")
+inline __m512d inverseCube(__m512d r2)
+{
+	// 14-bit estimate of 1/r, then two Newton steps
+	const __m512d threeHalves = _mm512_set1_pd(1.5);
+	__m512d inv = _mm512_rsqrt14_pd(r2);
+	__m512d halfR2 = _mm512_mul_pd(_mm512_set1_pd(0.5), r2);
+	inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(_mm512_mul_pd(halfR2, inv), inv, threeHalves));
+	inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(_mm512_mul_pd(halfR2, inv), inv, threeHalves));
+
+	__mmask8 nonzero = _mm512_cmp_pd_mask(r2, _mm512_setzero_pd(), _CMP_GT_OQ);
+	return _mm512_maskz_mul_pd(nonzero, inv, _mm512_mul_pd(inv, inv));
+}
+
+SIMD_TARGET("avx512f,avx2,fma")
+void accelerationRowsAVX512(BodySystem& bodies, int begin, int end)
+{
+	const double* x = bodies.x.data();
+	const double* y = bodies.y.data();
+	const double* z = bodies.z.data();
+	const double* m = bodies.m.data();
+	const int n = bodies.paddedSize();
+	const __m512d zero = _mm512_setzero_pd();
+
+	for (int i = begin; i < end; i++)
+	{
+		__m512d xi = _mm512_set1_pd(x[i]), yi = _mm512_set1_pd(y[i]), zi = _mm512_set1_pd(z[i]);
+		__m512d ax = zero, ay = zero, az = zero;
+		for (int j = 0; j < n; j += 8)
+		{
+			__m512d dx = _mm512_sub_pd(_mm512_load_pd(x + j), xi);
+			__m512d dy = _mm512_sub_pd(_mm512_load_pd(y + j), yi);
+			__m512d dz = _mm512_sub_pd(_mm512_load_pd(z + j), zi);
+			__m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz)));
+			__m512d s = _mm512_mul_pd(_mm512_load_pd(m + j), inverseCube(r2));
+
+			ax = _mm512_fmadd_pd(s, dx, ax);
+			ay = _mm512_fmadd_pd(s, dy, ay);
+			az = _mm512_fmadd_pd(s, dz, az);
+		}
+		bodies.ax[i] = gravity * horizontalSum(ax);
+		bodies.ay[i] = gravity * horizontalSum(ay);
+		bodies.az[i] = gravity * horizontalSum(az);
+	}
+}
+#endif
+
+// compute accelerations of bodies [begin, end) with the selected kernel
+void accelerationRows(BodySystem& bodies, int begin, int end)
+{
+	switch (simdLevel)
+	{
+#ifdef GRAVITY_X86
+	case simdAVX512:
+		accelerationRowsAVX512(bodies, begin, end);
+		break;
+	case simdAVX2:
+		accelerationRowsAVX2(bodies, begin, end);
+		break;
+	case simdSSE2:
+		accelerationRowsSSE2(bodies, begin, end);
+		break;
+#endif
+	default:
+		accelerationRowsScalar(bodies, begin, end);
+		break;
+	}
+}
+
+// Test particle kernels: bodies without mass feel the others but attract nothing, so only the
+// bodies with mass (the attractors, gathered into compact arrays) are summed. The cost is N*M
+// instead of N^2, and since M is small the SIMD lanes hold consecutive bodies of [begin, end),
+// which must be whole lane groups, while each attractor is broadcast to them. Bodies with mass
+// are handled alike, skipping themselves at zero distance.
+
+// copy of the positions and masses of the bodies with mass, padded to whole SIMD lanes
+struct Attractors
+{
+	Attractors() : count(0)
+	{
+	}
+
+	void gather(const BodySystem& bodies)
+	{
+		x.reserve(bodies.size());
+		y.reserve(bodies.size());
+		z.reserve(bodies.size());
+		m.reserve(bodies.size());
+		count = 0;
+		for (int i = 0; i < bodies.size(); i++)
+		{
+			if (bodies.m[i] == 0)
+				continue;
+			x[count] = bodies.x[i];
+			y[count] = bodies.y[i];
+			z[count] = bodies.z[i];
+			m[count] = bodies.m[i];
+			count++;
+		}
+	}
+
+	AlignedArray x, y, z, m;
+	int count;
+};
+
+void accelerationParticlesScalar(BodySystem& bodies, const Attractors& attractors, int begin, int end)
+{
+	const double* x = attractors.x.data();
+	const double* y = attractors.y.data();
+	const double* z = attractors.z.data();
+	const double* m = attractors.m.data();
+
+	for (int i = begin; i < end; i++)
+	{
+		double ax = 0, ay = 0, az = 0;
+		for (int j = 0; j < attractors.count; j++)
+		{
+			double dx = x[j] - bodies.x[i];
+			double dy = y[j] - bodies.y[i];
+			double dz = z[j] - bodies.z[i];
+			double r2 = dx * dx + dy * dy + dz * dz;
+			if (r2 > 0)
+			{
+				double s = m[j] / (r2 * sqrt(r2));
+				ax += dx * s;
+				ay += dy * s;
+				az += dz * s;
+			}
+		}
+		bodies.ax[i] = gravity * ax;
+		bodies.ay[i] = gravity * ay;
+		bodies.az[i] = gravity * az;
+	}
+}
+
+#ifdef GRAVITY_X86
+SIMD_TARGET("sse2")
+void accelerationParticlesSSE2(BodySystem& bodies, const Attractors& attractors, int begin, int end)
+{
+	const __m128d g = _mm_set1_pd(gravity);
+	for (int i = begin; i < end; i += 2)
+	{
+		__m128d xi = _mm_load_pd(bodies.x.data() + i), yi = _mm_load_pd(bodies.y.data() + i), zi = _mm_load_pd(bodies.z.data() + i);
+		__m128d ax = _mm_setzero_pd(), ay = _mm_setzero_pd(), az = _mm_setzero_pd();
+		for (int j = 0; j < attractors.count; j++)
+		{
+			__m128d dx = _mm_sub_pd(_mm_set1_pd(attractors.x[j]), xi);
+			__m128d dy = _mm_sub_pd(_mm_set1_pd(attractors.y[j]), yi);
+			__m128d dz = _mm_sub_pd(_mm_set1_pd(attractors.z[j]), zi);
+			__m128d r2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+			__m128d s = _mm_mul_pd(_mm_set1_pd(attractors.m[j]), inverseCube(r2));
+
+			ax = _mm_add_pd(ax, _mm_mul_pd(s, dx));
+			ay = _mm_add_pd(ay, _mm_mul_pd(s, dy));
+			az = _mm_add_pd(az, _mm_mul_pd(s, dz));
+		}
+		_mm_store_pd(bodies.ax.data() + i, _mm_mul_pd(g, ax));
+		_mm_store_pd(bodies.ay.data() + i, _mm_mul_pd(g, ay));
+		_mm_store_pd(bodies.az.data() + i, _mm_mul_pd(g, az));
+	}
+}
+
+SIMD_TARGET("avx2,fma")
+void accelerationParticlesAVX2(BodySystem& bodies, const Attractors& attractors, int begin, int end)
+{
+	const __m256d g = _mm256_set1_pd(gravity);
+	for (int i = begin; i < end; i += 4)
+	{
+		__m256d xi = _mm256_load_pd(bodies.x.data() + i), yi = _mm256_load_pd(bodies.y.data() + i), zi = _mm256_load_pd(bodies.z.data() + i);
+		__m256d ax = _mm256_setzero_pd(), ay = _mm256_setzero_pd(), az = _mm256_setzero_pd();
+		for (int j = 0; j < attractors.count; j++)
+		{
+			__m256d dx = _mm256_sub_pd(_mm256_set1_pd(attractors.x[j]), xi);
+			__m256d dy = _mm256_sub_pd(_mm256_set1_pd(attractors.y[j]), yi);
+			__m256d dz = _mm256_sub_pd(_mm256_set1_pd(attractors.z[j]), zi);
+			__m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz)));
+			__m256d s = _mm256_mul_pd(_mm256_set1_pd(attractors.m[j]), inverseCube(r2));
+
+			ax = _mm256_fmadd_pd(s, dx, ax);
+			ay = _mm256_fmadd_pd(s, dy, ay);
+			az = _mm256_fmadd_pd(s, dz, az);
+		}
+		_mm256_store_pd(bodies.ax.data() + i, _mm256_mul_pd(g, ax));
+		_mm256_store_pd(bodies.ay.data() + i, _mm256_mul_pd(g, ay));
+		_mm256_store_pd(bodies.az.data() + i, _mm256_mul_pd(g, az));
+	}
+}
+
+SIMD_TARGET("avx512f,avx2,fma")
+void accelerationParticlesAVX512(BodySystem& bodies, const Attractors& attractors, int begin, int end)
+{
+	const __m512d g = _mm512_set1_pd(gravity);
+	for (int i = begin; i < end; i += 8)
+	{
+		__m512d xi = _mm512_load_pd(bodies.x.data() + i), yi = _mm512_load_pd(bodies.y.data() + i), zi = _mm512_load_pd(bodies.z.data() + i);
+		__m512d ax = _mm512_setzero_pd(), ay = _mm512_setzero_pd(), az = _mm512_setzero_pd();
+		for (int j = 0; j < attractors.count; j++)
+		{
+			__m512d dx = _mm512_sub_pd(_mm512_set1_pd(attractors.x[j]), xi);
+			__m512d dy = _mm512_sub_pd(_mm512_set1_pd(attractors.y[j]), yi);
+			__m512d dz = _mm512_sub_pd(_mm512_set1_pd(attractors.z[j]), zi);
+			__m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz)));
+			__m512d s = _mm512_mul_pd(_mm512_set1_pd(attractors.m[j]), inverseCube(r2));
+
+			ax = _mm512_fmadd_pd(s, dx, ax);
+			ay = _mm512_fmadd_pd(s, dy, ay);
+			az = _mm512_fmadd_pd(s, dz, az);
+		}
+		_mm512_store_pd(bodies.ax.data() + i, _mm512_mul_pd(g, ax));
+		_mm512_store_pd(bodies.ay.data() + i, _mm512_mul_pd(g, ay));
+		_mm512_store_pd(bodies.az.data() + i, _mm512_mul_pd(g, az));
+	}
+}
+#endif
+
+// compute accelerations of bodies [begin, end) from the attractors with the selected kernel
+void accelerationParticles(BodySystem& bodies, const Attractors& attractors, int begin, int end)
+{
+	switch (simdLevel)
+	{
+#ifdef GRAVITY_X86
+	case simdAVX512:
+		accelerationParticlesAVX512(bodies, attractors, begin, end);
+		break;
+	case simdAVX2:
+		accelerationParticlesAVX2(bodies, attractors, begin, end);
+		break;
+	case simdSSE2:
+		accelerationParticlesSSE2(bodies, attractors, begin, end);
+		break;
+#endif
+	default:
+		accelerationParticlesScalar(bodies, attractors, begin, end);
+		break;
+	}
+}
+
+// Pair kernels: visit each unordered pair once and apply equal and opposite accelerations
+// (Newton's third law), which halves the work and conserves momentum to rounding error.
+// All accelerations are recomputed from the current positions before any body moves.
+
+void scaleAccelerations(BodySystem& bodies)
+{
+	for (int i = 0; i < bodies.size(); i++)
+	{
+		bodies.ax[i] *= gravity;
+		bodies.ay[i] *= gravity;
+		bodies.az[i] *= gravity;
+	}
+}
+
+void clearAccelerations(BodySystem& bodies)
+{
+	for (int i = 0; i < bodies.paddedSize(); i++)
+	{
+		bodies.ax[i] = 0;
+		bodies.ay[i] = 0;
+		bodies.az[i] = 0;
+	}
+}
+
+// accumulate pairs (i, j) with j in [begin, end) into ax, ay, az, without the gravitational constant
+void accumulatePairsScalar(BodySystem& bodies, int i, int begin, int end)
+{
+	const double* x = bodies.x.data();
+	const double* y = bodies.y.data();
+	const double* z = bodies.z.data();
+	const double* m = bodies.m.data();
+	double* ax = bodies.ax.data();
+	double* ay = bodies.ay.data();
+	double* az = bodies.az.data();
+
+	double axi = 0, ayi = 0, azi = 0;
+	for (int j = begin; j < end; j++)
+	{
+		double dx = x[j] - x[i];
+		double dy = y[j] - y[i];
+		double dz = z[j] - z[i];
+		double r2 = dx * dx + dy * dy + dz * dz;
+		if (r2 > 0)
+		{
+			double inv3 = 1 / (r2 * sqrt(r2));
+			double si = m[j] * inv3;
+			double sj = m[i] * inv3;
+			axi += dx * si;
+			ayi += dy * si;
+			azi += dz * si;
+			ax[j] -= dx * sj;
+			ay[j] -= dy * sj;
+			az[j] -= dz * sj;
+		}
+	}
+	ax[i] += axi;
+	ay[i] += ayi;
+	az[i] += azi;
+}
+
+void accelerationPairsScalar(BodySystem& bodies)
+{
+	clearAccelerations(bodies);
+	for (int i = 0; i < bodies.size(); i++)
+		accumulatePairsScalar(bodies, i, i + 1, bodies.size());
+	scaleAccelerations(bodies);
+}
+
+#ifdef GRAVITY_X86
+SIMD_TARGET("sse2")
+void accelerationPairsSSE2(BodySystem& bodies)
+{
+	const double* x = bodies.x.data();
+	const double* y = bodies.y.data();
+	const double* z = bodies.z.data();
+	const double* m = bodies.m.data();
+	double* ax = bodies.ax.data();
+	double* ay = bodies.ay.data();
+	double* az = bodies.az.data();
+	const int n = bodies.size();
+	const int padded = bodies.paddedSize();
+
+	clearAccelerations(bodies);
+	for (int i = 0; i < n; i++)
+	{
+		__m128d xi = _mm_set1_pd(x[i]), yi = _mm_set1_pd(y[i]), zi = _mm_set1_pd(z[i]), mi = _mm_set1_pd(m[i]);
+		__m128d axi = _mm_setzero_pd(), ayi = _mm_setzero_pd(), azi = _mm_setzero_pd();
+
+		// partners after i, in unaligned blocks (massless padding absorbs the overrun)
+		int j = i + 1;
+		for (; j + 2 <= padded; j += 2)
+		{
+			__m128d dx = _mm_sub_pd(_mm_loadu_pd(x + j), xi);
+			__m128d dy = _mm_sub_pd(_mm_loadu_pd(y + j), yi);
+			__m128d dz = _mm_sub_pd(_mm_loadu_pd(z + j), zi);
+			__m128d r2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+			__m128d inv3 = inverseCube(r2);
+			__m128d si = _mm_mul_pd(_mm_loadu_pd(m + j), inv3);
+			__m128d sj = _mm_mul_pd(mi, inv3);
+
+			axi = _mm_add_pd(axi, _mm_mul_pd(si, dx));
+			ayi = _mm_add_pd(ayi, _mm_mul_pd(si, dy));
+			azi = _mm_add_pd(azi, _mm_mul_pd(si, dz));
+			_mm_storeu_pd(ax + j, _mm_sub_pd(_mm_loadu_pd(ax + j), _mm_mul_pd(sj, dx)));
+			_mm_storeu_pd(ay + j, _mm_sub_pd(_mm_loadu_pd(ay + j), _mm_mul_pd(sj, dy)));
+			_mm_storeu_pd(az + j, _mm_sub_pd(_mm_loadu_pd(az + j), _mm_mul_pd(sj, dz)));
+		}
+		ax[i] += horizontalSum(axi);
+		ay[i] += horizontalSum(ayi);
+		az[i] += horizontalSum(azi);
+
+		// remaining partners near the end of the arrays
+		accumulatePairsScalar(bodies, i, j, n);
+	}
+	scaleAccelerations(bodies);
+}
+
+SIMD_TARGET("avx2,fma")
+void accelerationPairsAVX2(BodySystem& bodies)
+{
+	const double* x = bodies.x.data();
+	const double* y = bodies.y.data();
+	const double* z = bodies.z.data();
+	const double* m = bodies.m.data();
+	double* ax = bodies.ax.data();
+	double* ay = bodies.ay.data();
+	double* az = bodies.az.data();
+	const int n = bodies.size();
+	const int padded = bodies.paddedSize();
+
+	clearAccelerations(bodies);
+	for (int i = 0; i < n; i++)
+	{
+		__m256d xi = _mm256_set1_pd(x[i]), yi = _mm256_set1_pd(y[i]), zi = _mm256_set1_pd(z[i]), mi = _mm256_set1_pd(m[i]);
+		__m256d axi = _mm256_setzero_pd(), ayi = _mm256_setzero_pd(), azi = _mm256_setzero_pd();
+
+		// partners after i, in unaligned blocks (massless padding absorbs the overrun)
+		int j = i + 1;
+		for (; j + 4 <= padded; j += 4)
+		{
+			__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), xi);
+			__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), yi);
+			__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + j), zi);
+			__m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz)));
+			__m256d inv3 = inverseCube(r2);
+			__m256d si = _mm256_mul_pd(_mm256_loadu_pd(m + j), inv3);
+			__m256d sj = _mm256_mul_pd(mi, inv3);
+
+			axi = _mm256_fmadd_pd(si, dx, axi);
+			ayi = _mm256_fmadd_pd(si, dy, ayi);
+			azi = _mm256_fmadd_pd(si, dz, azi);
+			_mm256_storeu_pd(ax + j, _mm256_fnmadd_pd(sj, dx, _mm256_loadu_pd(ax + j)));
+			_mm256_storeu_pd(ay + j, _mm256_fnmadd_pd(sj, dy, _mm256_loadu_pd(ay + j)));
+			_mm256_storeu_pd(az + j, _mm256_fnmadd_pd(sj, dz, _mm256_loadu_pd(az + j)));
+		}
+		ax[i] += horizontalSum(axi);
+		ay[i] += horizontalSum(ayi);
+		az[i] += horizontalSum(azi);
+
+		// remaining partners near the end of the arrays
+		accumulatePairsScalar(bodies, i, j, n);
+	}
+	scaleAccelerations(bodies);
+}
+
+SIMD_TARGET("avx512f,avx2,fma")
+void accelerationPairsAVX512(BodySystem& bodies)
+{
+	const double* x = bodies.x.data();
+	const double* y = bodies.y.data();
+	const double* z = bodies.z.data();
+	const double* m = bodies.m.data();
+	double* ax = bodies.ax.data();
+	double* ay = bodies.ay.data();
+	double* az = bodies.az.data();
+	const int n = bodies.size();
+	const int padded = bodies.paddedSize();
+
+	clearAccelerations(bodies);
+	for (int i = 0; i < n; i++)
+	{
+		__m512d xi = _mm512_set1_pd(x[i]), yi = _mm512_set1_pd(y[i]), zi = _mm512_set1_pd(z[i]), mi = _mm512_set1_pd(m[i]);
+		__m512d axi = _mm512_setzero_pd(), ayi = _mm512_setzero_pd(), azi = _mm512_setzero_pd();
+
+		// partners after i, in unaligned blocks (massless padding absorbs the overrun)
+		int j = i + 1;
+		for (; j + 8 <= padded; j += 8)
+		{
+			__m512d dx = _mm512_sub_pd(_mm512_loadu_pd(x + j), xi);
+			__m512d dy = _mm512_sub_pd(_mm512_loadu_pd(y + j), yi);
+			__m512d dz = _mm512_sub_pd(_mm512_loadu_pd(z + j), zi);
+			__m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz)));
+			__m512d inv3 = inverseCube(r2);
+			__m512d si = _mm512_mul_pd(_mm512_loadu_pd(m + j), inv3);
+			__m512d sj = _mm512_mul_pd(mi, inv3);
+
+			axi = _mm512_fmadd_pd(si, dx, axi);
+			ayi = _mm512_fmadd_pd(si, dy, ayi);
+			azi = _mm512_fmadd_pd(si, dz, azi);
+			_mm512_storeu_pd(ax + j, _mm512_fnmadd_pd(sj, dx, _mm512_loadu_pd(ax + j)));
+			_mm512_storeu_pd(ay + j, _mm512_fnmadd_pd(sj, dy, _mm512_loadu_pd(ay + j)));
+			_mm512_storeu_pd(az + j, _mm512_fnmadd_pd(sj, dz, _mm512_loadu_pd(az + j)));
+		}
+		ax[i] += horizontalSum(axi);
+		ay[i] += horizontalSum(ayi);
+		az[i] += horizontalSum(azi);
+
+		// remaining partners near the end of the arrays
+		accumulatePairsScalar(bodies, i, j, n);
+	}
+	scaleAccelerations(bodies);
+}
+#endif
+
+// compute accelerations of all bodies with the selected pair kernel
+void accelerationPairs(BodySystem& bodies)
+{
+	switch (simdLevel)
+	{
+#ifdef GRAVITY_X86
+	case simdAVX512:
+		accelerationPairsAVX512(bodies);
+		break;
+	case simdAVX2:
+		accelerationPairsAVX2(bodies);
+		break;
+	case simdSSE2:
+		accelerationPairsSSE2(bodies);
+		break;
+#endif
+	default:
+		accelerationPairsScalar(bodies);
+		break;
+	}
+}
+
+// interface of gravity solvers, which fill ax, ay, az from the current positions
+class GravitySolver
+{
+public:
+	GravitySolver() : pool(nullptr)
+	{
+	}
+
+	virtual ~GravitySolver()
+	{
+	}
+
+	virtual const char* name() const = 0;
+	virtual void computeAccelerations(BodySystem& bodies) = 0;
+
+	ThreadPool* pool; // worker threads, or null to run on the calling thread
+
+protected:
+	int threadCount() const
+	{
+		return pool ? pool->getThreadCount() : 1;
+	}
+
+	// calls task(begin, end, thread) for blocks of [0, count), on the pool if there is one
+	void parallelFor(int count, int blockSize, const std::function<void(int, int, int)>& task)
+	{
+		if (pool)
+			pool->parallelFor(count, blockSize, task);
+		else if (count > 0)
+			task(0, count, 0);
+	}
+};
+
+// exact summation over all pairs, O(N^2), or O(N*M) over the M bodies with mass when the others are massless
+class DirectSolver : public GravitySolver
+{
+public:
+	const char* name() const override
+	{
+		return "direct";
+	}
+
+	void computeAccelerations(BodySystem& bodies) override
+	{
+		// with enough massless bodies only the attractors are summed, in blocks of 64 bodies
+		attractors.gather(bodies);
+		const int lanes = BodySystem::lanes;
+		if (attractors.count < bodies.size() && (threadCount() > 1 || 2 * attractors.count < bodies.size()))
+		{
+			parallelFor(bodies.paddedSize() / lanes, 8, [&](int begin, int end, int) { accelerationParticles(bodies, attractors, begin * lanes, end * lanes); });
+			return;
+		}
+
+		// one thread uses each pair once, several threads sum whole rows so that no two write the same body
+		if (threadCount() == 1)
+			accelerationPairs(bodies);
+		else
+			parallelFor(bodies.size(), 64, [&](int begin, int end, int) { accelerationRows(bodies, begin, end); });
+	}
+
+private:
+	Attractors attractors;
+};
@@ -0,0 +1,767 @@
+// scheme advancing positions, velocities, and spin angles of a body system by one time step
+class Integrator
+{
+public:
+	Integrator() : forceEvaluations(0), cached(false)
+	{
+	}
+
+	virtual ~Integrator()
+	{
+	}
+
+	virtual const char* name() const = 0;
+	virtual int order() const = 0;
+
+	// force evaluations per step, once the accelerations of the first step are known
+	virtual int evaluationsPerStep() const = 0;
+
+	virtual void step(BodySystem& bodies, GravitySolver& solver, double dt) = 0;
+
+	// forgets the accelerations kept from the previous step, needed whenever bodies were changed
+	virtual void reset()
+	{
+		cached = false;
+	}
+
+	// writes or reads what is carried from one step to the next, for checkpoints
+	virtual void serialize(Archive& archive)
+	{
+		archive.value(forceEvaluations);
+		archive.value(cached);
+	}
+
+	long long forceEvaluations; // since the start
+
+protected:
+	void evaluate(BodySystem& bodies, GravitySolver& solver)
+	{
+		solver.computeAccelerations(bodies);
+		forceEvaluations++;
+		cached = true;
+	}
+
+	// accelerations at the current positions, reused from the end of the previous step if possible
+	void prepare(BodySystem& bodies, GravitySolver& solver)
+	{
+		if (!cached)
+			evaluate(bodies, solver);
+	}
+
+	static void kick(BodySystem& bodies, double dt)
+	{
+		const int n = bodies.size();
+		for (int i = 0; i < n; i++)
+		{
+			bodies.vx[i] += bodies.ax[i] * dt;
+			bodies.vy[i] += bodies.ay[i] * dt;
+			bodies.vz[i] += bodies.az[i] * dt;
+		}
+	}
+
+	static void drift(BodySystem& bodies, double dt)
+	{
+		const int n = bodies.size();
+		for (int i = 0; i < n; i++)
+		{
+			bodies.x[i] += bodies.vx[i] * dt;
+			bodies.y[i] += bodies.vy[i] * dt;
+			bodies.z[i] += bodies.vz[i] * dt;
+			bodies.rotAngle[i] += bodies.rotSpeed[i] * dt;
+		}
+	}
+
+	bool cached; // accelerations belong to the current positions
+};
+
+// first-order semi-implicit Euler: kick with the current forces, then drift
+class EulerIntegrator : public Integrator
+{
+public:
+	const char* name() const override
+	{
+		return "semi-implicit Euler";
+	}
+
+	int order() const override
+	{
+		return 1;
+	}
+
+	int evaluationsPerStep() const override
+	{
+		return 1;
+	}
+
+	void step(BodySystem& bodies, GravitySolver& solver, double dt) override
+	{
+		prepare(bodies, solver);
+		kick(bodies, dt);
+		drift(bodies, dt);
+		cached = false;
+	}
+};
+
+// second-order kick-drift-kick leapfrog; the forces at the end of a step start the next one
+class LeapfrogIntegrator : public Integrator
+{
+public:
+	const char* name() const override
+	{
+		return "leapfrog";
+	}
+
+	int order() const override
+	{
+		return 2;
+	}
+
+	int evaluationsPerStep() const override
+	{
+		return 1;
+	}
+
+	void step(BodySystem& bodies, GravitySolver& solver, double dt) override
+	{
+		prepare(bodies, solver);
+		kick(bodies, 0.5 * dt);
+		drift(bodies, dt);
+		evaluate(bodies, solver);
+		kick(bodies, 0.5 * dt);
+	}
+};
+
+// second-order velocity Verlet: positions from a Taylor step, velocities from the mean of old and new forces
+class VerletIntegrator : public Integrator
+{
+public:
+	const char* name() const override
+	{
+		return "velocity Verlet";
+	}
+
+	int order() const override
+	{
+		return 2;
+	}
+
+	int evaluationsPerStep() const override
+	{
+		return 1;
+	}
+
+	void step(BodySystem& bodies, GravitySolver& solver, double dt) override
+	{
+		prepare(bodies, solver);
+		const int n = bodies.size();
+		previous.resize(3 * n);
+		for (int i = 0; i < n; i++)
+		{
+			bodies.x[i] += (bodies.vx[i] + 0.5 * bodies.ax[i] * dt) * dt;
+			bodies.y[i] += (bodies.vy[i] + 0.5 * bodies.ay[i] * dt) * dt;
+			bodies.z[i] += (bodies.vz[i] + 0.5 * bodies.az[i] * dt) * dt;
+			bodies.rotAngle[i] += bodies.rotSpeed[i] * dt;
+			previous[3 * i] = bodies.ax[i];
+			previous[3 * i + 1] = bodies.ay[i];
+			previous[3 * i + 2] = bodies.az[i];
+		}
+
+		evaluate(bodies, solver);
+		for (int i = 0; i < n; i++)
+		{
+			bodies.vx[i] += 0.5 * (previous[3 * i] + bodies.ax[i]) * dt;
+			bodies.vy[i] += 0.5 * (previous[3 * i + 1] + bodies.ay[i]) * dt;
+			bodies.vz[i] += 0.5 * (previous[3 * i + 2] + bodies.az[i]) * dt;
+		}
+	}
+
+private:
+	std::vector<double> previous; // accelerations at the start of the step
+};
+
+// symmetric composition of leapfrog steps with weights w, which raises the order of the scheme
+// (Yoshida 1990); each stage costs one force evaluation
+class CompositionIntegrator : public Integrator
+{
+public:
+	CompositionIntegrator(const char* name_, int order_, const std::vector<double>& weights_) : label(name_), accuracy(order_), weights(weights_)
+	{
+	}
+
+	const char* name() const override
+	{
+		return label;
+	}
+
+	int order() const override
+	{
+		return accuracy;
+	}
+
+	int evaluationsPerStep() const override
+	{
+		return (int)weights.size();
+	}
+
+	void step(BodySystem& bodies, GravitySolver& solver, double dt) override
+	{
+		prepare(bodies, solver);
+		for (double w : weights)
+		{
+			kick(bodies, 0.5 * w * dt);
+			drift(bodies, w * dt);
+			evaluate(bodies, solver);
+			kick(bodies, 0.5 * w * dt);
+		}
+	}
+
+private:
+	const char* label;
+	int accuracy;
+	std::vector<double> weights;
+};
+
+// fourth-order triple jump, also known as the Forest-Ruth integrator
+std::vector<double> yoshida4Weights()
+{
+	const double cubeRoot = pow(2.0, 1.0 / 3.0);
+	const double outer = 1 / (2 - cubeRoot);
+	const double middle = -cubeRoot / (2 - cubeRoot);
+	return std::vector<double>({ outer, middle, outer });
+}
+
+// sixth-order composition of seven stages, solution A of Yoshida (1990)
+std::vector<double> yoshida6Weights()
+{
+	const double w1 = -1.17767998417887, w2 = 0.235573213359357, w3 = 0.784513610477560;
+	const double w0 = 1 - 2 * (w1 + w2 + w3);
+	return std::vector<double>({ w3, w2, w1, w0, w1, w2, w3 });
+}
+
+// Wisdom-Holman map in democratic heliocentric coordinates (Duncan, Levison & Lee 1998).
+//
+// Positions are taken relative to the central body, the most massive one, and velocities relative
+// to the barycenter. A step is a half kick from the interactions between the other bodies, a half
+// jump of the central body by the total momentum, exact Kepler orbits around the central body, and
+// the same jump and kick again. Since the Kepler part carries almost all of the motion, the error
+// only depends on the much weaker interactions, and steps of weeks keep the planets accurate.
+class WisdomHolmanIntegrator : public Integrator
+{
+public:
+	const char* name() const override
+	{
+		return "Wisdom-Holman";
+	}
+
+	int order() const override
+	{
+		return 2;
+	}
+
+	int evaluationsPerStep() const override
+	{
+		return 1;
+	}
+
+	void step(BodySystem& bodies, GravitySolver& solver, double dt) override
+	{
+		const int n = bodies.size();
+		if (n == 0)
+			return;
+
+		// central body, barycenter, and total momentum
+		int c = 0;
+		for (int i = 1; i < n; i++)
+			if (bodies.m[i] > bodies.m[c])
+				c = i;
+		const double m0 = bodies.m[c];
+		double total = 0, center[3] = { 0, 0, 0 }, momentum[3] = { 0, 0, 0 };
+		for (int i = 0; i < n; i++)
+		{
+			total += bodies.m[i];
+			center[0] += bodies.m[i] * bodies.x[i];
+			center[1] += bodies.m[i] * bodies.y[i];
+			center[2] += bodies.m[i] * bodies.z[i];
+			momentum[0] += bodies.m[i] * bodies.vx[i];
+			momentum[1] += bodies.m[i] * bodies.vy[i];
+			momentum[2] += bodies.m[i] * bodies.vz[i];
+		}
+		if (total == 0 || m0 == 0)
+			return;
+		double centerVelocity[3];
+		for (int k = 0; k < 3; k++)
+		{
+			center[k] /= total;
+			centerVelocity[k] = momentum[k] / total;
+		}
+
+		// heliocentric positions and barycentric velocities
+		relative.resize(6 * n);
+		double* q = relative.data();
+		double* u = q + 3 * n;
+		for (int i = 0; i < n; i++)
+		{
+			q[3 * i] = bodies.x[i] - bodies.x[c];
+			q[3 * i + 1] = bodies.y[i] - bodies.y[c];
+			q[3 * i + 2] = bodies.z[i] - bodies.z[c];
+			u[3 * i] = bodies.vx[i] - centerVelocity[0];
+			u[3 * i + 1] = bodies.vy[i] - centerVelocity[1];
+			u[3 * i + 2] = bodies.vz[i] - centerVelocity[2];
+		}
+
+		if (!cached)
+			interactions(bodies, solver, c);
+		interactionKick(bodies, c, 0.5 * dt);
+		jump(bodies, c, 0.5 * dt);
+		const double mu = gravity * m0;
+		for (int i = 0; i < n; i++)
+			if (i != c)
+				keplerDrift(mu, &q[3 * i], &u[3 * i], dt);
+		jump(bodies, c, 0.5 * dt);
+
+		// back to inertial positions, with the barycenter moving uniformly
+		double offset[3] = { 0, 0, 0 };
+		for (int i = 0; i < n; i++)
+			for (int k = 0; k < 3; k++)
+				offset[k] += bodies.m[i] * q[3 * i + k];
+		double central[3];
+		for (int k = 0; k < 3; k++)
+			central[k] = center[k] + centerVelocity[k] * dt - offset[k] / total;
+		for (int i = 0; i < n; i++)
+		{
+			bodies.x[i] = central[0] + (i == c ? 0 : q[3 * i]);
+			bodies.y[i] = central[1] + (i == c ? 0 : q[3 * i + 1]);
+			bodies.z[i] = central[2] + (i == c ? 0 : q[3 * i + 2]);
+			bodies.rotAngle[i] += bodies.rotSpeed[i] * dt;
+		}
+
+		interactions(bodies, solver, c);
+		interactionKick(bodies, c, 0.5 * dt);
+
+		// inertial velocities; the central body balances the momentum of the others
+		double others[3] = { 0, 0, 0 };
+		for (int i = 0; i < n; i++)
+		{
+			if (i == c)
+				continue;
+			bodies.vx[i] = u[3 * i] + centerVelocity[0];
+			bodies.vy[i] = u[3 * i + 1] + centerVelocity[1];
+			bodies.vz[i] = u[3 * i + 2] + centerVelocity[2];
+			for (int k = 0; k < 3; k++)
+				others[k] += bodies.m[i] * u[3 * i + k];
+		}
+		bodies.vx[c] = centerVelocity[0] - others[0] / m0;
+		bodies.vy[c] = centerVelocity[1] - others[1] / m0;
+		bodies.vz[c] = centerVelocity[2] - others[2] / m0;
+	}
+
+private:
+	// accelerations between all bodies except the central one, which is made massless meanwhile
+	void interactions(BodySystem& bodies, GravitySolver& solver, int c)
+	{
+		const double m0 = bodies.m[c];
+		bodies.m[c] = 0;
+		evaluate(bodies, solver);
+		bodies.m[c] = m0;
+	}
+
+	void interactionKick(const BodySystem& bodies, int c, double dt)
+	{
+		double* u = relative.data() + 3 * bodies.size();
+		for (int i = 0; i < bodies.size(); i++)
+			if (i != c)
+			{
+				u[3 * i] += bodies.ax[i] * dt;
+				u[3 * i + 1] += bodies.ay[i] * dt;
+				u[3 * i + 2] += bodies.az[i] * dt;
+			}
+	}
+
+	// heliocentric positions move by the total barycentric momentum over the central mass
+	void jump(const BodySystem& bodies, int c, double dt)
+	{
+		const int n = bodies.size();
+		double* q = relative.data();
+		const double* u = q + 3 * n;
+		double shift[3] = { 0, 0, 0 };
+		for (int i = 0; i < n; i++)
+			if (i != c)
+				for (int k = 0; k < 3; k++)
+					shift[k] += bodies.m[i] * u[3 * i + k];
+		for (int i = 0; i < n; i++)
+			if (i != c)
+				for (int k = 0; k < 3; k++)
+					q[3 * i + k] += shift[k] / bodies.m[c] * dt;
+	}
+
+	std::vector<double> relative; // heliocentric positions, then barycentric velocities
+};
+
+// adaptive 15th-order Gauss-Radau predictor-corrector in the style of IAS15 (Rein & Spiegel 2015).
+//
+// Within a step the accelerations are a polynomial a0 + b0 t + ... + b6 t^7 in the fraction t of the
+// step, fitted at the 7 Gauss-Radau nodes by iterating until the coefficients stop changing. The
+// size of the last coefficient b6 relative to the accelerations estimates the error, and the next
+// step is chosen so that this estimate stays at epsilon: steps grow up to fourfold while nothing
+// happens and shrink (rejecting the step) near close encounters. Positions and velocities use
+// compensated summation, so that round-off does not accumulate over many steps. The requested
+// step is split into as many adaptive steps as needed and always ends exactly at its end.
+class Ias15Integrator : public Integrator
+{
+public:
+	Ias15Integrator() : epsilon(1e-9), minimumStep(1), nextStep(0), lastStep(0), count(-1), lastEvaluations(0)
+	{
+		// Gauss-Radau nodes on [0, 1]
+		const double nodes[8] = { 0.0, 0.0562625605369221464656521910318, 0.180240691736892364987579942780, 0.352624717113169637373907769648,
+			0.547153626330555383001448554766, 0.734210177215410531523210605558, 0.885320946839095768090359771030, 0.977520613561287501891174488626 };
+		for (int n = 0; n < 8; n++)
+			h[n] = nodes[n];
+
+		// the acceleration is a0 + sum over k of g_k t (t - h1) ... (t - hk) = a0 + sum over j of b_j t^(j+1);
+		// toB[k][j] is the coefficient of t^j in (t - h1) ... (t - hk)
+		for (int k = 0; k < 7; k++)
+		{
+			for (int j = 0; j < 8; j++)
+				toB[k][j] = 0;
+			toB[k][0] = 1;
+			for (int i = 1; i <= k; i++)
+				for (int j = i; j >= 0; j--)
+					toB[k][j] = (j > 0 ? toB[k][j - 1] : 0) - h[i] * toB[k][j];
+		}
+
+		// toG[j][k] is the divided difference of t^j over the nodes h1 ... h(k+1)
+		for (int j = 0; j < 7; j++)
+		{
+			double differences[7];
+			for (int i = 0; i < 7; i++)
+				differences[i] = pow(h[i + 1], j);
+			for (int k = 0; k < 7; k++)
+			{
+				toG[j][k] = differences[0];
+				for (int i = 0; i + k + 1 < 7; i++)
+					differences[i] = (differences[i + 1] - differences[i]) / (h[i + k + 2] - h[i + 1]);
+			}
+		}
+	}
+
+	const char* name() const override
+	{
+		return "IAS15";
+	}
+
+	int order() const override
+	{
+		return 15;
+	}
+
+	// in the most recent step, which varies with the number of adaptive steps and iterations
+	int evaluationsPerStep() const override
+	{
+		return lastEvaluations;
+	}
+
+	void reset() override
+	{
+		cached = false;
+		count = -1;
+	}
+
+	void serialize(Archive& archive) override
+	{
+		Integrator::serialize(archive);
+		archive.value(epsilon);
+		archive.value(minimumStep);
+		for (int k = 0; k < 7; k++)
+		{
+			archive.value(b[k]);
+			archive.value(g[k]);
+			archive.value(e[k]);
+			archive.value(previousB[k]);
+			archive.value(previousE[k]);
+		}
+		archive.value(positionCompensation);
+		archive.value(velocityCompensation);
+		archive.value(nextStep);
+		archive.value(lastStep);
+		archive.value(count);
+		archive.value(lastEvaluations);
+	}
+
+	void step(BodySystem& bodies, GravitySolver& solver, double dt) override
+	{
+		const int n = bodies.size();
+		const long long evaluations = forceEvaluations;
+		if (n != count)
+		{
+			// forget predictions and compensations of other bodies
+			count = n;
+			for (int k = 0; k < 7; k++)
+			{
+				b[k].assign(3 * n, 0);
+				g[k].assign(3 * n, 0);
+				e[k].assign(3 * n, 0);
+				previousB[k].assign(3 * n, 0);
+				previousE[k].assign(3 * n, 0);
+			}
+			positionCompensation.assign(3 * n, 0);
+			velocityCompensation.assign(3 * n, 0);
+			lastStep = 0;
+			cached = false;
+		}
+		if (dt == 0)
+			return;
+		if (nextStep * dt <= 0)
+			nextStep = dt;
+
+		// adaptive steps until the end of the requested one
+		double done = 0;
+		bool finished = false;
+		while (!finished)
+		{
+			bool truncated = fabs(nextStep) >= fabs(dt - done);
+			double size = truncated ? dt - done : nextStep;
+			if (attempt(bodies, solver, size, truncated))
+			{
+				done += size;
+				finished = truncated;
+			}
+		}
+		for (int i = 0; i < n; i++)
+			bodies.rotAngle[i] += bodies.rotSpeed[i] * dt;
+		lastEvaluations = (int)(forceEvaluations - evaluations);
+	}
+
+	double epsilon;     // target of the relative error estimate per step
+	double minimumStep; // in seconds; at close encounters far from the origin b6 becomes round-off
+	                    // noise, which would otherwise shrink the steps without end
+
+private:
+	// one step of the given size; returns false and updates nextStep if it was rejected
+	bool attempt(BodySystem& bodies, GravitySolver& solver, double size, bool truncated)
+	{
+		const int n = bodies.size();
+		const int components = 3 * n;
+		prepare(bodies, solver);
+
+		// start of the step
+		start.resize(3 * components);
+		double* x0 = start.data();
+		double* v0 = x0 + components;
+		double* a0 = v0 + components;
+		for (int i = 0; i < n; i++)
+		{
+			x0[3 * i] = bodies.x[i];
+			x0[3 * i + 1] = bodies.y[i];
+			x0[3 * i + 2] = bodies.z[i];
+			v0[3 * i] = bodies.vx[i];
+			v0[3 * i + 1] = bodies.vy[i];
+			v0[3 * i + 2] = bodies.vz[i];
+			a0[3 * i] = bodies.ax[i];
+			a0[3 * i + 1] = bodies.ay[i];
+			a0[3 * i + 2] = bodies.az[i];
+		}
+
+		// g from the predicted b
+		for (int c = 0; c < components; c++)
+			for (int k = 0; k < 7; k++)
+			{
+				double sum = b[k][c];
+				for (int j = k + 1; j < 7; j++)
+					sum += toG[j][k] * b[j][c];
+				g[k][c] = sum;
+			}
+
+		// predictor-corrector iterations until b6 stops changing
+		double correction = 2, lastCorrection = 3;
+		for (int iteration = 0; iteration < 12; iteration++)
+		{
+			if (correction < 1e-16 || (iteration > 2 && correction >= lastCorrection))
+				break;
+			lastCorrection = correction;
+
+			for (int node = 1; node < 8; node++)
+			{
+				// positions at the node from the current polynomial
+				const double t = h[node];
+				for (int i = 0; i < n; i++)
+				{
+					double p[3];
+					for (int k = 0; k < 3; k++)
+					{
+						const int c = 3 * i + k;
+						double s = a0[c] / 2 + t * (b[0][c] / 6 + t * (b[1][c] / 12 + t * (b[2][c] / 20 + t * (b[3][c] / 30 + t * (b[4][c] / 42 + t * (b[5][c] / 56 + t * b[6][c] / 72))))));
+						p[k] = x0[c] + (t * size * v0[c] + t * t * size * size * s - positionCompensation[c]);
+					}
+					bodies.x[i] = p[0];
+					bodies.y[i] = p[1];
+					bodies.z[i] = p[2];
+				}
+				evaluate(bodies, solver);
+
+				// new divided difference g(node-1) and its effect on b
+				double largestAcceleration = 0, largestChange = 0;
+				for (int c = 0; c < components; c++)
+				{
+					const double a = c % 3 == 0 ? bodies.ax[c / 3] : c % 3 == 1 ? bodies.ay[c / 3] : bodies.az[c / 3];
+					double difference = (a - a0[c]) / h[node];
+					for (int m = 1; m < node; m++)
+						difference = (difference - g[m - 1][c]) / (h[node] - h[m]);
+					const int k = node - 1;
+					double change = difference - g[k][c];
+					g[k][c] = difference;
+					for (int j = 0; j < k; j++)
+						b[j][c] += change * toB[k][j];
+					b[k][c] += change;
+
+					if (node == 7)
+					{
+						largestAcceleration = std::max(largestAcceleration, fabs(a));
+						largestChange = std::max(largestChange, fabs(change));
+					}
+				}
+				if (node == 7)
+					correction = largestAcceleration > 0 ? largestChange / largestAcceleration : 0;
+			}
+		}
+
+		// next step size from the relative size of b6 at the end of the step
+		double largestAcceleration = 0, largestB6 = 0;
+		for (int i = 0; i < n; i++)
+		{
+			largestAcceleration = std::max(largestAcceleration, std::max(fabs(bodies.ax[i]), std::max(fabs(bodies.ay[i]), fabs(bodies.az[i]))));
+			for (int k = 0; k < 3; k++)
+				largestB6 = std::max(largestB6, fabs(b[6][3 * i + k]));
+		}
+		const double safety = 0.25;
+		double error = largestAcceleration > 0 ? largestB6 / largestAcceleration : 0;
+		double proposed = error > 0 && error == error ? size * pow(epsilon / error, 1.0 / 7) : size / safety;
+		if (fabs(proposed) < minimumStep)
+			proposed = size > 0 ? minimumStep : -minimumStep;
+
+		if (fabs(proposed / size) < safety)
+		{
+			// too large: restore the start and predict b for the shorter step from the previous one
+			for (int i = 0; i < n; i++)
+			{
+				bodies.x[i] = x0[3 * i];
+				bodies.y[i] = x0[3 * i + 1];
+				bodies.z[i] = x0[3 * i + 2];
+				bodies.ax[i] = a0[3 * i];
+				bodies.ay[i] = a0[3 * i + 1];
+				bodies.az[i] = a0[3 * i + 2];
+			}
+			if (lastStep != 0)
+				predict(proposed / lastStep, previousB, previousE);
+			else
+				for (int k = 0; k < 7; k++)
+					std::fill(b[k].begin(), b[k].end(), 0.0);
+			nextStep = proposed;
+			return false;
+		}
+		double limit = (truncated ? std::max(fabs(nextStep), fabs(size)) : fabs(size)) / safety;
+		if (fabs(proposed) > limit)
+			proposed = proposed > 0 ? limit : -limit;
+
+		// a step shortened to end on time says little about longer ones (the error of a very short
+		// step is round-off), so keep the step planned before unless even the short one was too long
+		if (truncated && fabs(size) < fabs(proposed) && fabs(proposed) < fabs(nextStep))
+			proposed = nextStep;
+
+		// positions and velocities at the end of the step, with compensated summation
+		for (int i = 0; i < n; i++)
+		{
+			double p[3], v[3];
+			for (int k = 0; k < 3; k++)
+			{
+				const int c = 3 * i + k;
+				double dx = size * v0[c] + size * size * (a0[c] / 2 + b[0][c] / 6 + b[1][c] / 12 + b[2][c] / 20 + b[3][c] / 30 + b[4][c] / 42 + b[5][c] / 56 + b[6][c] / 72);
+				double dv = size * (a0[c] + b[0][c] / 2 + b[1][c] / 3 + b[2][c] / 4 + b[3][c] / 5 + b[4][c] / 6 + b[5][c] / 7 + b[6][c] / 8);
+				p[k] = compensatedAdd(x0[c], dx, positionCompensation[c]);
+				v[k] = compensatedAdd(v0[c], dv, velocityCompensation[c]);
+			}
+			bodies.x[i] = p[0];
+			bodies.y[i] = p[1];
+			bodies.z[i] = p[2];
+			bodies.vx[i] = v[0];
+			bodies.vy[i] = v[1];
+			bodies.vz[i] = v[2];
+		}
+		cached = false;
+
+		// predict b of the next step from this one
+		for (int k = 0; k < 7; k++)
+		{
+			previousB[k] = b[k];
+			previousE[k] = e[k];
+		}
+		lastStep = size;
+		nextStep = proposed;
+		predict(proposed / size, b, e);
+		return true;
+	}
+
+	// rescales the polynomial of a step to the following step of ratio times its size
+	void predict(double ratio, const std::vector<double>* fromB, const std::vector<double>* fromE)
+	{
+		const int components = (int)b[0].size();
+		if (fabs(ratio) > 20)
+		{
+			// too far to extrapolate
+			for (int k = 0; k < 7; k++)
+			{
+				std::fill(b[k].begin(), b[k].end(), 0.0);
+				std::fill(e[k].begin(), e[k].end(), 0.0);
+			}
+			return;
+		}
+
+		// a(1 + ratio s) - a(1) in powers of s, keeping the last correction b - e of each coefficient
+		for (int c = 0; c < components; c++)
+		{
+			double corrections[7], coefficients[7];
+			for (int k = 0; k < 7; k++)
+				corrections[k] = fromB[k][c] - fromE[k][c];
+			double power = 1;
+			for (int m = 0; m < 7; m++)
+			{
+				power *= ratio;
+				double sum = 0;
+				for (int j = m; j < 7; j++)
+					sum += binomial(j + 1, m + 1) * fromB[j][c];
+				coefficients[m] = power * sum;
+			}
+			for (int k = 0; k < 7; k++)
+			{
+				e[k][c] = coefficients[k];
+				b[k][c] = coefficients[k] + corrections[k];
+			}
+		}
+	}
+
+	static double binomial(int n, int k)
+	{
+		double result = 1;
+		for (int i = 1; i <= k; i++)
+			result = result * (n - k + i) / i;
+		return result;
+	}
+
+	// x + dx, carrying the round-off of x in compensation (Kahan summation)
+	static double compensatedAdd(double x, double dx, double& compensation)
+	{
+		double y = dx - compensation;
+		double sum = x + y;
+		compensation = (sum - x) - y;
+		return sum;
+	}
+
+	double h[8];
+	double toB[7][8], toG[7][7];
+	std::vector<double> b[7], g[7], e[7];           // coefficients, divided differences, predictions
+	std::vector<double> previousB[7], previousE[7]; // of the last accepted step
+	std::vector<double> positionCompensation, velocityCompensation;
+	std::vector<double> start;                      // positions, velocities, and accelerations at the start
+	double nextStep, lastStep;
+	int count; // bodies the coefficients belong to
+	int lastEvaluations;
+};
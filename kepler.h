@@ -0,0 +1,333 @@
+// Stumpff functions c2(z) = (1 - cos sqrt z) / z and c3(z) = (sqrt z - sin sqrt z) / sqrt z^3,
+// continued to negative z with hyperbolic functions and evaluated by series near zero
+void stumpff(double z, double& c2, double& c3)
+{
+	if (fabs(z) < 1e-3)
+	{
+		c2 = 1.0 / 2 - z * (1.0 / 24 - z * (1.0 / 720 - z / 40320));
+		c3 = 1.0 / 6 - z * (1.0 / 120 - z * (1.0 / 5040 - z / 362880));
+	}
+	else if (z > 0)
+	{
+		double s = sqrt(z);
+		c2 = (1 - cos(s)) / z;
+		c3 = (s - sin(s)) / (z * s);
+	}
+	else
+	{
+		double s = sqrt(-z);
+		c2 = (1 - cosh(s)) / z;
+		c3 = (sinh(s) - s) / (-z * s);
+	}
+}
+
+// advances a two-body orbit with gravitational parameter mu by dt; position r and velocity v are
+// relative to the central body. Universal variables treat elliptic, parabolic, and hyperbolic
+// orbits alike, the Kepler equation is solved by Laguerre-Conway iteration, and a step that does
+// not converge is split in two halves.
+void keplerDrift(double mu, double* r, double* v, double dt, int depth = 0)
+{
+	const double r0 = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+	const double v2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+	if (r0 == 0 || mu <= 0)
+	{
+		// no attraction: straight line
+		for (int k = 0; k < 3; k++)
+			r[k] += v[k] * dt;
+		return;
+	}
+
+	const double sqrtMu = sqrt(mu);
+	const double sigma = (r[0] * v[0] + r[1] * v[1] + r[2] * v[2]) / sqrtMu;
+	const double alpha = 2 / r0 - v2 / mu; // inverse semi-major axis
+	const double beta = 1 - alpha * r0;
+
+	// whole revolutions of a bound orbit change nothing
+	if (alpha > 0)
+	{
+		double period = 2 * 3.14159265358979323846 / (sqrtMu * alpha * sqrt(alpha));
+		if (fabs(dt) > period)
+			dt = fmod(dt, period);
+	}
+
+	// universal anomaly chi from F(chi) = sigma chi^2 c2 + beta chi^3 c3 + r0 chi - sqrt(mu) dt = 0
+	double chi = sqrtMu * dt / r0;
+	double c2 = 0.5, c3 = 1.0 / 6;
+	bool converged = false;
+	for (int iteration = 0; iteration < 50 && !converged; iteration++)
+	{
+		const double z = alpha * chi * chi;
+		stumpff(z, c2, c3);
+		double f = sigma * chi * chi * c2 + beta * chi * chi * chi * c3 + r0 * chi - sqrtMu * dt;
+		double df = sigma * chi * (1 - z * c3) + beta * chi * chi * c2 + r0;
+		double ddf = sigma * (1 - z * c2) + beta * chi * (1 - z * c3);
+
+		const double n = 5;
+		double root = sqrt(fabs((n - 1) * (n - 1) * df * df - n * (n - 1) * f * ddf));
+		double delta = n * f / (df + (df >= 0 ? root : -root));
+		chi -= delta;
+		converged = fabs(delta) <= 1e-14 * fabs(chi) || f == 0;
+	}
+
+	if (!converged)
+	{
+		if (depth < 20)
+		{
+			keplerDrift(mu, r, v, 0.5 * dt, depth + 1);
+			keplerDrift(mu, r, v, 0.5 * dt, depth + 1);
+		}
+		return;
+	}
+
+	// Lagrange coefficients at the converged anomaly
+	const double z = alpha * chi * chi;
+	stumpff(z, c2, c3);
+	const double f = 1 - chi * chi * c2 / r0;
+	const double g = dt - chi * chi * chi * c3 / sqrtMu;
+	double position[3];
+	for (int k = 0; k < 3; k++)
+		position[k] = f * r[k] + g * v[k];
+	const double r1 = sqrt(position[0] * position[0] + position[1] * position[1] + position[2] * position[2]);
+	const double df = sqrtMu / (r1 * r0) * chi * (z * c3 - 1);
+	const double dg = 1 - chi * chi * c2 / r1;
+	for (int k = 0; k < 3; k++)
+	{
+		double velocity = df * r[k] + dg * v[k];
+		r[k] = position[k];
+		v[k] = velocity;
+	}
+}
+
+// Unperturbed two-body orbits of many small bodies around one central body, kept as orbital
+// elements in one array per element (elliptic and hyperbolic orbits apart) and evaluated at any
+// time in one call, without stepping: the mean anomaly grows linearly, the elliptic Kepler equation
+// is solved from Markley's starting value with one fifth-order correction and the hyperbolic one by
+// a fixed number of Halley iterations, and the position and velocity follow from the anomaly. The
+// loops have no data-dependent branches, so the compiler can vectorize them along with sin, cos,
+// and exp, and blocks of orbits run on the thread pool.
+class KeplerCatalog
+{
+public:
+	KeplerCatalog() : central(0)
+	{
+	}
+
+	int size() const
+	{
+		return (int)(elliptic.target.size() + hyperbolic.target.size());
+	}
+
+	void clear()
+	{
+		elliptic.clear();
+		hyperbolic.clear();
+	}
+
+	// adds the orbit of a body with position r and velocity v relative to the central body at time
+	// epoch, mu = G (M + m); its states go to body target of the system. Parabolic orbits (zero
+	// energy) are not supported.
+	void add(double mu, dvec3 r, dvec3 v, double epoch, int target)
+	{
+		const double r0 = r.length(), v2 = v.x * v.x + v.y * v.y + v.z * v.z;
+		const double alpha = 2 / r0 - v2 / mu; // inverse semi-major axis
+		dvec3 h(r.y * v.z - r.z * v.y, r.z * v.x - r.x * v.z, r.x * v.y - r.y * v.x);
+
+		// eccentricity vector along the pericenter, or any direction in the plane for circles
+		dvec3 vh(v.y * h.z - v.z * h.y, v.z * h.x - v.x * h.z, v.x * h.y - v.y * h.x);
+		dvec3 eccentricity = vh * (1 / mu) - r * (1 / r0);
+		const double e = eccentricity.length();
+		dvec3 p = e > 0 ? eccentricity * (1 / e) : r * (1 / r0);
+		dvec3 q(h.y * p.z - h.z * p.y, h.z * p.x - h.x * p.z, h.x * p.y - h.y * p.x);
+		q = q * (1 / h.length());
+
+		// mean anomaly from the true anomaly, measured from p so that both agree even for circles
+		const double a = 1 / fabs(alpha), n = sqrt(mu * alpha * alpha * fabs(alpha));
+		const double nu = atan2(r.x * q.x + r.y * q.y + r.z * q.z, r.x * p.x + r.y * p.y + r.z * p.z);
+		Orbits& orbits = alpha > 0 ? elliptic : hyperbolic;
+		double anomaly;
+		if (alpha > 0)
+		{
+			double E = atan2(sqrt(1 - e * e) * sin(nu), e + cos(nu));
+			anomaly = E - e * sin(E);
+		}
+		else
+		{
+			double H = asinh(sqrt(e * e - 1) * sin(nu) / (1 + e * cos(nu)));
+			anomaly = e * sinh(H) - H;
+		}
+
+		orbits.a.push_back(a);
+		orbits.e.push_back(e);
+		orbits.n.push_back(n);
+		orbits.m0.push_back(anomaly - n * epoch);
+		orbits.px.push_back(p.x);
+		orbits.py.push_back(p.y);
+		orbits.pz.push_back(p.z);
+		orbits.qx.push_back(q.x);
+		orbits.qy.push_back(q.y);
+		orbits.qz.push_back(q.z);
+		orbits.target.push_back(target);
+	}
+
+	// positions and velocities of all orbits at time t, added to the current state of the central
+	// body and written to their target bodies
+	void evaluate(double t, BodySystem& bodies, ThreadPool* pool) const
+	{
+		evaluate(t, bodies.position(central), bodies.velocity(central), bodies, pool);
+	}
+
+	// the same for target bodies in a system of their own, with the state of the central body given
+	void evaluate(double t, dvec3 center, dvec3 centerVelocity, BodySystem& bodies, ThreadPool* pool) const
+	{
+		for (const Orbits* orbits : { &elliptic, &hyperbolic })
+		{
+			const bool bound = orbits == &elliptic;
+			std::function<void(int, int, int)> task = [&](int begin, int end, int)
+			{
+				// relative states of a block on the stack, then scattered to the bodies
+				const int block = 256;
+				double state[6][block];
+				for (int start = begin; start < end; start += block)
+				{
+					const int count = std::min(block, end - start);
+					if (bound)
+						evaluateElliptic(*orbits, t, start, count, state);
+					else
+						evaluateHyperbolic(*orbits, t, start, count, state);
+					for (int k = 0; k < count; k++)
+					{
+						const int i = orbits->target[start + k];
+						bodies.x[i] = center.x + state[0][k];
+						bodies.y[i] = center.y + state[1][k];
+						bodies.z[i] = center.z + state[2][k];
+						bodies.vx[i] = centerVelocity.x + state[3][k];
+						bodies.vy[i] = centerVelocity.y + state[4][k];
+						bodies.vz[i] = centerVelocity.z + state[5][k];
+					}
+				}
+			};
+			const int count = (int)orbits->target.size();
+			if (pool)
+				pool->parallelFor(count, 4096, task);
+			else if (count > 0)
+				task(0, count, 0);
+		}
+	}
+
+	// writes or reads all orbits, for checkpoints
+	void serialize(Archive& archive)
+	{
+		archive.value(central);
+		for (Orbits* orbits : { &elliptic, &hyperbolic })
+		{
+			std::vector<double>* arrays[] = { &orbits->a, &orbits->e, &orbits->n, &orbits->m0, &orbits->px, &orbits->py, &orbits->pz, &orbits->qx, &orbits->qy, &orbits->qz };
+			for (std::vector<double>* array : arrays)
+				archive.value(*array);
+			archive.value(orbits->target);
+		}
+	}
+
+	int central; // index of the central body in the systems written to
+
+private:
+	// elements of one kind of orbits, one array each
+	struct Orbits
+	{
+		void clear()
+		{
+			std::vector<double>* arrays[] = { &a, &e, &n, &m0, &px, &py, &pz, &qx, &qy, &qz };
+			for (std::vector<double>* array : arrays)
+				array->clear();
+			target.clear();
+		}
+
+		std::vector<double> a, e, n;      // semi-major axis (positive for both kinds), eccentricity, mean motion
+		std::vector<double> m0;           // mean anomaly at time zero
+		std::vector<double> px, py, pz;   // unit vector towards the pericenter
+		std::vector<double> qx, qy, qz;   // unit vector in the orbital plane, 90 degrees ahead
+		std::vector<int> target;          // body index in the system
+	};
+
+	// E - e sin E = M for orbits [start, start + count) (Markley 1995), states relative to the central body
+	static void evaluateElliptic(const Orbits& orbits, double t, int start, int count, double (*state)[256])
+	{
+		const double pi = 3.14159265358979323846;
+		for (int k = 0; k < count; k++)
+		{
+			const int i = start + k;
+			const double e = orbits.e[i];
+
+			// mean anomaly in [-pi, pi), solved for its magnitude and mirrored
+			double M = orbits.m0[i] + orbits.n[i] * t;
+			M -= 2 * pi * floor((M + pi) / (2 * pi));
+			const double m = fabs(M);
+
+			// Markley's cubic starting value, then one fifth-order correction
+			const double alpha = (3 * pi * pi + 1.6 * pi * (pi - m) / (1 + e)) / (pi * pi - 6);
+			const double d = 3 * (1 - e) + alpha * e;
+			const double q = 2 * alpha * d * (1 - e) - m * m;
+			const double r = 3 * alpha * d * (d - 1 + e) * m + m * m * m;
+			const double w = pow(r + sqrt(q * q * q + r * r), 2.0 / 3);
+			double E = (2 * r * w / (w * w + w * q + q * q) + m) / d;
+			const double f2 = e * sin(E), f3 = e * cos(E);
+			const double f0 = E - f2 - m, f1 = 1 - f3;
+			const double d3 = -f0 / (f1 - 0.5 * f0 * f2 / f1);
+			const double d4 = -f0 / (f1 + 0.5 * d3 * f2 + d3 * d3 * f3 / 6);
+			const double d5 = -f0 / (f1 + 0.5 * d4 * f2 + d4 * d4 * f3 / 6 - d4 * d4 * d4 * f2 / 24);
+			E = copysign(E + d5, M);
+
+			const double cosE = cos(E), sinE = sin(E);
+			const double a = orbits.a[i], b = a * sqrt(1 - e * e);
+			const double x = a * (cosE - e), y = b * sinE;
+			const double rate = orbits.n[i] / (1 - e * cosE);
+			const double vx = -a * sinE * rate, vy = b * cosE * rate;
+			state[0][k] = x * orbits.px[i] + y * orbits.qx[i];
+			state[1][k] = x * orbits.py[i] + y * orbits.qy[i];
+			state[2][k] = x * orbits.pz[i] + y * orbits.qz[i];
+			state[3][k] = vx * orbits.px[i] + vy * orbits.qx[i];
+			state[4][k] = vx * orbits.py[i] + vy * orbits.qy[i];
+			state[5][k] = vx * orbits.pz[i] + vy * orbits.qz[i];
+		}
+	}
+
+	// e sinh H - H = M, likewise
+	static void evaluateHyperbolic(const Orbits& orbits, double t, int start, int count, double (*state)[256])
+	{
+		for (int k = 0; k < count; k++)
+		{
+			const int i = start + k;
+			const double e = orbits.e[i];
+			const double M = orbits.m0[i] + orbits.n[i] * t;
+			const double m = fabs(M);
+
+			// both the root of the cubic from the series e (H + H^3/6) - H and the logarithmic start
+			// for large anomalies lie above the root, so Halley's iterations from the lower one
+			// approach it from above without overshooting
+			const double p = 6 * (e - 1) / e, q = 3 * m / e, root = sqrt(q * q + p * p * p / 27);
+			double H = std::min(cbrt(q + root) + cbrt(q - root), log(2 * m / e + 1.8));
+			for (int iteration = 0; iteration < 4; iteration++)
+			{
+				double grow = exp(H), shrink = 1 / grow;
+				double s = e * 0.5 * (grow - shrink), c = e * 0.5 * (grow + shrink);
+				double f = s - H - m, df = c - 1;
+				H -= 2 * f * df / (2 * df * df - f * s);
+			}
+			H = copysign(H, M);
+
+			const double grow = exp(H), shrink = 1 / grow;
+			const double coshH = 0.5 * (grow + shrink), sinhH = 0.5 * (grow - shrink);
+			const double a = orbits.a[i], b = a * sqrt(e * e - 1);
+			const double x = a * (e - coshH), y = b * sinhH;
+			const double rate = orbits.n[i] / (e * coshH - 1);
+			const double vx = -a * sinhH * rate, vy = b * coshH * rate;
+			state[0][k] = x * orbits.px[i] + y * orbits.qx[i];
+			state[1][k] = x * orbits.py[i] + y * orbits.qy[i];
+			state[2][k] = x * orbits.pz[i] + y * orbits.qz[i];
+			state[3][k] = vx * orbits.px[i] + vy * orbits.qx[i];
+			state[4][k] = vx * orbits.py[i] + vy * orbits.qy[i];
+			state[5][k] = vx * orbits.pz[i] + vy * orbits.qz[i];
+		}
+	}
+
+	Orbits elliptic, hyperbolic;
+};
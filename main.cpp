@@ -2,6 +2,22 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <iostream>
 #include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+#include <complex>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <deque>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <random>
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw.h"
@@ -19,6 +35,24 @@
 #include "shaders.h"
 #include "model.h"
 #include "body.h"
+#include "checkpoint.h"
+#include "bodysystem.h"
+#include "threadpool.h"
+#include "gravity.h"
+#include "octree.h"
+#include "barneshut.h"
+#include "fmm.h"
+#include "fft.h"
+#include "particlemesh.h"
+#include "kepler.h"
+#include "integrator.h"
+#include "blockstep.h"
+#include "regularization.h"
+#include "subsystem.h"
+#include "ephemeris.h"
+#include "timeline.h"
+#include "trajectory.h"
+#include "simulation.h"
 #include "camera.h"
 
 // textures
@@ -29,13 +63,81 @@ unsigned int ringTexture;
 // 3D models
 Model cube, sphere, ring;
 
-// Solar system
-std::vector<Body> bodies;
+// Solar system, simulated on its own thread, and drawn between its states
+Simulation simulation;
+DrawState drawn;
 const int inner = -1;
 const int outer = -2;
 
+// worker threads for the force computation, and the gravity solvers using them
+ThreadPool threadPool;
+DirectSolver directSolver;
+BarnesHutSolver barnesHutSolver;
+FmmSolver fmmSolver;
+ParticleMeshSolver particleMeshSolver;
+GravitySolver* solvers[] = { &directSolver, &barnesHutSolver, &fmmSolver, &particleMeshSolver };
+
+// integration schemes
+EulerIntegrator eulerIntegrator;
+LeapfrogIntegrator leapfrogIntegrator;
+VerletIntegrator verletIntegrator;
+CompositionIntegrator yoshida4Integrator("Yoshida 4th order", 4, yoshida4Weights());
+CompositionIntegrator yoshida6Integrator("Yoshida 6th order", 6, yoshida6Weights());
+WisdomHolmanIntegrator wisdomHolmanIntegrator;
+Ias15Integrator ias15Integrator;
+BlockHermiteIntegrator blockHermiteIntegrator;
+Integrator* integrators[] = { &eulerIntegrator, &leapfrogIntegrator, &verletIntegrator, &yoshida4Integrator, &yoshida6Integrator, &wisdomHolmanIntegrator, &ias15Integrator, &blockHermiteIntegrator };
+EncounterIntegrator encounterIntegrator; // runs the selected one with close pairs regularized
+SubsystemIntegrator subsystemIntegrator; // runs the selected one on the outer system
+
+// asteroids on fixed orbits around the Sun, placed at each step instead of integrated
+KeplerCatalog catalog;
+
+// ephemeris written while integrating; the one read for seeking belongs to the simulation
+const char* ephemerisPath = "ephemeris.bin";
+EphemerisRecorder ephemerisRecorder;
+const double year = 365.25 * 86400;
+
+// keyframes of the recent history, for rewinding
+Timeline timeline;
+
+// full history of the run, written on a thread of its own
+const char* trajectoryPath = "trajectory.bin";
+TrajectoryWriter trajectoryWriter;
+
+// checkpoints of the whole state, saved at intervals of simulated time and written in the background
+CheckpointWriter checkpoints;
+
+// physics settings edited in the GUI, handed to the simulation thread through commands
+int solverSelection = 0;
+int integratorSelection = 1;
+bool localMoons = true;
+bool regularize = false;
+float timeWarp = (float)simulation.timeScale;
+float stepSize = (float)simulation.stepSize;
+float budget = (float)simulation.budget * 1000;
+int tickRate = (int)(1 / simulation.tickInterval + 0.5);
+int threadCount = threadPool.getThreadCount();
+int kernelSelection = simdLevel;
+float barnesHutTheta = (float)barnesHutSolver.theta;
+float fmmTheta = (float)fmmSolver.theta;
+int fmmOrder = fmmSolver.getOrder();
+int gridExponent = 6;
+float gridPadding = (float)particleMeshSolver.padding;
+float directMass = (float)particleMeshSolver.massiveLimit;
+bool recordEphemeris = false;
+bool recordTrajectory = false;
+float seekYears = 0;
+float timelineYears = 0;
+float timelineEnd = 0;
+bool scrubbing = false;
+int timelineMemory = (int)(timeline.budget >> 20);
+float checkpointYears = 0;
+bool checkpointUnreadable = false;
+int shownCheckpointLoads = 0;                  // loads the controls follow already
+std::shared_ptr<const Ephemeris> shownEphemeris; // the one seeking started from now
+
 // current state
-bool paused = false;
 int bodySelection = 0;
 int sunScale = 30;
 int bodyScale = 1000;
@@ -78,77 +180,45 @@ void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
 
 void createBodies()
 {
-	// set parameters                distance(m)    speed(m/s) radius(m) mass(kg)    tilt(rad) rotSpeed(rad/s) moon option
-	bodies.push_back(Body("Sun", 0, 0, 6.957e8, 1.9885e30, 0.13, 2.90308e-6, false, sunTexture));
-	bodies.push_back(Body("Mercury", 5.790905e10, 47360, 2.4397e6, 3.3011e23, 0.00, 1.24002e-6, true, mercuryTexture));
-	bodies.push_back(Body("Venus", 1.08208e11, 35020, 6.0518e6, 4.8675e24, 3.10, 2.99240e-7, true, venusTexture));
-	bodies.push_back(Body("Earth", 1.49598023e11, 29780, 6.371e6, 5.97237e24, 0.41, 7.29212e-5, false, earthTexture));
-	bodies.push_back(Body("Moon", 1.49982422e11, 30802, 1.7374e6, 7.342e22, 0.03, 2.66170e-6, false, moonTexture));
-	bodies.push_back(Body("Mars", 2.27939366e11, 24070, 3.3895e6, 6.4171e23, 0.44, 7.08822e-5, true, marsTexture));
-	bodies.push_back(Body("Jupiter", 7.78479e11, 13070, 6.9911e7, 1.8982e27, 0.05, 1.75852e-4, true, jupiterTexture));
-	bodies.push_back(Body("Saturn", 1.43353e12, 9680, 5.8232e7, 5.6834e26, 0.47, 1.65269e-4, true, saturnTexture));
-	bodies.push_back(Body("Uranus", 2.870972e12, 6800, 2.5362e7, 8.681e25, 1.71, 1.01238e-4, true, uranusTexture));
-	bodies.push_back(Body("Neptune", 4.5e12, 5430, 2.4622e7, 1.02413e26, 0.49, 1.08330e-4, true, neptuneTexture));
-}
-
-void updateBodies(double timeStep)
-{
-	// speed up time for noticeable animation
-	timeStep *= 1e5;
-
-	// use multiple iterations per frame for precise simulation
-	const int iterations = 100;
-	timeStep /= iterations;
-
-	for (int k = 0; k < iterations; k++)
-	{
-		// update each body
-		for (int i = 0; i < bodies.size(); i++)
-		{
-			dvec3 totalForce;
-
-			// collect forces from all bodies
-			for (int j = 0; j < bodies.size(); j++)
-			{
-				// skip itself
-				if (j == i)
-					continue;
-
-				// gravitational force from the other body
-				totalForce += bodies[i].calcForce(bodies[j]);
-			}
+	BodySystem& bodies = simulation.bodies;
 
-			// update velocity and position of this body
-			bodies[i].update(totalForce, timeStep);
-		}
-	}
+	// set parameters                distance(m)    speed(m/s) radius(m) mass(kg)    tilt(rad) rotSpeed(rad/s) moon option
+	bodies.add(Body("Sun", 0, 0, 6.957e8, 1.9885e30, 0.13, 2.90308e-6, false, sunTexture));
+	bodies.add(Body("Mercury", 5.790905e10, 47360, 2.4397e6, 3.3011e23, 0.00, 1.24002e-6, true, mercuryTexture));
+	bodies.add(Body("Venus", 1.08208e11, 35020, 6.0518e6, 4.8675e24, 3.10, 2.99240e-7, true, venusTexture));
+	bodies.add(Body("Earth", 1.49598023e11, 29780, 6.371e6, 5.97237e24, 0.41, 7.29212e-5, false, earthTexture));
+	bodies.add(Body("Moon", 1.49982422e11, 30802, 1.7374e6, 7.342e22, 0.03, 2.66170e-6, false, moonTexture));
+	bodies.properties(4).host = 3;
+	bodies.add(Body("Mars", 2.27939366e11, 24070, 3.3895e6, 6.4171e23, 0.44, 7.08822e-5, true, marsTexture));
+	bodies.add(Body("Jupiter", 7.78479e11, 13070, 6.9911e7, 1.8982e27, 0.05, 1.75852e-4, true, jupiterTexture));
+	bodies.add(Body("Saturn", 1.43353e12, 9680, 5.8232e7, 5.6834e26, 0.47, 1.65269e-4, true, saturnTexture));
+	bodies.add(Body("Uranus", 2.870972e12, 6800, 2.5362e7, 8.681e25, 1.71, 1.01238e-4, true, uranusTexture));
+	bodies.add(Body("Neptune", 4.5e12, 5430, 2.4622e7, 1.02413e26, 0.49, 1.08330e-4, true, neptuneTexture));
 }
 
-double bodyRadius(int i)
+double bodyRadius(const Snapshot& state, int i)
 {
-	Body& body = bodies[i];
-	return body.radius * (i == 0 ? sunScale : bodyScale);
+	return state.properties[i].radius * (i == 0 ? sunScale : bodyScale);
 }
 
-dvec3 bodyPosition(int i)
+dvec3 bodyPosition(const Snapshot& state, int i)
 {
-	Body& body = bodies[i];
-	dvec3 position = body.position;
+	dvec3 position = drawn.positions[i];
 
 	// for moons, scale their orbit to improve visibilty
-	if (body.texture == moonTexture)
+	int host = state.properties[i].host;
+	if (host >= 0)
 	{
-		// host planet is the previous body
-		Body& planet = bodies[i - 1];
-		position = planet.position + (position - planet.position) * moonOrbitScale;
+		dvec3 planet = drawn.positions[host];
+		position = planet + (position - planet) * moonOrbitScale;
 	}
 
 	return position;
 }
 
-void setCamera()
+void setCamera(const Snapshot& state)
 {
-	Body& sun = bodies[0];
+	dvec3 sun = drawn.positions[0];
 
 	if (bodySelection == inner)
 	{
@@ -156,7 +226,7 @@ void setCamera()
 		double cameraDistance = 5e11;
 		dvec3 cameraDirection = normalize(dvec3(0, 1, 1));
 		double cameraSpeed = 1e11;
-		camera.set(sun.position, cameraDirection, cameraDistance, cameraSpeed);
+		camera.set(sun, cameraDirection, cameraDistance, cameraSpeed);
 	}
 	else if (bodySelection == outer)
 	{
@@ -164,19 +234,18 @@ void setCamera()
 		double cameraDistance = 1e13;
 		dvec3 cameraDirection = normalize(dvec3(0, 1, 1));
 		double cameraSpeed = 1e12;
-		camera.set(sun.position, cameraDirection, cameraDistance, cameraSpeed);
+		camera.set(sun, cameraDirection, cameraDistance, cameraSpeed);
 	}
 	else
 	{
 		// camera distance is roughly proportional to selected body radius
-		Body& body = bodies[bodySelection];
-		dvec3 position = bodyPosition(bodySelection);
-		double cameraDistance = bodySelection == 0 ? 8e10 : 4e7 * sqrt(body.radius);
+		dvec3 position = bodyPosition(state, bodySelection);
+		double cameraDistance = bodySelection == 0 ? 8e10 : 4e7 * sqrt(state.properties[bodySelection].radius);
 
 		// camera direction is back and above
 		dvec3 cameraDirection = normalize(dvec3(0, 0, 1));
 		if (bodySelection != 0)
-			cameraDirection = normalize(position - sun.position);
+			cameraDirection = normalize(position - sun);
 		cameraDirection.rotate(0.8, dvec3(0, 1, 0));
 		cameraDirection.y = 0.5;
 
@@ -186,20 +255,21 @@ void setCamera()
 	}
 }
 
-void addMoon()
+// runs on the simulation thread
+void addMoon(BodySystem& bodies, int planetIndex)
 {
 	// new moon name
-	Body& planet = bodies[bodySelection];
+	Body planet = bodies.get(planetIndex);
 	std::string name = planet.name + " moon";
 
 	// create new moon
 	double radius = planet.radius * 0.3;
 	double mass = planet.mass * 0.001;
 	Body newMoon(name, 0, 0, radius, mass, 0.5, 1e-5, false, moonTexture);
+	newMoon.host = planetIndex;
 
 	// Sun-planet direction
-	Body& sun = bodies[0];
-	dvec3 direction = normalize(planet.position - sun.position);
+	dvec3 direction = normalize(planet.position - bodies.position(0));
 
 	// new moon position
 	double distance = planet.radius * 40;
@@ -211,11 +281,192 @@ void addMoon()
 	newMoon.velocity = planet.velocity + normalize(planet.velocity) * velocity;
 
 	// add new moon
-	planet.moonOption = false;
-	bodies.insert(bodies.begin() + bodySelection + 1, newMoon);
+	bodies.properties(planetIndex).moonOption = false;
+	bodies.insert(planetIndex + 1, newMoon);
+}
+
+// main-belt asteroids on random orbits around the Sun, starting now; runs on the simulation thread
+void createAsteroids(int count)
+{
+	BodySystem& bodies = simulation.bodies;
+	std::mt19937_64 random(count);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	const double mu = gravity * bodies.m[0];
+
+	catalog.clear();
+	catalog.central = 0;
+	simulation.catalogBodies.clear();
+	for (int i = 0; i < count; i++)
+	{
+		// semi-major axes of 2.1 to 3.3 AU, moderate eccentricities and inclinations, started at the pericenter
+		double e = 0.25 * uniform(random), pericenter = (3.1e11 + 1.8e11 * uniform(random)) * (1 - e);
+		dvec3 position(pericenter, 0, 0), velocity(0, 0, -sqrt(mu * (1 + e) / pericenter));
+		double inclination = 0.3 * uniform(random), node = 2 * 3.14159265358979 * uniform(random);
+		position.rotate(inclination, dvec3(1, 0, 0));
+		velocity.rotate(inclination, dvec3(1, 0, 0));
+		position.rotate(node, dvec3(0, 1, 0));
+		velocity.rotate(node, dvec3(0, 1, 0));
+
+		Body asteroid("", 0, 0, 5e4 + 4.5e5 * uniform(random) * uniform(random), 0, 0, 0, false, moonTexture);
+		simulation.catalogBodies.add(asteroid);
+
+		// at a random point of the orbit, by starting there a random time ago
+		double period = 2 * 3.14159265358979 * sqrt(pow(pericenter / (1 - e), 3) / mu);
+		catalog.add(mu, position, velocity, simulation.getTime() - period * uniform(random), i);
+	}
+}
+
+// wraps the selected integrator as set in the GUI; runs on the simulation thread once it started
+void selectIntegrator(Integrator* integrator, bool pairs, bool nested)
+{
+	encounterIntegrator.outer = integrator;
+	Integrator* single = pairs ? &encounterIntegrator : integrator;
+	subsystemIntegrator.outer = single;
+	simulation.integrator = nested ? &subsystemIntegrator : single;
+}
+
+// physics settings as the simulation thread has them, which checkpoints hold along with the state
+struct PhysicsSettings
+{
+	// from the simulation, on its thread
+	void capture()
+	{
+		const int solverCount = sizeof(solvers) / sizeof(solvers[0]);
+		const int integratorCount = sizeof(integrators) / sizeof(integrators[0]);
+		solver = (int)(std::find(solvers, solvers + solverCount, simulation.solver) - solvers);
+		integrator = (int)(std::find(integrators, integrators + integratorCount, encounterIntegrator.outer) - integrators);
+		pairs = subsystemIntegrator.outer == &encounterIntegrator;
+		nested = simulation.integrator == &subsystemIntegrator;
+		timeScale = simulation.timeScale;
+		step = simulation.stepSize;
+		tickBudget = simulation.budget;
+		tickInterval = simulation.tickInterval;
+		threads = threadPool.getThreadCount();
+		kernel = simdLevel;
+		openingAngle = barnesHutSolver.theta;
+		fmmAngle = fmmSolver.theta;
+		expansionOrder = fmmSolver.getOrder();
+		gridSize = particleMeshSolver.getGridSize();
+		padding = particleMeshSolver.padding;
+		massiveLimit = particleMeshSolver.massiveLimit;
+		timelineBudget = timeline.budget;
+		checkpointInterval = checkpoints.interval;
+	}
+
+	// to the simulation, on its thread; threads and kernel only as far as this computer has them
+	void apply() const
+	{
+		simulation.solver = solvers[solver];
+		selectIntegrator(integrators[integrator], pairs, nested);
+		simulation.timeScale = timeScale;
+		simulation.stepSize = step;
+		simulation.budget = tickBudget;
+		simulation.tickInterval = tickInterval;
+		threadPool.setThreadCount(std::min(threads, ThreadPool::defaultThreadCount()));
+		simdLevel = (SimdLevel)std::min(kernel, (int)supportedSimdLevel);
+		barnesHutSolver.theta = openingAngle;
+		fmmSolver.theta = fmmAngle;
+		fmmSolver.setOrder(expansionOrder);
+		particleMeshSolver.setGridSize(gridSize);
+		particleMeshSolver.padding = padding;
+		particleMeshSolver.massiveLimit = massiveLimit;
+		timeline.budget = (size_t)timelineBudget;
+		checkpoints.interval = checkpointInterval;
+	}
+
+	// to the controls of the GUI, on its thread
+	void show() const
+	{
+		solverSelection = solver;
+		integratorSelection = integrator;
+		regularize = pairs;
+		localMoons = nested;
+		timeWarp = (float)timeScale;
+		stepSize = (float)step;
+		budget = (float)tickBudget * 1000;
+		tickRate = (int)(1 / tickInterval + 0.5);
+		threadCount = std::min(threads, ThreadPool::defaultThreadCount());
+		kernelSelection = std::min(kernel, (int)supportedSimdLevel);
+		barnesHutTheta = (float)openingAngle;
+		fmmTheta = (float)fmmAngle;
+		fmmOrder = expansionOrder;
+		for (gridExponent = 0; (1 << gridExponent) < gridSize; gridExponent++)
+			;
+		gridPadding = (float)padding;
+		directMass = (float)massiveLimit;
+		timelineMemory = (int)(timelineBudget >> 20);
+		checkpointYears = (float)(checkpointInterval / year);
+	}
+
+	// false for the checkpoints of other programs and for settings this one does not have
+	bool serialize(Archive& archive)
+	{
+		std::string program = "solar system";
+		archive.value(program);
+		archive.value(solver);
+		archive.value(integrator);
+		archive.value(pairs);
+		archive.value(nested);
+		archive.value(timeScale);
+		archive.value(step);
+		archive.value(tickBudget);
+		archive.value(tickInterval);
+		archive.value(threads);
+		archive.value(kernel);
+		archive.value(openingAngle);
+		archive.value(fmmAngle);
+		archive.value(expansionOrder);
+		archive.value(gridSize);
+		archive.value(padding);
+		archive.value(massiveLimit);
+		archive.value(timelineBudget);
+		archive.value(checkpointInterval);
+		const int solverCount = sizeof(solvers) / sizeof(solvers[0]);
+		const int integratorCount = sizeof(integrators) / sizeof(integrators[0]);
+		return archive.isValid() && program == "solar system" && solver >= 0 && solver < solverCount && integrator >= 0 && integrator < integratorCount && threads > 0 && kernel >= 0;
+	}
+
+	int solver, integrator; // indices in the lists
+	bool pairs, nested;     // wrapped as by selectIntegrator
+	double timeScale, step, tickBudget, tickInterval;
+	int threads, kernel;
+	double openingAngle, fmmAngle;
+	int expansionOrder, gridSize;
+	double padding, massiveLimit;
+	uint64_t timelineBudget;
+	double checkpointInterval;
+};
+
+// writes or reads what a checkpoint holds: the settings, the time, the bodies, and the state of
+// every integrator; runs on the simulation thread. Reading keeps the state unless the settings fit.
+bool checkpointState(Archive& archive)
+{
+	PhysicsSettings settings;
+	if (archive.isWriting())
+		settings.capture();
+	if (!settings.serialize(archive))
+		return false;
+	double time = simulation.getTime();
+	archive.value(time);
+	simulation.bodies.serialize(archive);
+	catalog.serialize(archive);
+	simulation.catalogBodies.serialize(archive);
+	for (Integrator* integrator : integrators)
+		integrator->serialize(archive);
+	encounterIntegrator.serialize(archive);
+	subsystemIntegrator.serialize(archive);
+	if (archive.isWriting())
+		return true;
+
+	// the history of the timeline does not lead here
+	settings.apply();
+	simulation.setTime(time);
+	timeline.clear();
+	checkpoints.start(time);
+	return archive.isComplete();
 }
 
-void drawGui()
+void drawGui(const Snapshot& state)
 {
 	// start ImGui frame
 	ImGui_ImplOpenGL3_NewFrame();
@@ -226,59 +477,322 @@ void drawGui()
 	ImGui::Begin("Solar system", NULL, ImGuiWindowFlags_AlwaysAutoResize);
 
 	// create button for pausing/resuming
-	if (ImGui::Button(paused ? "resume" : "pause"))
-		paused = !paused;
+	if (ImGui::Button(simulation.paused ? "resume" : "pause"))
+		simulation.paused = !simulation.paused;
 
 	// create scale sliders
 	ImGui::SliderInt("Sun scale", &sunScale, 1, 50);
 	ImGui::SliderInt("Body scale", &bodyScale, 1, 1000);
 	ImGui::SliderInt("Moon orbit scale", &moonOrbitScale, 1, 100);
 
-	// create checkboxes and buttons for each body
-	for (int i = 0; i < bodies.size(); i++)
+	// create slider for the number of threads computing forces
+	if (ImGui::SliderInt("Threads", &threadCount, 1, ThreadPool::defaultThreadCount()))
+	{
+		int threads = threadCount;
+		simulation.post([threads](BodySystem&) { threadPool.setThreadCount(threads); });
+	}
+
+	// create selector for the gravity kernel, limited to instruction sets of this CPU
+	if (ImGui::Combo("Gravity kernel", &kernelSelection, simdLevelNames, supportedSimdLevel + 1))
+	{
+		SimdLevel level = (SimdLevel)kernelSelection;
+		simulation.post([level](BodySystem&) { simdLevel = level; });
+	}
+
+	// create selector for the gravity solver and its accuracy
+	const int solverCount = sizeof(solvers) / sizeof(solvers[0]);
+	const char* solverNames[solverCount];
+	for (int i = 0; i < solverCount; i++)
+		solverNames[i] = solvers[i]->name();
+	if (ImGui::Combo("Gravity solver", &solverSelection, solverNames, solverCount))
+	{
+		GravitySolver* solver = solvers[solverSelection];
+		simulation.post([solver](BodySystem&) { simulation.solver = solver; });
+	}
+	if (solvers[solverSelection] == &barnesHutSolver)
+	{
+		if (ImGui::SliderFloat("Opening angle", &barnesHutTheta, 0.1f, 1.5f))
+		{
+			double theta = barnesHutTheta;
+			simulation.post([theta](BodySystem&) { barnesHutSolver.theta = theta; });
+		}
+	}
+	else if (solvers[solverSelection] == &fmmSolver)
+	{
+		if (ImGui::SliderFloat("Opening angle", &fmmTheta, 0.1f, 1.0f))
+		{
+			double theta = fmmTheta;
+			simulation.post([theta](BodySystem&) { fmmSolver.theta = theta; });
+		}
+		if (ImGui::SliderInt("Expansion order", &fmmOrder, 1, 10))
+		{
+			int order = fmmOrder;
+			simulation.post([order](BodySystem&) { fmmSolver.setOrder(order); });
+		}
+	}
+	else if (solvers[solverSelection] == &particleMeshSolver)
+	{
+		// grid sizes are powers of two, selected by their exponent, up to the largest that fits in memory
+		if (ImGui::SliderInt("Grid size (log2)", &gridExponent, 3, (int)log2((double)maxGridSize)))
+		{
+			int size = 1 << gridExponent;
+			simulation.post([size](BodySystem&) { particleMeshSolver.setGridSize(size); });
+		}
+		if (ImGui::SliderFloat("Grid padding", &gridPadding, 0.0f, 1.0f))
+		{
+			double padding = gridPadding;
+			simulation.post([padding](BodySystem&) { particleMeshSolver.padding = padding; });
+		}
+		if (ImGui::SliderFloat("Direct above (kg)", &directMass, 1e10f, 1e30f, "%.0e", ImGuiSliderFlags_Logarithmic))
+		{
+			double mass = directMass;
+			simulation.post([mass](BodySystem&) { particleMeshSolver.massiveLimit = mass; });
+		}
+	}
+
+	// create selector for the integration scheme, its step, and the speed of the simulation
+	const int integratorCount = sizeof(integrators) / sizeof(integrators[0]);
+	const char* integratorNames[integratorCount];
+	for (int i = 0; i < integratorCount; i++)
+		integratorNames[i] = integrators[i]->name();
+	bool integratorChanged = ImGui::Combo("Integrator", &integratorSelection, integratorNames, integratorCount);
+	integratorChanged |= ImGui::Checkbox("Moons in local frames", &localMoons);
+	integratorChanged |= ImGui::Checkbox("Regularize close encounters", &regularize);
+	if (integratorChanged)
+	{
+		Integrator* integrator = integrators[integratorSelection];
+		bool pairs = regularize, nested = localMoons;
+		simulation.post([integrator, pairs, nested](BodySystem&) { selectIntegrator(integrator, pairs, nested); });
+	}
+	if (ImGui::SliderFloat("Step (s)", &stepSize, 1.0f, 1e6f, "%.0f", ImGuiSliderFlags_Logarithmic))
+	{
+		double size = stepSize;
+		simulation.post([size](BodySystem&) { simulation.stepSize = size; });
+	}
+	ImGui::Text("%d force evaluations per step, %lld in total", state.evaluationsPerStep, state.forceEvaluations);
+	if (ImGui::SliderFloat("Time warp", &timeWarp, 1.0f, 1e8f, "%.0e", ImGuiSliderFlags_Logarithmic))
+	{
+		double scale = timeWarp;
+		simulation.post([scale](BodySystem&) { simulation.timeScale = scale; });
+	}
+	if (ImGui::SliderFloat("Budget per tick (ms)", &budget, 0.1f, 50.0f, "%.1f", ImGuiSliderFlags_Logarithmic))
+	{
+		double seconds = budget * 1e-3;
+		simulation.post([seconds](BodySystem&) { simulation.budget = seconds; });
+	}
+	if (ImGui::SliderInt("Physics ticks per s", &tickRate, 1, 240))
+	{
+		double interval = 1.0 / tickRate;
+		simulation.post([interval](BodySystem&) { simulation.tickInterval = interval; });
+	}
+	ImGui::Text("%.3g simulated s per s%s", state.warp, state.limited ? ", limited by the budget" : "");
+
+	// trajectory: the states of all steps, compressed and written in the background
+	if (ImGui::Checkbox("Record trajectory", &recordTrajectory))
+	{
+		bool record = recordTrajectory;
+		simulation.post([record](BodySystem& bodies)
+		{
+			simulation.trajectory = nullptr;
+			trajectoryWriter.close();
+			if (record && trajectoryWriter.open(trajectoryPath, bodies, simulation.getTime()))
+				simulation.trajectory = &trajectoryWriter;
+		});
+	}
+	if (trajectoryWriter.droppedChunks() > 0)
+		ImGui::Text("%lld chunks of the trajectory dropped, the writer fell behind", trajectoryWriter.droppedChunks());
+
+	// timeline: scrubbing back restores the latest keyframe before the chosen time and steps on from
+	// there; while dragged, the slider keeps the time reached before so that it can go forward again
+	const float now = (float)(state.time / year);
+	if (!scrubbing)
+	{
+		timelineYears = now;
+		timelineEnd = now;
+	}
+	if (ImGui::SliderFloat("Timeline (years)", &timelineYears, (float)(state.history / year), std::max(timelineEnd, now), "%.4f"))
+	{
+		double time = timelineYears * year;
+		simulation.post([time](BodySystem&) { simulation.seek(time); });
+	}
+	scrubbing = ImGui::IsItemActive();
+	if (ImGui::SliderInt("Timeline memory (MB)", &timelineMemory, 1, 4096, "%d", ImGuiSliderFlags_Logarithmic))
+	{
+		size_t bytes = (size_t)timelineMemory << 20;
+		simulation.post([bytes](BodySystem&) { timeline.budget = bytes; });
+	}
+
+	// checkpoints: the whole state, saved at intervals or on request, and loaded to continue from it
+	if (ImGui::SliderFloat("Checkpoint every (years)", &checkpointYears, 0.0f, 100.0f, checkpointYears > 0 ? "%.2f" : "never", ImGuiSliderFlags_Logarithmic))
+	{
+		double interval = checkpointYears * year;
+		simulation.post([interval](BodySystem&)
+		{
+			checkpoints.interval = interval;
+			checkpoints.start(simulation.getTime());
+			simulation.keepIntegrator();
+		});
+	}
+	if (ImGui::Button("Save checkpoint"))
+	{
+		simulation.post([](BodySystem&)
+		{
+			checkpoints.save();
+			simulation.keepIntegrator();
+		});
+	}
+	ImGui::SameLine();
+	if (ImGui::Button("Load checkpoint"))
+	{
+		// read and checked on the simulation thread; the settings come back with the snapshots
+		simulation.post([](BodySystem&)
+		{
+			std::vector<unsigned char> payload;
+			Archive archive(payload, false);
+			PhysicsSettings settings;
+			if (!readCheckpoint(checkpoints.path.c_str(), payload) || !settings.serialize(archive))
+			{
+				simulation.loadedCheckpoint(nullptr);
+				simulation.keepIntegrator();
+				return;
+			}
+
+			// recordings would continue across the jump
+			simulation.recorder = nullptr;
+			ephemerisRecorder.close();
+			simulation.trajectory = nullptr;
+			trajectoryWriter.close();
+			Archive state(payload, false);
+			if (!checkpointState(state))
+			{
+				simulation.loadedCheckpoint(nullptr);
+				return;
+			}
+			simulation.keepIntegrator();
+			std::shared_ptr<std::vector<unsigned char> > controls(new std::vector<unsigned char>);
+			Archive written(*controls, true);
+			settings.serialize(written);
+			simulation.loadedCheckpoint(controls);
+		});
+	}
+	if (state.checkpointLoads != shownCheckpointLoads)
+	{
+		shownCheckpointLoads = state.checkpointLoads;
+		checkpointUnreadable = !state.checkpoint;
+		if (state.checkpoint)
+		{
+			std::vector<unsigned char> controls = *state.checkpoint;
+			Archive archive(controls, false);
+			PhysicsSettings settings;
+			if (settings.serialize(archive))
+				settings.show();
+			recordEphemeris = false;
+			recordTrajectory = false;
+		}
+	}
+	if (checkpointUnreadable)
+		ImGui::Text("%s is missing, damaged, or of another version", checkpoints.path.c_str());
+	else if (checkpoints.failed)
+		ImGui::Text("the checkpoint could not be written to %s", checkpoints.path.c_str());
+
+	// ephemeris: recorded while integrating, then read for seeking to any time it covers
+	if (ImGui::Checkbox("Record ephemeris", &recordEphemeris))
+	{
+		bool record = recordEphemeris;
+		simulation.post([record](BodySystem& bodies)
+		{
+			simulation.recorder = nullptr;
+			ephemerisRecorder.close();
+			if (record && ephemerisRecorder.open(ephemerisPath, bodies, simulation.getTime(), std::max(4 * 86400.0, 8 * simulation.stepSize)))
+				simulation.recorder = &ephemerisRecorder;
+
+			// whole granules are flushed as they are written, so the file can be read right away
+			std::shared_ptr<Ephemeris> loaded(new Ephemeris);
+			simulation.ephemeris = !record && loaded->load(ephemerisPath) ? loaded : nullptr;
+		});
+	}
+	if (state.ephemeris != shownEphemeris)
+	{
+		shownEphemeris = state.ephemeris;
+		seekYears = (float)(state.time / year);
+	}
+	const Ephemeris* ephemeris = state.ephemeris.get();
+	if (ephemeris && ephemeris->end() > ephemeris->begin())
+	{
+		if (ImGui::SliderFloat("Seek (years)", &seekYears, (float)(ephemeris->begin() / year), (float)(ephemeris->end() / year), "%.2f"))
+		{
+			double time = seekYears * year;
+			simulation.post([time](BodySystem& bodies)
+			{
+				if (simulation.ephemeris && simulation.ephemeris->apply(bodies, time))
+					simulation.setTime(time);
+			});
+		}
+	}
+
+	// asteroids: any number of them on fixed orbits, at no cost for the integration
+	int asteroids = state.size() - state.integrated;
+	if (ImGui::SliderInt("Asteroids (Kepler orbits)", &asteroids, 0, 10000, "%d", ImGuiSliderFlags_Logarithmic))
+	{
+		simulation.post([asteroids](BodySystem&)
+		{
+			createAsteroids(asteroids);
+			simulation.keepIntegrator();
+		});
+	}
+
+	// create checkboxes and buttons for each integrated body
+	for (int i = 0; i < state.integrated; i++)
 	{
-		Body& body = bodies[i];
+		const BodyInfo& body = state.properties[i];
 
 		// create buttons for inner planets
 		if (body.name == "Mercury" && ImGui::Button("Inner planets"))
 		{
 			bodySelection = inner;
-			setCamera();
+			setCamera(state);
 		}
 
 		// create buttons for outer planets
 		if (body.name == "Jupiter" && ImGui::Button("Outer planets"))
 		{
 			bodySelection = outer;
-			setCamera();
+			setCamera(state);
 		}
 
 		// create checkbox for body visibility
-		ImGui::Checkbox(("##" + body.name).c_str(), &body.visible);
+		bool visible = body.visible;
+		if (ImGui::Checkbox(("##" + body.name).c_str(), &visible))
+			simulation.post([i, visible](BodySystem& bodies) { bodies.properties(i).visible = visible; });
 		ImGui::SameLine();
 
 		// create button for body focusing
 		if (ImGui::Button(body.name.c_str()))
 		{
 			bodySelection = i;
-			setCamera();
+			setCamera(state);
 		}
 	}
 
 	if (bodySelection >= 0)
 	{
 		// create properties label
+		const int i = bodySelection;
 		ImGui::Separator();
-		ImGui::Text("%s properties:", bodies[bodySelection].name.c_str());
+		ImGui::Text("%s properties:", state.properties[i].name.c_str());
 
 		// create mass and spin input fields
-		ImGui::InputDouble("mass (kg)", &bodies[bodySelection].mass, 0.0, 0.0, "%e", ImGuiInputTextFlags_EnterReturnsTrue);
-		ImGui::InputDouble("spin (rad/s)", &bodies[bodySelection].rotSpeed, 0.0, 0.0, "%e", ImGuiInputTextFlags_EnterReturnsTrue);
+		double mass = state.masses[i];
+		if (ImGui::InputDouble("mass (kg)", &mass, 0.0, 0.0, "%e", ImGuiInputTextFlags_EnterReturnsTrue))
+			simulation.post([i, mass](BodySystem& bodies) { bodies.mass(i) = mass; });
+		double spin = state.spins[i];
+		if (ImGui::InputDouble("spin (rad/s)", &spin, 0.0, 0.0, "%e", ImGuiInputTextFlags_EnterReturnsTrue))
+			simulation.post([i, spin](BodySystem& bodies) { bodies.spin(i) = spin; });
 
 		// create button for adding moon
-		if (bodies[bodySelection].moonOption)
+		if (state.properties[i].moonOption)
 			if (ImGui::Button("add moon"))
-				addMoon();
+				simulation.post([i](BodySystem& bodies) { addMoon(bodies, i); });
 	}
 
 	// draw ImGui window
@@ -348,12 +862,22 @@ int main(void)
 	sphere.load("models/sphere.obj", program);
 	ring.load("models/ring.obj", program);
 
-	// create Solar system bodies
+	// create Solar system bodies and start simulating them
+	for (GravitySolver* solver : solvers)
+		solver->pool = &threadPool;
 	createBodies();
+	simulation.solver = solvers[solverSelection];
+	simulation.timeline = &timeline;
+	simulation.catalog = &catalog;
+	checkpoints.state = [](Archive& archive) { checkpointState(archive); };
+	simulation.checkpoints = &checkpoints;
+	selectIntegrator(integrators[integratorSelection], regularize, localMoons);
+	simulation.start();
 
 	// select Earth by default
 	bodySelection = 3;
-	setCamera();
+	drawn.update(simulation.latest(), steadyTime());
+	setCamera(simulation.latest());
 
 	while (!glfwWindowShouldClose(window))
 	{
@@ -363,9 +887,9 @@ int main(void)
 		double timeStep = newTime - time;
 		time = newTime;
 
-		// update velocities and positions of all bodies
-		if (!paused)
-			updateBodies(timeStep);
+		// latest state of the bodies, the simulation keeps running meanwhile, and the state to draw
+		const Snapshot& state = simulation.latest();
+		drawn.update(state, steadyTime());
 
 		// clear window
 		int width, height;
@@ -396,43 +920,45 @@ int main(void)
 		cube.drawSkybox(program, skyboxTextures);
 
 		// set sun position for shaders
-		Body& sun = bodies[0];
-		glUniform3f(glGetUniformLocation(program, "sunPosition"), (float)sun.position.x, (float)sun.position.y, (float)sun.position.z);
+		dvec3 sun = drawn.positions[0];
+		glUniform3f(glGetUniformLocation(program, "sunPosition"), (float)sun.x, (float)sun.y, (float)sun.z);
 
 		// draw bodies
 		glUniformMatrix4fv(glGetUniformLocation(program, "viewMatrix"), 1, GL_FALSE, (const GLfloat*)viewMatrix);
-		for (int i = 0; i < bodies.size(); i++)
+		for (int i = 0; i < state.size(); i++)
 		{
 			// ignore hidden bodies
-			Body& body = bodies[i];
+			const BodyInfo& body = state.properties[i];
 			if (!body.visible)
 				continue;
 
 			// draw a sphere
 			glUniform1i(glGetUniformLocation(program, "useLighting"), body.name != "Sun");
-			sphere.draw(program, bodyPosition(i), bodyRadius(i), body.tilt, body.rotAngle, body.texture);
+			sphere.draw(program, bodyPosition(state, i), bodyRadius(state, i), body.tilt, drawn.rotAngles[i], body.texture);
 		}
 
 		// draw a ring for Saturn
-		for (int i = 0; i < bodies.size(); i++)
+		for (int i = 0; i < state.size(); i++)
 		{
-			if (bodies[i].visible && bodies[i].name == "Saturn")
+			const BodyInfo& body = state.properties[i];
+			if (body.visible && body.name == "Saturn")
 			{
 				// use transparent blending
 				glUniform1i(glGetUniformLocation(program, "useLighting"), 0);
 				glEnable(GL_BLEND);
 				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-				ring.draw(program, bodyPosition(i), bodyRadius(i), bodies[i].tilt, 0, ringTexture);
+				ring.draw(program, bodyPosition(state, i), bodyRadius(state, i), body.tilt, 0, ringTexture);
 				glDisable(GL_BLEND);
 			}
 		}
 
-		drawGui();
+		drawGui(state);
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
+	simulation.stop();
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
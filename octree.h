@@ -0,0 +1,191 @@
+// cube of the octree with mass moments of the bodies inside it
+struct OctreeNode
+{
+	double cx, cy, cz; // geometric center
+	double size;       // half width of the cube
+	double mx, my, mz; // center of mass (geometric center if massless)
+	double mass;
+	double radius;     // distance from the center of mass to the farthest body inside
+	int firstChild;    // index of the first child node, children are stored contiguously
+	int childCount;    // zero for leaves
+	int begin, end;    // range of bodies in the sorted index array
+};
+
+// adaptive octree over the first bodies of a body system, rebuilt from scratch on each step
+class Octree
+{
+public:
+	Octree() : leafSize(8)
+	{
+	}
+
+	void build(const BodySystem& bodies, int count)
+	{
+		nodes.clear();
+		index.resize(count);
+		scratch.resize(count);
+		for (int i = 0; i < count; i++)
+			index[i] = i;
+		if (count == 0)
+			return;
+
+		// bounding cube of all bodies
+		double low[3] = { bodies.x[0], bodies.y[0], bodies.z[0] };
+		double high[3] = { low[0], low[1], low[2] };
+		for (int i = 1; i < count; i++)
+		{
+			double p[3] = { bodies.x[i], bodies.y[i], bodies.z[i] };
+			for (int k = 0; k < 3; k++)
+			{
+				low[k] = std::min(low[k], p[k]);
+				high[k] = std::max(high[k], p[k]);
+			}
+		}
+		double size = 0.5 * std::max(high[0] - low[0], std::max(high[1] - low[1], high[2] - low[2]));
+
+		OctreeNode root;
+		root.cx = 0.5 * (low[0] + high[0]);
+		root.cy = 0.5 * (low[1] + high[1]);
+		root.cz = 0.5 * (low[2] + high[2]);
+		root.size = size * (1 + 1e-12) + 1e-300;
+		root.begin = 0;
+		root.end = count;
+		nodes.push_back(root);
+		split(bodies, 0, 0);
+
+		// copy positions and masses in tree order so that leaves are contiguous in memory
+		x.resize(count);
+		y.resize(count);
+		z.resize(count);
+		m.resize(count);
+		for (int k = 0; k < count; k++)
+		{
+			x[k] = bodies.x[index[k]];
+			y[k] = bodies.y[index[k]];
+			z[k] = bodies.z[index[k]];
+			m[k] = bodies.m[index[k]];
+		}
+	}
+
+	int leafSize;                   // maximal number of bodies in a leaf
+	std::vector<OctreeNode> nodes;  // root node first
+	std::vector<int> index;         // body indices grouped by leaf
+	std::vector<double> x, y, z, m; // bodies in index order
+
+private:
+	void split(const BodySystem& bodies, int node, int depth)
+	{
+		OctreeNode n = nodes[node];
+		n.firstChild = -1;
+		n.childCount = 0;
+
+		// subdivide while there are too many bodies (bounded depth for coincident bodies)
+		if (n.end - n.begin > leafSize && depth < 48)
+		{
+			// counting sort of the node's bodies by octant
+			int counts[8] = { 0 };
+			for (int k = n.begin; k < n.end; k++)
+				counts[octant(bodies, n, index[k])]++;
+			int offsets[8];
+			int offset = n.begin;
+			for (int o = 0; o < 8; o++)
+			{
+				offsets[o] = offset;
+				offset += counts[o];
+			}
+			for (int k = n.begin; k < n.end; k++)
+				scratch[offsets[octant(bodies, n, index[k])]++] = index[k];
+			for (int k = n.begin; k < n.end; k++)
+				index[k] = scratch[k];
+
+			// create non-empty children contiguously, then subdivide them
+			n.firstChild = (int)nodes.size();
+			int begin = n.begin;
+			for (int o = 0; o < 8; o++)
+			{
+				if (counts[o] == 0)
+					continue;
+
+				OctreeNode child;
+				child.size = 0.5 * n.size;
+				child.cx = n.cx + (o & 1 ? child.size : -child.size);
+				child.cy = n.cy + (o & 2 ? child.size : -child.size);
+				child.cz = n.cz + (o & 4 ? child.size : -child.size);
+				child.begin = begin;
+				child.end = begin + counts[o];
+				nodes.push_back(child);
+				begin += counts[o];
+				n.childCount++;
+			}
+			for (int c = 0; c < n.childCount; c++)
+				split(bodies, n.firstChild + c, depth + 1);
+		}
+
+		// mass and center of mass, from children where available
+		n.mass = n.mx = n.my = n.mz = 0;
+		if (n.childCount == 0)
+		{
+			for (int k = n.begin; k < n.end; k++)
+			{
+				int i = index[k];
+				n.mass += bodies.m[i];
+				n.mx += bodies.m[i] * bodies.x[i];
+				n.my += bodies.m[i] * bodies.y[i];
+				n.mz += bodies.m[i] * bodies.z[i];
+			}
+		}
+		else
+		{
+			for (int c = 0; c < n.childCount; c++)
+			{
+				const OctreeNode& child = nodes[n.firstChild + c];
+				n.mass += child.mass;
+				n.mx += child.mass * child.mx;
+				n.my += child.mass * child.my;
+				n.mz += child.mass * child.mz;
+			}
+		}
+		if (n.mass > 0)
+		{
+			n.mx /= n.mass;
+			n.my /= n.mass;
+			n.mz /= n.mass;
+		}
+		else
+		{
+			n.mx = n.cx;
+			n.my = n.cy;
+			n.mz = n.cz;
+		}
+
+		// bounding radius around the center of mass, from children where available
+		n.radius = 0;
+		if (n.childCount == 0)
+		{
+			for (int k = n.begin; k < n.end; k++)
+			{
+				int i = index[k];
+				double dx = bodies.x[i] - n.mx, dy = bodies.y[i] - n.my, dz = bodies.z[i] - n.mz;
+				n.radius = std::max(n.radius, sqrt(dx * dx + dy * dy + dz * dz));
+			}
+		}
+		else
+		{
+			for (int c = 0; c < n.childCount; c++)
+			{
+				const OctreeNode& child = nodes[n.firstChild + c];
+				double dx = child.mx - n.mx, dy = child.my - n.my, dz = child.mz - n.mz;
+				n.radius = std::max(n.radius, child.radius + sqrt(dx * dx + dy * dy + dz * dz));
+			}
+		}
+
+		nodes[node] = n;
+	}
+
+	static int octant(const BodySystem& bodies, const OctreeNode& n, int i)
+	{
+		return (bodies.x[i] >= n.cx ? 1 : 0) | (bodies.y[i] >= n.cy ? 2 : 0) | (bodies.z[i] >= n.cz ? 4 : 0);
+	}
+
+	std::vector<int> scratch; // temporary index array for sorting
+};
@@ -0,0 +1,328 @@
+// Particle-mesh gravity solver for diffuse matter such as dust rings and debris fields, combined
+// with direct summation for massive bodies.
+//
+// Light bodies are deposited onto a cubic grid with cloud-in-cell weights. Their potential is the
+// convolution of the mass grid with 1/r, done with FFTs on a grid of twice the size so that the
+// boundaries are isolated rather than periodic, and the accelerations from central differences are
+// interpolated back with the same weights. Bodies of at least massiveLimit are kept off the grid:
+// every pair involving one of them is summed directly, which costs O(N M) for M massive bodies.
+
+const int maxGridSize = 128; // cells per axis; the doubled grid of complex values then takes 268 MB
+
+class ParticleMeshSolver : public GravitySolver
+{
+public:
+	ParticleMeshSolver() : padding(0.1), massiveLimit(1e20), cells(0), greenCells(0)
+	{
+		setGridSize(64);
+	}
+
+	const char* name() const override
+	{
+		return "particle-mesh";
+	}
+
+	// cells per axis, rounded up to a power of two between 8 and maxGridSize
+	void setGridSize(int size)
+	{
+		int n = 8;
+		while (n < size && n < maxGridSize)
+			n *= 2;
+		cells = n;
+	}
+
+	int getGridSize() const
+	{
+		return cells;
+	}
+
+	void computeAccelerations(BodySystem& bodies) override
+	{
+		const int n = bodies.size();
+		light.clear();
+		massive.clear();
+		for (int i = 0; i < n; i++)
+		{
+			if (bodies.m[i] >= massiveLimit)
+				massive.push_back(i);
+			else
+				light.push_back(i);
+		}
+
+		for (int i = 0; i < n; i++)
+			bodies.ax[i] = bodies.ay[i] = bodies.az[i] = 0;
+		if (light.size() > 1)
+			meshAccelerations(bodies);
+		directAccelerations(bodies);
+	}
+
+	double padding;      // empty margin around the light bodies, as a fraction of their extent
+	double massiveLimit; // bodies with at least this mass (kg) are summed directly
+
+private:
+	// all pairs that involve a massive body; every body sums its own row, so that threads never
+	// write the same body
+	void directAccelerations(BodySystem& bodies)
+	{
+		if (massive.empty())
+			return;
+
+		// massive bodies attract the light ones
+		parallelFor((int)light.size(), 256, [&](int begin, int end, int)
+		{
+			for (int k = begin; k < end; k++)
+			{
+				const int i = light[k];
+				double ax = 0, ay = 0, az = 0;
+				for (int j : massive)
+					addAttraction(bodies, i, j, ax, ay, az);
+				bodies.ax[i] += ax;
+				bodies.ay[i] += ay;
+				bodies.az[i] += az;
+			}
+		});
+
+		// massive bodies are attracted by all others
+		parallelFor((int)massive.size(), 1, [&](int begin, int end, int)
+		{
+			for (int k = begin; k < end; k++)
+			{
+				const int i = massive[k];
+				double ax = 0, ay = 0, az = 0;
+				for (int j = 0; j < bodies.size(); j++)
+					if (j != i)
+						addAttraction(bodies, i, j, ax, ay, az);
+				bodies.ax[i] += ax;
+				bodies.ay[i] += ay;
+				bodies.az[i] += az;
+			}
+		});
+	}
+
+	static void addAttraction(const BodySystem& bodies, int i, int j, double& ax, double& ay, double& az)
+	{
+		double dx = bodies.x[j] - bodies.x[i], dy = bodies.y[j] - bodies.y[i], dz = bodies.z[j] - bodies.z[i];
+		double r2 = dx * dx + dy * dy + dz * dz;
+		if (r2 > 0)
+		{
+			double s = gravity * bodies.m[j] / (r2 * sqrt(r2));
+			ax += s * dx;
+			ay += s * dy;
+			az += s * dz;
+		}
+	}
+
+	// forces between light bodies through the grid
+	void meshAccelerations(BodySystem& bodies)
+	{
+		// cube around the light bodies with the padding margin on each side
+		double low[3] = { bodies.x[light[0]], bodies.y[light[0]], bodies.z[light[0]] };
+		double high[3] = { low[0], low[1], low[2] };
+		for (int i : light)
+		{
+			double p[3] = { bodies.x[i], bodies.y[i], bodies.z[i] };
+			for (int k = 0; k < 3; k++)
+			{
+				low[k] = std::min(low[k], p[k]);
+				high[k] = std::max(high[k], p[k]);
+			}
+		}
+		double extent = std::max(high[0] - low[0], std::max(high[1] - low[1], high[2] - low[2]));
+		if (extent == 0)
+			return;
+		cellSize = extent * (1 + 2 * padding) / (cells - 1);
+		for (int k = 0; k < 3; k++)
+			origin[k] = 0.5 * (low[k] + high[k]) - 0.5 * (cells - 1) * cellSize;
+
+		const int m = 2 * cells;
+		line.resize(threadCount() * 8 * m);
+		if (greenCells != cells)
+			prepareGreen();
+
+		// cloud-in-cell deposition into the first octant of the doubled grid
+		grid.assign((size_t)m * m * m, std::complex<double>(0, 0));
+		for (int i : light)
+		{
+			int cell[3];
+			double weight[3];
+			locate(bodies, i, cell, weight);
+			for (int c = 0; c < 8; c++)
+			{
+				double w = bodies.m[i];
+				for (int k = 0; k < 3; k++)
+					w *= c & (1 << k) ? weight[k] : 1 - weight[k];
+				grid[index(cell[0] + (c & 1), cell[1] + (c >> 1 & 1), cell[2] + (c >> 2 & 1))] += w;
+			}
+		}
+
+		// convolution with the Green's function; the zero octants are skipped where possible
+		transformRows(cells, cells, false);
+		transformColumns(cells, (size_t)m * m, m, false);
+		transformColumns(m, m, (size_t)m * m, false);
+		const int h = cells + 1;
+		parallelFor(m, 1, [&](int begin, int end, int)
+		{
+			for (int z = begin; z < end; z++)
+				for (int y = 0; y < m; y++)
+				{
+					const double* row = &green[((size_t)std::min(z, m - z) * h + std::min(y, m - y)) * h];
+					std::complex<double>* values = &grid[index(0, y, z)];
+					for (int x = 0; x < m; x++)
+						values[x] *= row[std::min(x, m - x)];
+				}
+		});
+		transformColumns(m, m, (size_t)m * m, true);
+		transformColumns(cells, (size_t)m * m, m, true);
+		transformRows(cells, cells, true);
+
+		// potential in the first octant, including the 1/m^3 of the inverse transform
+		const double scale = -gravity / (cellSize * (double)m * m * m);
+		potential.resize((size_t)cells * cells * cells);
+		parallelFor(cells, 1, [&](int begin, int end, int)
+		{
+			for (int z = begin; z < end; z++)
+				for (int y = 0; y < cells; y++)
+					for (int x = 0; x < cells; x++)
+						potential[(z * cells + y) * cells + x] = scale * grid[index(x, y, z)].real();
+		});
+
+		// accelerations on the grid by central differences, one-sided at the edges
+		for (int k = 0; k < 3; k++)
+			field[k].resize(potential.size());
+		const int steps[3] = { 1, cells, cells * cells };
+		parallelFor(cells, 1, [&](int begin, int end, int)
+		{
+			for (int z = begin; z < end; z++)
+				for (int y = 0; y < cells; y++)
+					for (int x = 0; x < cells; x++)
+					{
+						const int position[3] = { x, y, z };
+						const int c = (z * cells + y) * cells + x;
+						for (int k = 0; k < 3; k++)
+						{
+							int before = position[k] > 0 ? c - steps[k] : c;
+							int after = position[k] < cells - 1 ? c + steps[k] : c;
+							double spacing = (after - before) / steps[k] * cellSize;
+							field[k][c] = -(potential[after] - potential[before]) / spacing;
+						}
+					}
+		});
+
+		// interpolation back to the bodies with the deposition weights
+		parallelFor((int)light.size(), 256, [&](int begin, int end, int)
+		{
+			for (int k = begin; k < end; k++)
+				interpolate(bodies, light[k]);
+		});
+	}
+
+	void interpolate(BodySystem& bodies, int i) const
+	{
+		int cell[3];
+		double weight[3];
+		locate(bodies, i, cell, weight);
+		double a[3] = { 0, 0, 0 };
+		for (int c = 0; c < 8; c++)
+		{
+			double w = 1;
+			for (int k = 0; k < 3; k++)
+				w *= c & (1 << k) ? weight[k] : 1 - weight[k];
+			int g = ((cell[2] + (c >> 2 & 1)) * cells + cell[1] + (c >> 1 & 1)) * cells + cell[0] + (c & 1);
+			for (int k = 0; k < 3; k++)
+				a[k] += w * field[k][g];
+		}
+		bodies.ax[i] += a[0];
+		bodies.ay[i] += a[1];
+		bodies.az[i] += a[2];
+	}
+
+	// lower corner cell of a body and its fractional offset inside that cell
+	void locate(const BodySystem& bodies, int i, int* cell, double* weight) const
+	{
+		const double p[3] = { bodies.x[i], bodies.y[i], bodies.z[i] };
+		for (int k = 0; k < 3; k++)
+		{
+			double u = (p[k] - origin[k]) / cellSize;
+			cell[k] = std::max(0, std::min((int)u, cells - 2));
+			weight[k] = std::max(0.0, std::min(u - cell[k], 1.0));
+		}
+	}
+
+	size_t index(int x, int y, int z) const
+	{
+		const size_t m = 2 * cells;
+		return (z * m + y) * m + x;
+	}
+
+	// transform of 1/r in cell units on the doubled grid, with distances wrapped around;
+	// at the origin the mean of 1/r over a unit cube seen from its center
+	void prepareGreen()
+	{
+		const int m = 2 * cells;
+		fft.setSize(m);
+		grid.resize((size_t)m * m * m);
+		for (int z = 0; z < m; z++)
+			for (int y = 0; y < m; y++)
+				for (int x = 0; x < m; x++)
+				{
+					double dx = std::min(x, m - x), dy = std::min(y, m - y), dz = std::min(z, m - z);
+					double r = sqrt(dx * dx + dy * dy + dz * dz);
+					grid[index(x, y, z)] = r > 0 ? 1 / r : 2.38008;
+				}
+		transformRows(m, m, false);
+		transformColumns(m, (size_t)m * m, m, false);
+		transformColumns(m, m, (size_t)m * m, false);
+
+		// the kernel is real and even along each axis, and so is its transform: one octant holds all of it
+		const int h = cells + 1;
+		green.resize((size_t)h * h * h);
+		for (int z = 0; z < h; z++)
+			for (int y = 0; y < h; y++)
+				for (int x = 0; x < h; x++)
+					green[((size_t)z * h + y) * h + x] = grid[index(x, y, z)].real();
+		greenCells = cells;
+	}
+
+	// transforms the contiguous x lines for z < planes and y < rows
+	void transformRows(int planes, int rows, bool inverse)
+	{
+		parallelFor(planes * rows, 16, [&](int begin, int end, int)
+		{
+			for (int k = begin; k < end; k++)
+				fft.transform(&grid[index(0, k % rows, k / rows)], inverse);
+		});
+	}
+
+	// transforms the lines outer * outerStep + x + k * stride over k, eight adjacent x at a time
+	// so that each cache line that is read is used completely
+	void transformColumns(int outerCount, size_t outerStep, size_t stride, bool inverse)
+	{
+		const int m = fft.size();
+		const int batches = m / 8;
+		parallelFor(outerCount * batches, 1, [&](int begin, int end, int thread)
+		{
+			std::complex<double>* lines = &line[thread * 8 * m];
+			for (int job = begin; job < end; job++)
+			{
+				std::complex<double>* base = &grid[job / batches * outerStep + job % batches * 8];
+				for (int k = 0; k < m; k++)
+					for (int b = 0; b < 8; b++)
+						lines[b * m + k] = base[k * stride + b];
+				for (int b = 0; b < 8; b++)
+					fft.transform(&lines[b * m], inverse);
+				for (int k = 0; k < m; k++)
+					for (int b = 0; b < 8; b++)
+						base[k * stride + b] = lines[b * m + k];
+			}
+		});
+	}
+
+	int cells, greenCells;
+	double cellSize;
+	double origin[3];
+	Fft fft;
+	std::vector<int> light, massive;               // body indices by kind
+	std::vector<std::complex<double> > grid, line; // doubled grid and a batch of lines per thread
+	std::vector<double> green;                     // transform of the Green's function, first octant
+	std::vector<double> potential, field[3];       // first octant only
+};
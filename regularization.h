@@ -0,0 +1,533 @@
+// Kustaanheimo-Stiefel (KS) regularization of a two-body orbit.
+//
+// The relative position r (3D) is written as r = L(u) u with a 4D vector u, and time is replaced by
+// a fictitious time s with dt = |r| ds. The Kepler problem then becomes a harmonic oscillator
+// u'' = h/2 u with the constant energy h = v^2/2 - mu/|r|, free of the 1/r^2 singularity, so that
+// close approaches and even collisions are as smooth as any other part of the orbit.
+
+// KS matrix L(u) applied to a 4D vector
+void ksMatrix(const double* u, const double* a, double* result)
+{
+	result[0] = u[0] * a[0] - u[1] * a[1] - u[2] * a[2] + u[3] * a[3];
+	result[1] = u[1] * a[0] + u[0] * a[1] - u[3] * a[2] - u[2] * a[3];
+	result[2] = u[2] * a[0] + u[3] * a[1] + u[0] * a[2] + u[1] * a[3];
+	result[3] = u[3] * a[0] - u[2] * a[1] + u[1] * a[2] - u[0] * a[3];
+}
+
+// transposed KS matrix applied to a 3D vector (with a zero fourth component)
+void ksTransposed(const double* u, const double* a, double* result)
+{
+	result[0] = u[0] * a[0] + u[1] * a[1] + u[2] * a[2];
+	result[1] = -u[1] * a[0] + u[0] * a[1] + u[3] * a[2];
+	result[2] = -u[2] * a[0] - u[3] * a[1] + u[0] * a[2];
+	result[3] = u[3] * a[0] - u[2] * a[1] + u[1] * a[2];
+}
+
+// KS coordinates u and their derivative w = du/ds of a relative position and velocity
+void ksFromCartesian(const double* r, const double* v, double* u, double* w)
+{
+	const double length = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+	if (r[0] >= 0)
+	{
+		u[0] = sqrt(0.5 * (length + r[0]));
+		u[3] = 0;
+		u[1] = 0.5 * r[1] / u[0];
+		u[2] = 0.5 * r[2] / u[0];
+	}
+	else
+	{
+		u[1] = sqrt(0.5 * (length - r[0]));
+		u[2] = 0;
+		u[0] = 0.5 * r[1] / u[1];
+		u[3] = 0.5 * r[2] / u[1];
+	}
+	ksTransposed(u, v, w);
+	for (int k = 0; k < 4; k++)
+		w[k] *= 0.5;
+}
+
+void ksToCartesian(const double* u, const double* w, double* r, double* v)
+{
+	double p[4], q[4];
+	ksMatrix(u, u, p);
+	ksMatrix(u, w, q);
+	const double length = u[0] * u[0] + u[1] * u[1] + u[2] * u[2] + u[3] * u[3];
+	for (int k = 0; k < 3; k++)
+	{
+		r[k] = p[k];
+		v[k] = length > 0 ? 2 * q[k] / length : 0;
+	}
+}
+
+// exact oscillator motion over the fictitious time s; returns the physical time it takes.
+// With z = -h/2 s^2 and Stumpff functions, bound and unbound orbits need no distinction.
+double ksDrift(double* u, double* w, double h, double s)
+{
+	const double z = -0.5 * h * s * s;
+	double c2, c3, c2Double, c3Double;
+	stumpff(z, c2, c3);
+	stumpff(4 * z, c2Double, c3Double);
+	const double cosine = 1 - z * c2;  // cos(omega s)
+	const double sine = s * (1 - z * c3); // sin(omega s) / omega
+
+	// time: integral of |u|^2 over s
+	double uu = 0, uw = 0, ww = 0;
+	for (int k = 0; k < 4; k++)
+	{
+		uu += u[k] * u[k];
+		uw += u[k] * w[k];
+		ww += w[k] * w[k];
+	}
+	const double time = uu * 0.5 * s * (2 - 4 * z * c3Double) + 2 * uw * s * s * c2Double + 2 * ww * s * s * s * c3Double;
+
+	for (int k = 0; k < 4; k++)
+	{
+		double position = u[k] * cosine + w[k] * sine;
+		w[k] = w[k] * cosine + 0.5 * h * u[k] * sine;
+		u[k] = position;
+	}
+	return time;
+}
+
+// fictitious time whose drift takes the given physical time, by Newton's method
+double ksDriftLength(const double* u, const double* w, double h, double time)
+{
+	double uu = u[0] * u[0] + u[1] * u[1] + u[2] * u[2] + u[3] * u[3];
+	double s = time / uu;
+	for (int iteration = 0; iteration < 50; iteration++)
+	{
+		double trialU[4] = { u[0], u[1], u[2], u[3] };
+		double trialW[4] = { w[0], w[1], w[2], w[3] };
+		double error = ksDrift(trialU, trialW, h, s) - time;
+		double rate = trialU[0] * trialU[0] + trialU[1] * trialU[1] + trialU[2] * trialU[2] + trialU[3] * trialU[3];
+		double correction = error / rate;
+		s -= correction;
+		if (fabs(correction) <= 1e-15 * fabs(s))
+			break;
+	}
+	return s;
+}
+
+// close pairs of bodies integrated with KS regularization.
+//
+// A pair is formed when two bodies come so close that their orbit around each other takes less
+// than a few outer steps, while the rest of the system disturbs it only weakly. The outer
+// integrator then sees a single body at their center of mass, and the relative motion follows the
+// KS oscillator exactly between kicks from the tidal field of the other bodies, which is
+// interpolated over the step. Close approaches therefore neither force short outer steps nor spoil
+// the energy. The pair is resolved again once the bodies separate or a third body disturbs them
+// or comes close.
+// The most massive body is left out when it dominates the system: the outer integrator is made
+// for the orbits around it.
+class EncounterIntegrator : public Integrator
+{
+public:
+	EncounterIntegrator() : outer(nullptr), closeSteps(8), tidalLimit(0.1), clearance(2), eta(0.05), regularizedSteps(0), built(false), count(-1)
+	{
+	}
+
+	const char* name() const override
+	{
+		return outer ? outer->name() : "regularized encounters";
+	}
+
+	int order() const override
+	{
+		return outer ? outer->order() : 0;
+	}
+
+	int evaluationsPerStep() const override
+	{
+		return outer ? outer->evaluationsPerStep() : 0;
+	}
+
+	void reset() override
+	{
+		built = false;
+		if (outer)
+			outer->reset();
+	}
+
+	// the outer integrator is saved on its own
+	void serialize(Archive& archive) override
+	{
+		Integrator::serialize(archive);
+		archive.value(closeSteps);
+		archive.value(tidalLimit);
+		archive.value(clearance);
+		archive.value(eta);
+		archive.value(regularizedSteps);
+		archive.value(built);
+		archive.value(count);
+		archive.value(pairs);
+		top.serialize(archive);
+		archive.value(topBodies);
+	}
+
+	// pairs currently regularized
+	int pairCount() const
+	{
+		return (int)pairs.size();
+	}
+
+	void step(BodySystem& bodies, GravitySolver& solver, double dt) override
+	{
+		if (!outer || dt == 0)
+			return;
+		if (!built || bodies.size() != count)
+		{
+			pairs.clear();
+			build(bodies);
+		}
+
+		// new close pairs among the single bodies
+		BodySystem* system = pairs.empty() ? &bodies : &top;
+		if (detect(*system, dt))
+		{
+			build(bodies);
+			system = pairs.empty() ? &bodies : &top;
+		}
+
+		// outer step, with the tidal field on each pair before and after it
+		for (Pair& pair : pairs)
+			tidalTensor(top, pair.outerIndex, pair.tides);
+		outer->step(*system, solver, dt);
+		for (Pair& pair : pairs)
+		{
+			pair.nearest = tidalTensor(top, pair.outerIndex, pair.tides + 9);
+			advance(pair, dt);
+		}
+
+		if (!pairs.empty())
+		{
+			store(bodies, dt);
+
+			// resolve pairs that separated or are disturbed
+			bool changed = false;
+			for (int p = (int)pairs.size() - 1; p >= 0; p--)
+				if (!keep(pairs[p], dt))
+				{
+					pairs.erase(pairs.begin() + p);
+					changed = true;
+				}
+			if (changed)
+				build(bodies);
+		}
+		forceEvaluations = outer->forceEvaluations;
+	}
+
+	Integrator* outer;          // advances the single bodies and the centers of mass of pairs
+	double closeSteps;          // a pair forms when its orbital time r^1.5 / sqrt(mu) is below this many steps
+	double tidalLimit;          // and the tides of the others are below this fraction of its own attraction
+	double clearance;           // and no other body is closer than this many separations
+	double eta;                 // fictitious time step as a fraction of sqrt(r / mu)
+	long long regularizedSteps; // KS steps since the start
+
+private:
+	struct Pair
+	{
+		int first, second;  // bodies
+		int outerIndex;     // center of mass in the outer system
+		double mu;          // G (m1 + m2)
+		double u[4], w[4];  // KS coordinates of second - first and their derivative
+		double h;           // energy of the relative orbit per reduced mass
+		double tides[18];   // tidal tensor at the start and the end of the step
+		double nearest;     // distance of the closest other body at the end of the step
+	};
+
+	// outer system of single bodies and centers of mass, KS states from the current bodies
+	void build(BodySystem& bodies)
+	{
+		const int n = bodies.size();
+		count = n;
+		built = true;
+		outer->reset();
+		top.clear();
+		topBodies.clear();
+		if (pairs.empty())
+		{
+			// the bodies themselves are the outer system
+			for (int i = 0; i < n; i++)
+				topBodies.push_back(i);
+			return;
+		}
+
+		std::vector<int> pairOf(n, -1);
+		for (int p = 0; p < (int)pairs.size(); p++)
+		{
+			pairOf[pairs[p].first] = p;
+			pairOf[pairs[p].second] = p;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			const int p = pairOf[i];
+			if (p < 0)
+			{
+				top.add(bodies.get(i));
+				topBodies.push_back(i);
+				continue;
+			}
+			Pair& pair = pairs[p];
+			if (i != pair.first)
+				continue;
+
+			// center of mass in place of the first body
+			const int j = pair.second;
+			const double m1 = bodies.m[i], m2 = bodies.m[j], mass = m1 + m2;
+			Body center = bodies.get(i);
+			center.mass = mass;
+			center.position = (bodies.position(i) * m1 + bodies.position(j) * m2) * (1 / mass);
+			center.velocity = (bodies.velocity(i) * m1 + bodies.velocity(j) * m2) * (1 / mass);
+			center.rotSpeed = 0;
+			pair.outerIndex = top.size();
+			top.add(center);
+			topBodies.push_back(-1);
+
+			double r[3] = { bodies.x[j] - bodies.x[i], bodies.y[j] - bodies.y[i], bodies.z[j] - bodies.z[i] };
+			double v[3] = { bodies.vx[j] - bodies.vx[i], bodies.vy[j] - bodies.vy[i], bodies.vz[j] - bodies.vz[i] };
+			pair.mu = gravity * mass;
+			ksFromCartesian(r, v, pair.u, pair.w);
+			pair.h = 0.5 * (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]) - pair.mu / sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+		}
+	}
+
+	// adds close, weakly disturbed pairs of single bodies; returns whether there were any
+	bool detect(const BodySystem& system, double dt)
+	{
+		const int n = system.size();
+		if (n < 2)
+			return false;
+
+		// a dominant central body is never paired; bound the search distance by the heaviest rest
+		double total = 0, heaviest = 0;
+		int central = 0;
+		for (int i = 0; i < n; i++)
+		{
+			total += system.m[i];
+			if (system.m[i] > system.m[central])
+				central = i;
+		}
+		for (int i = 0; i < n; i++)
+			if (i != central || system.m[central] <= 0.5 * total)
+				heaviest = std::max(heaviest, system.m[i]);
+		const double time = closeSteps * fabs(dt);
+		const double reach = pow(time * time * gravity * 2 * heaviest, 1.0 / 3);
+		if (reach <= 0)
+			return false;
+
+		// sweep over the bodies sorted along x
+		sorted.resize(n);
+		for (int i = 0; i < n; i++)
+			sorted[i] = i;
+		std::sort(sorted.begin(), sorted.end(), [&](int a, int b) { return system.x[a] < system.x[b]; });
+		taken.assign(n, false);
+		const int before = (int)pairs.size();
+		for (int a = 0; a < n; a++)
+		{
+			const int i = sorted[a];
+			if (taken[i] || !single(system, i, central, total))
+				continue;
+			for (int b = a + 1; b < n && system.x[sorted[b]] - system.x[i] < reach; b++)
+			{
+				const int j = sorted[b];
+				if (taken[j] || !single(system, j, central, total))
+					continue;
+				double dx = system.x[j] - system.x[i], dy = system.y[j] - system.y[i], dz = system.z[j] - system.z[i];
+				double r2 = dx * dx + dy * dy + dz * dz;
+				double mu = gravity * (system.m[i] + system.m[j]);
+				if (mu <= 0 || r2 * sqrt(r2) >= time * time * mu)
+					continue;
+
+				// weakly disturbed by the others
+				double tides[9];
+				dvec3 center = (system.position(i) * system.m[i] + system.position(j) * system.m[j]) * (1 / (system.m[i] + system.m[j]));
+				double nearest = tidalTensorAt(system, center, i, j, tides);
+				if (tidalRatio(tides, mu, sqrt(r2)) >= tidalLimit || nearest * nearest <= clearance * clearance * r2)
+					continue;
+
+				taken[i] = taken[j] = true;
+				Pair pair;
+				pair.first = std::min(topBodies[i], topBodies[j]);
+				pair.second = std::max(topBodies[i], topBodies[j]);
+				pairs.push_back(pair);
+				break;
+			}
+		}
+		return (int)pairs.size() > before;
+	}
+
+	// an actual body of the outer system, not a pair or a dominant central body
+	bool single(const BodySystem& system, int i, int central, double total) const
+	{
+		if (i == central && system.m[central] > 0.5 * total)
+			return false;
+		return topBodies[i] >= 0;
+	}
+
+	// tidal tensor of all outer bodies except the given center of mass, at its position
+	double tidalTensor(const BodySystem& system, int index, double* tides) const
+	{
+		return tidalTensorAt(system, system.position(index), index, index, tides);
+	}
+
+	// sum of G m (3 d d^T / R^5 - I / R^3) over the bodies except two, d pointing to them;
+	// returns the distance of the closest of them
+	static double tidalTensorAt(const BodySystem& system, dvec3 point, int skip1, int skip2, double* tides)
+	{
+		double nearest = 1e300;
+		for (int k = 0; k < 9; k++)
+			tides[k] = 0;
+		for (int j = 0; j < system.size(); j++)
+		{
+			if (j == skip1 || j == skip2)
+				continue;
+			double d[3] = { system.x[j] - point.x, system.y[j] - point.y, system.z[j] - point.z };
+			double r2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+			if (r2 == 0)
+				continue;
+			nearest = std::min(nearest, sqrt(r2));
+			double inverse3 = 1 / (r2 * sqrt(r2));
+			double s = gravity * system.m[j] * inverse3;
+			for (int a = 0; a < 3; a++)
+				for (int b = 0; b < 3; b++)
+					tides[3 * a + b] += s * (3 * d[a] * d[b] / r2 - (a == b ? 1 : 0));
+		}
+		return nearest;
+	}
+
+	// largest tidal acceleration across the pair relative to its own attraction
+	static double tidalRatio(const double* tides, double mu, double r)
+	{
+		double norm = 0;
+		for (int k = 0; k < 9; k++)
+			norm += tides[k] * tides[k];
+		return sqrt(norm) * r / (mu / (r * r));
+	}
+
+	// relative motion over the step: tidal kicks around exact KS drifts
+	void advance(Pair& pair, double dt)
+	{
+		double time = 0;
+		bool finished = false;
+		while (!finished)
+		{
+			double uu = pair.u[0] * pair.u[0] + pair.u[1] * pair.u[1] + pair.u[2] * pair.u[2] + pair.u[3] * pair.u[3];
+			double s = eta * sqrt(uu / pair.mu);
+			if (dt < 0)
+				s = -s;
+
+			// would the step pass the end? then find the one that ends on it
+			double u[4], w[4], h = pair.h;
+			for (int k = 0; k < 4; k++)
+			{
+				u[k] = pair.u[k];
+				w[k] = pair.w[k];
+			}
+			kick(pair, u, w, h, time / dt, 0.5 * s);
+			double duration = ksDrift(u, w, h, s);
+			if ((time + duration - dt) * dt >= 0)
+			{
+				for (int iteration = 0; iteration < 4; iteration++)
+				{
+					for (int k = 0; k < 4; k++)
+					{
+						u[k] = pair.u[k];
+						w[k] = pair.w[k];
+					}
+					h = pair.h;
+					kick(pair, u, w, h, time / dt, 0.5 * s);
+					double exact = ksDriftLength(u, w, h, dt - time);
+					bool converged = fabs(exact - s) <= 1e-12 * fabs(s);
+					s = exact;
+					if (converged)
+						break;
+				}
+				ksDrift(u, w, h, s);
+				time = dt;
+				finished = true;
+			}
+			else
+				time += duration;
+			kick(pair, u, w, h, time / dt, 0.5 * s);
+
+			for (int k = 0; k < 4; k++)
+			{
+				pair.u[k] = u[k];
+				pair.w[k] = w[k];
+			}
+			pair.h = h;
+			regularizedSteps++;
+		}
+	}
+
+	// tidal acceleration P = T r at the fraction f of the step: w += |u|^2 / 2 L^T(u) P ds, h += 2 w . L^T(u) P ds
+	void kick(const Pair& pair, double* u, double* w, double& h, double f, double ds) const
+	{
+		double r[3], v[3], p[3], q[4];
+		ksToCartesian(u, w, r, v);
+		for (int a = 0; a < 3; a++)
+		{
+			p[a] = 0;
+			for (int b = 0; b < 3; b++)
+				p[a] += ((1 - f) * pair.tides[3 * a + b] + f * pair.tides[9 + 3 * a + b]) * r[b];
+		}
+		ksTransposed(u, p, q);
+		const double uu = u[0] * u[0] + u[1] * u[1] + u[2] * u[2] + u[3] * u[3];
+		double before = 0, after = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			before += w[k] * q[k];
+			w[k] += 0.5 * uu * q[k] * ds;
+			after += w[k] * q[k];
+		}
+		h += (before + after) * ds;
+	}
+
+	// whether a pair stays regularized after the step
+	bool keep(const Pair& pair, double dt) const
+	{
+		// the test of detect for twice the time: a pair whose orbit takes that long is resolved
+		const double r = pair.u[0] * pair.u[0] + pair.u[1] * pair.u[1] + pair.u[2] * pair.u[2] + pair.u[3] * pair.u[3];
+		const double time = 2 * closeSteps * fabs(dt);
+		if (r * r * r > time * time * pair.mu || pair.nearest <= 0.5 * clearance * r)
+			return false;
+		return tidalRatio(pair.tides + 9, pair.mu, r) < 2 * tidalLimit;
+	}
+
+	// writes single bodies and pair members back to the bodies
+	void store(BodySystem& bodies, double dt) const
+	{
+		for (int j = 0; j < top.size(); j++)
+		{
+			const int i = topBodies[j];
+			if (i < 0)
+				continue;
+			bodies.setPosition(i, top.position(j));
+			bodies.setVelocity(i, top.velocity(j));
+			bodies.rotAngle[i] = top.rotAngle[j];
+		}
+		for (const Pair& pair : pairs)
+		{
+			double r[3], v[3];
+			ksToCartesian(pair.u, pair.w, r, v);
+			const int i = pair.first, j = pair.second;
+			const double mass = bodies.m[i] + bodies.m[j];
+			const double f1 = bodies.m[j] / mass, f2 = bodies.m[i] / mass;
+			dvec3 center = top.position(pair.outerIndex), velocity = top.velocity(pair.outerIndex);
+			bodies.setPosition(i, center - dvec3(r[0], r[1], r[2]) * f1);
+			bodies.setPosition(j, center + dvec3(r[0], r[1], r[2]) * f2);
+			bodies.setVelocity(i, velocity - dvec3(v[0], v[1], v[2]) * f1);
+			bodies.setVelocity(j, velocity + dvec3(v[0], v[1], v[2]) * f2);
+			bodies.rotAngle[i] += bodies.rotSpeed[i] * dt;
+			bodies.rotAngle[j] += bodies.rotSpeed[j] * dt;
+		}
+	}
+
+	bool built;                 // the outer system belongs to the current bodies and pairs
+	int count;
+	std::vector<Pair> pairs;
+	BodySystem top;             // single bodies and centers of mass while there are pairs
+	std::vector<int> topBodies; // body of each outer entry, -1 for centers of mass
+	std::vector<int> sorted;    // bodies along x for the pair search
+	std::vector<bool> taken;
+};
@@ -0,0 +1,461 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <type_traits>
+
+#include "linmath.h"
+#include "dvec3.h"
+#include "body.h"
+#include "checkpoint.h"
+#include "bodysystem.h"
+#include "threadpool.h"
+#include "gravity.h"
+#include "octree.h"
+#include "barneshut.h"
+#include "fmm.h"
+#include "fft.h"
+#include "particlemesh.h"
+#include "kepler.h"
+#include "integrator.h"
+#include "blockstep.h"
+#include "regularization.h"
+#include "subsystem.h"
+#include "ephemeris.h"
+#include "trajectory.h"
+
+const double year = 365.25 * 86400;
+
+// worker threads for the force computation, and the gravity solvers using them
+ThreadPool threadPool;
+DirectSolver directSolver;
+BarnesHutSolver barnesHutSolver;
+FmmSolver fmmSolver;
+ParticleMeshSolver particleMeshSolver;
+GravitySolver* solvers[] = { &directSolver, &barnesHutSolver, &fmmSolver, &particleMeshSolver };
+const char* solverKeys[] = { "direct", "barnes-hut", "fmm", "particle-mesh" };
+
+// integration schemes
+EulerIntegrator eulerIntegrator;
+LeapfrogIntegrator leapfrogIntegrator;
+VerletIntegrator verletIntegrator;
+CompositionIntegrator yoshida4Integrator("Yoshida 4th order", 4, yoshida4Weights());
+CompositionIntegrator yoshida6Integrator("Yoshida 6th order", 6, yoshida6Weights());
+WisdomHolmanIntegrator wisdomHolmanIntegrator;
+Ias15Integrator ias15Integrator;
+BlockHermiteIntegrator blockHermiteIntegrator;
+Integrator* integrators[] = { &eulerIntegrator, &leapfrogIntegrator, &verletIntegrator, &yoshida4Integrator, &yoshida6Integrator, &wisdomHolmanIntegrator, &ias15Integrator, &blockHermiteIntegrator };
+const char* integratorKeys[] = { "euler", "leapfrog", "verlet", "yoshida4", "yoshida6", "wisdom-holman", "ias15", "hermite" };
+EncounterIntegrator encounterIntegrator;
+SubsystemIntegrator subsystemIntegrator;
+
+// the bodies of the application: Sun, planets, and the Moon
+void createSolarSystem(BodySystem& bodies)
+{
+	bodies.clear();
+	bodies.add(Body("Sun", 0, 0, 6.957e8, 1.9885e30, 0.13, 2.90308e-6, false, 0));
+	bodies.add(Body("Mercury", 5.790905e10, 47360, 2.4397e6, 3.3011e23, 0.00, 1.24002e-6, true, 0));
+	bodies.add(Body("Venus", 1.08208e11, 35020, 6.0518e6, 4.8675e24, 3.10, 2.99240e-7, true, 0));
+	bodies.add(Body("Earth", 1.49598023e11, 29780, 6.371e6, 5.97237e24, 0.41, 7.29212e-5, false, 0));
+	bodies.add(Body("Moon", 1.49982422e11, 30802, 1.7374e6, 7.342e22, 0.03, 2.66170e-6, false, 0));
+	bodies.properties(4).host = 3;
+	bodies.add(Body("Mars", 2.27939366e11, 24070, 3.3895e6, 6.4171e23, 0.44, 7.08822e-5, true, 0));
+	bodies.add(Body("Jupiter", 7.78479e11, 13070, 6.9911e7, 1.8982e27, 0.05, 1.75852e-4, true, 0));
+	bodies.add(Body("Saturn", 1.43353e12, 9680, 5.8232e7, 5.6834e26, 0.47, 1.65269e-4, true, 0));
+	bodies.add(Body("Uranus", 2.870972e12, 6800, 2.5362e7, 8.681e25, 1.71, 1.01238e-4, true, 0));
+	bodies.add(Body("Neptune", 4.5e12, 5430, 2.4622e7, 1.02413e26, 0.49, 1.08330e-4, true, 0));
+}
+
+// reads bodies, one per line: mass radius x y z vx vy vz host name (SI units, host -1 for none);
+// empty lines and lines starting with # are skipped. A "# time" line starts a new state, so of
+// files written by the runner the last state is read, with its time. Bodies after a "# catalog"
+// line go to the catalog, on fixed orbits around the first body. Returns false on errors.
+bool loadScenario(const char* path, BodySystem& bodies, BodySystem& catalogBodies, double& time)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+	bodies.clear();
+	catalogBodies.clear();
+	BodySystem* target = &bodies;
+	time = 0;
+	std::string line;
+	int number = 0;
+	while (std::getline(file, line))
+	{
+		number++;
+		if (line.compare(0, 7, "# time ") == 0)
+		{
+			bodies.clear();
+			catalogBodies.clear();
+			target = &bodies;
+			time = atof(line.c_str() + 7);
+		}
+		if (line.compare(0, 9, "# catalog") == 0)
+			target = &catalogBodies;
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream fields(line);
+		double mass, radius;
+		dvec3 position, velocity;
+		int host;
+		std::string name;
+		if (!(fields >> mass >> radius >> position.x >> position.y >> position.z >> velocity.x >> velocity.y >> velocity.z >> host))
+		{
+			fprintf(stderr, "%s:%d: expected mass radius x y z vx vy vz host name\n", path, number);
+			return false;
+		}
+		std::getline(fields >> std::ws, name);
+
+		Body body(name, 0, 0, radius, mass, 0, 0, false, 0);
+		body.position = position;
+		body.velocity = velocity;
+		body.host = host;
+		target->add(body);
+	}
+	return true;
+}
+
+// writes the bodies in the scenario format, so that any state can be loaded again
+void writeBodies(FILE* output, const BodySystem& bodies)
+{
+	for (int i = 0; i < bodies.size(); i++)
+	{
+		const BodyInfo& info = bodies.properties(i);
+		fprintf(output, "%.17g %.17g %.17g %.17g %.17g %.17g %.17g %.17g %d %s\n", bodies.m[i], info.radius,
+			bodies.x[i], bodies.y[i], bodies.z[i], bodies.vx[i], bodies.vy[i], bodies.vz[i], info.host, info.name.c_str());
+	}
+}
+
+// the integrated bodies and those of the catalog, placed at the time first
+void writeState(FILE* output, BodySystem& bodies, BodySystem& catalogBodies, const KeplerCatalog& catalog, double time)
+{
+	fprintf(output, "# time %.17g s (%.6f years), %d bodies\n", time, time / year, bodies.size());
+	writeBodies(output, bodies);
+	if (catalogBodies.size() > 0)
+	{
+		catalog.evaluate(time, bodies.position(catalog.central), bodies.velocity(catalog.central), catalogBodies, &threadPool);
+		fprintf(output, "# catalog, %d bodies on fixed orbits\n", catalogBodies.size());
+		writeBodies(output, catalogBodies);
+	}
+	fflush(output);
+}
+
+// kinetic plus potential energy, summed directly
+double totalEnergy(const BodySystem& bodies)
+{
+	double energy = 0;
+	for (int i = 0; i < bodies.size(); i++)
+	{
+		double v2 = bodies.vx[i] * bodies.vx[i] + bodies.vy[i] * bodies.vy[i] + bodies.vz[i] * bodies.vz[i];
+		energy += 0.5 * bodies.m[i] * v2;
+		for (int j = i + 1; j < bodies.size(); j++)
+		{
+			double dx = bodies.x[j] - bodies.x[i], dy = bodies.y[j] - bodies.y[i], dz = bodies.z[j] - bodies.z[i];
+			energy -= gravity * bodies.m[i] * bodies.m[j] / sqrt(dx * dx + dy * dy + dz * dz);
+		}
+	}
+	return energy;
+}
+
+// index of a key in a list, or -1
+int find(const char* key, const char* const* keys, int count)
+{
+	for (int i = 0; i < count; i++)
+		if (strcmp(key, keys[i]) == 0)
+			return i;
+	return -1;
+}
+
+void usage()
+{
+	fprintf(stderr,
+		"usage: runner [options]\n"
+		"  --scenario FILE     bodies to integrate (default: the Solar system of the application)\n"
+		"  --catalog FILE      also bodies on fixed Kepler orbits around the first one, not integrated\n"
+		"  --years N           simulated years (default 1)\n"
+		"  --step S            integration step in seconds (default 3600)\n"
+		"  --integrator NAME   euler, leapfrog, verlet, yoshida4, yoshida6, wisdom-holman, ias15, hermite\n"
+		"                      (default leapfrog)\n"
+		"  --solver NAME       direct, barnes-hut, fmm, particle-mesh (default direct)\n"
+		"  --massive KG        bodies of at least this mass skip the particle-mesh grid (default 1e20)\n"
+		"  --threads N         threads for the force computation (default: all cores)\n"
+		"  --local-moons       integrate moons in the frames of their planets\n"
+		"  --regularize        regularize close encounters\n"
+		"  --every N           also write the state every N simulated years\n"
+		"  --ephemeris FILE    also fit a Chebyshev ephemeris to the run and write it to FILE\n"
+		"  --granule D         length of the ephemeris granules in days, at least 8 steps (default 4)\n"
+		"  --trajectory FILE   also write the states of the run to the compressed trajectory store FILE\n"
+		"  --sample N          steps per trajectory sample (default 1)\n"
+		"  --checkpoint FILE   save the whole state to FILE while running, to resume from\n"
+		"  --checkpoint-every N\n"
+		"                      simulated years between checkpoints (default 1)\n"
+		"  --resume FILE       continue the run saved in the checkpoint FILE, with its settings and end\n"
+		"  --output FILE       where to write the states (default: standard output)\n");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* scenario = nullptr;
+	const char* catalogPath = nullptr;
+	const char* outputPath = nullptr;
+	const char* ephemerisPath = nullptr;
+	const char* trajectoryPath = nullptr;
+	const char* checkpointPath = nullptr;
+	const char* resumePath = nullptr;
+	double years = 1, stepSize = 3600, every = 0, granule = 4, checkpointYears = 1;
+	int integratorSelection = 1, solverSelection = 0, threads = 0, sampleInterval = 1;
+	bool localMoons = false, regularize = false;
+
+	// options
+	const int integratorCount = sizeof(integrators) / sizeof(integrators[0]);
+	const int solverCount = sizeof(solvers) / sizeof(solvers[0]);
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (option == "--local-moons")
+			localMoons = true;
+		else if (option == "--regularize")
+			regularize = true;
+		else if (option == "--scenario" && hasValue)
+			scenario = argv[++i];
+		else if (option == "--catalog" && hasValue)
+			catalogPath = argv[++i];
+		else if (option == "--output" && hasValue)
+			outputPath = argv[++i];
+		else if (option == "--years" && hasValue)
+			years = atof(argv[++i]);
+		else if (option == "--step" && hasValue)
+			stepSize = atof(argv[++i]);
+		else if (option == "--every" && hasValue)
+			every = atof(argv[++i]);
+		else if (option == "--ephemeris" && hasValue)
+			ephemerisPath = argv[++i];
+		else if (option == "--granule" && hasValue)
+			granule = atof(argv[++i]);
+		else if (option == "--trajectory" && hasValue)
+			trajectoryPath = argv[++i];
+		else if (option == "--sample" && hasValue)
+			sampleInterval = atoi(argv[++i]);
+		else if (option == "--checkpoint" && hasValue)
+			checkpointPath = argv[++i];
+		else if (option == "--checkpoint-every" && hasValue)
+			checkpointYears = atof(argv[++i]);
+		else if (option == "--resume" && hasValue)
+			resumePath = argv[++i];
+		else if (option == "--massive" && hasValue)
+			particleMeshSolver.massiveLimit = atof(argv[++i]);
+		else if (option == "--threads" && hasValue)
+			threads = atoi(argv[++i]);
+		else if (option == "--integrator" && hasValue)
+			integratorSelection = find(argv[++i], integratorKeys, integratorCount);
+		else if (option == "--solver" && hasValue)
+			solverSelection = find(argv[++i], solverKeys, solverCount);
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+	if (integratorSelection < 0 || solverSelection < 0 || years <= 0 || stepSize <= 0 || every < 0 || granule <= 0 || sampleInterval < 1 || checkpointYears <= 0)
+	{
+		usage();
+		return 1;
+	}
+
+	// what a checkpoint holds: the settings, the progress of the run, the bodies, and the state of
+	// every integrator; false for checkpoints of other programs and settings this one does not have
+	BodySystem bodies, catalogBodies;
+	KeplerCatalog catalog;
+	double time = 0, end = 0, nextOutput = 0;
+	long long steps = 0;
+	std::function<bool(Archive&)> state = [&](Archive& archive)
+	{
+		std::string program = "runner";
+		int kernel = simdLevel;
+		archive.value(program);
+		archive.value(integratorSelection);
+		archive.value(solverSelection);
+		archive.value(localMoons);
+		archive.value(regularize);
+		archive.value(stepSize);
+		archive.value(particleMeshSolver.massiveLimit);
+		archive.value(every);
+		archive.value(kernel);
+		archive.value(time);
+		archive.value(end);
+		archive.value(nextOutput);
+		archive.value(steps);
+		bodies.serialize(archive);
+		catalog.serialize(archive);
+		catalogBodies.serialize(archive);
+		for (Integrator* integrator : integrators)
+			integrator->serialize(archive);
+		encounterIntegrator.serialize(archive);
+		subsystemIntegrator.serialize(archive);
+		if (archive.isWriting())
+			return true;
+
+		// the kernel only as far as this computer has it, which may change the last bits
+		simdLevel = (SimdLevel)std::min(std::max(kernel, 0), (int)supportedSimdLevel);
+		return archive.isComplete() && program == "runner" && integratorSelection >= 0 && integratorSelection < integratorCount &&
+			solverSelection >= 0 && solverSelection < solverCount && stepSize > 0;
+	};
+
+	// scenario, or the state of an interrupted run
+	if (resumePath)
+	{
+		std::vector<unsigned char> payload;
+		Archive archive(payload, false);
+		if (!readCheckpoint(resumePath, payload) || !state(archive))
+		{
+			fprintf(stderr, "cannot resume from %s, it is missing, damaged, or of another version\n", resumePath);
+			return 1;
+		}
+		years = (end - time) / year;
+	}
+	else if (scenario)
+	{
+		if (!loadScenario(scenario, bodies, catalogBodies, time))
+		{
+			fprintf(stderr, "cannot read scenario %s\n", scenario);
+			return 1;
+		}
+	}
+	else
+		createSolarSystem(bodies);
+	if (!resumePath)
+	{
+		end = time + years * year;
+		nextOutput = time + every * year;
+
+		// catalog bodies of both files, their orbits from the states at the start
+		BodySystem extra, unused;
+		double ignored;
+		if (catalogPath && !loadScenario(catalogPath, extra, unused, ignored))
+		{
+			fprintf(stderr, "cannot read catalog %s\n", catalogPath);
+			return 1;
+		}
+		for (int i = 0; i < extra.size(); i++)
+			catalogBodies.add(extra.get(i));
+		if (catalogBodies.size() > 0 && bodies.size() == 0)
+		{
+			fprintf(stderr, "catalog bodies need a body to orbit\n");
+			return 1;
+		}
+		for (int i = 0; i < catalogBodies.size(); i++)
+			catalog.add(gravity * (bodies.m[0] + catalogBodies.m[i]), catalogBodies.position(i) - bodies.position(0), catalogBodies.velocity(i) - bodies.velocity(0), time, i);
+	}
+
+	FILE* output = outputPath ? fopen(outputPath, "w") : stdout;
+	if (!output)
+	{
+		fprintf(stderr, "cannot write %s\n", outputPath);
+		return 1;
+	}
+
+	// physics, chained as in the application
+	if (threads > 0)
+		threadPool.setThreadCount(threads);
+	for (GravitySolver* solver : solvers)
+		solver->pool = &threadPool;
+	GravitySolver* solver = solvers[solverSelection];
+	Integrator* integrator = integrators[integratorSelection];
+	encounterIntegrator.outer = integrator;
+	if (regularize)
+		integrator = &encounterIntegrator;
+	subsystemIntegrator.outer = integrator;
+	if (localMoons)
+		integrator = &subsystemIntegrator;
+
+	// energy check only where direct summation is affordable
+	const bool checkEnergy = bodies.size() <= 20000;
+	const double initial = checkEnergy ? totalEnergy(bodies) : 0;
+	if (catalogBodies.size() > 0)
+		fprintf(stderr, "%d bodies on fixed Kepler orbits\n", catalogBodies.size());
+	fprintf(stderr, "%d bodies, %s with %s, %g years in steps of %g s\n", bodies.size(), integrators[integratorSelection]->name(), solver->name(), years, stepSize);
+
+	// ephemeris of the whole run, fitted as it goes, with enough steps in each granule for the fit
+	EphemerisRecorder recorder;
+	const double granuleLength = std::max(granule * 86400, 8 * stepSize);
+	if (ephemerisPath && granuleLength > granule * 86400)
+		fprintf(stderr, "ephemeris granules of %g days, 8 steps\n", granuleLength / 86400);
+	if (ephemerisPath && !recorder.open(ephemerisPath, bodies, time, granuleLength))
+	{
+		fprintf(stderr, "cannot write %s\n", ephemerisPath);
+		return 1;
+	}
+
+	// states of the run, written while it goes on; nothing may be dropped here
+	TrajectoryWriter trajectory;
+	trajectory.interval = sampleInterval;
+	trajectory.lossless = true;
+	if (trajectoryPath && !trajectory.open(trajectoryPath, bodies, time))
+	{
+		fprintf(stderr, "cannot write %s\n", trajectoryPath);
+		return 1;
+	}
+
+	// checkpoints to resume from, should the run be interrupted
+	CheckpointWriter checkpoints;
+	if (checkpointPath)
+	{
+		checkpoints.interval = checkpointYears * year;
+		checkpoints.path = checkpointPath;
+		checkpoints.state = [&](Archive& archive) { state(archive); };
+		checkpoints.start(time);
+	}
+
+	// steps of the given size, the last one shortened to end on time
+	const double start = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	if (every > 0 && !resumePath)
+		writeState(output, bodies, catalogBodies, catalog, time);
+	while (time < end)
+	{
+		double dt = std::min(stepSize, end - time);
+		integrator->step(bodies, *solver, dt);
+		time = end - time <= stepSize ? end : time + stepSize;
+		steps++;
+		recorder.sample(bodies, time);
+		trajectory.sample(bodies, time);
+		if (every > 0 && time >= nextOutput && time < end)
+		{
+			writeState(output, bodies, catalogBodies, catalog, time);
+			while (nextOutput <= time)
+				nextOutput += every * year;
+		}
+		checkpoints.update(time);
+	}
+	writeState(output, bodies, catalogBodies, catalog, time);
+	if (output != stdout)
+		fclose(output);
+	trajectory.close();
+	trajectory.finish();
+	checkpoints.finish();
+	if (checkpoints.failed)
+		fprintf(stderr, "the latest checkpoint could not be written to %s\n", checkpointPath);
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count() - start;
+	fprintf(stderr, "%lld steps, %lld force evaluations in %.3f s (%.3g simulated years per second)\n", steps, integrator->forceEvaluations, elapsed, years / std::max(elapsed, 1e-9));
+	if (checkEnergy)
+		fprintf(stderr, "relative energy error %.3e\n", fabs(totalEnergy(bodies) / initial - 1));
+	if (ephemerisPath)
+		fprintf(stderr, "ephemeris covers %.6f years%s\n", (recorder.end() - (end - years * year)) / year, recorder.isOpen() ? "" : ", recording stopped early");
+	return 0;
+}
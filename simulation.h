@@ -0,0 +1,454 @@
+// wall-clock time on the steady clock (s)
+double steadyTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// state of the bodies published by the simulation thread, read-only for the renderer
+struct Snapshot
+{
+	Snapshot() : time(0), history(0), integrated(0), generation(0), checkpointLoads(0), forceEvaluations(0), evaluationsPerStep(0), warp(0), limited(false), previousTime(0), owed(0), rate(0), published(0)
+	{
+	}
+
+	int size() const
+	{
+		return (int)positions.size();
+	}
+
+	double time;                // simulated time since the start (s)
+	double history;             // earliest simulated time a seek can go back to (s)
+	int integrated;             // bodies before those on the orbits of the catalog
+	int generation;             // changes whenever the bodies or their properties may have changed
+	int checkpointLoads;        // checkpoints commands tried to load since the start
+	std::shared_ptr<const std::vector<unsigned char> > checkpoint; // what the controls need of the latest one, or null if it was unreadable
+	std::shared_ptr<const Ephemeris> ephemeris;                     // read for seeking, or null
+	long long forceEvaluations; // since the start
+	int evaluationsPerStep;     // force evaluations of the latest step
+	double warp;                // achieved simulated seconds per wall-clock second
+	bool limited;               // steps were dropped to stay within the budget
+	std::vector<dvec3> positions, velocities;
+	std::vector<double> rotAngles, masses, spins;
+	std::vector<BodyInfo> properties;
+
+	// the state before the latest steps, for interpolation; when paused or started over, the time
+	// is the current one and the arrays are left as they were
+	double previousTime;
+	std::vector<dvec3> previousPositions, previousVelocities;
+	std::vector<double> previousRotAngles;
+
+	double owed;      // simulated time accumulated but not stepped yet (s)
+	double rate;      // simulated seconds per wall-clock second in the latest tick
+	double published; // wall-clock time of the tick (s, steady clock)
+};
+
+// positions and spin angles drawn in a frame.
+//
+// The physics changes the state only at whole steps, at a tick rate unrelated to the display, so
+// the bodies are drawn one stretch of steps behind the simulation: the time the simulation should
+// have reached by now, less the span between the two states of the snapshot, falls between them.
+// Positions follow the cubic Hermite curve through both positions and velocities, which keeps
+// bodies on their orbits even across long spans, and spin angles change linearly. When the next
+// snapshot is late, the bodies move on along their latest velocities for at most another span.
+// The drawn time waits instead of running backwards when a snapshot arrives early.
+struct DrawState
+{
+	DrawState() : time(0)
+	{
+	}
+
+	// computes the state at the current wall-clock time, for all bodies at once
+	void update(const Snapshot& state, double wallTime)
+	{
+		const int n = state.size();
+		positions.resize(n);
+		rotAngles.resize(n);
+		const double span = state.time - state.previousTime;
+		const double target = state.time + state.owed + (wallTime - state.published) * state.rate - span;
+
+		// never backwards, as right after the start, unless the simulation itself went back
+		time = time <= state.time + span ? std::max(target, time) : target;
+
+		if (span > 0 && time <= state.time)
+		{
+			// interpolation
+			const double f = std::max(0.0, (time - state.previousTime) / span);
+			const double f2 = f * f, f3 = f2 * f;
+			const double a = 2 * f3 - 3 * f2 + 1, b = -2 * f3 + 3 * f2;
+			const double c = (f3 - 2 * f2 + f) * span, d = (f3 - f2) * span;
+			for (int i = 0; i < n; i++)
+			{
+				dvec3 p0 = state.previousPositions[i], v0 = state.previousVelocities[i];
+				dvec3 p1 = state.positions[i], v1 = state.velocities[i];
+				positions[i] = p0 * a + v0 * c + p1 * b + v1 * d;
+				rotAngles[i] = state.previousRotAngles[i] + (state.rotAngles[i] - state.previousRotAngles[i]) * f;
+			}
+		}
+		else
+		{
+			// extrapolation
+			const double ahead = std::min(time - state.time, span);
+			for (int i = 0; i < n; i++)
+			{
+				dvec3 velocity = state.velocities[i];
+				positions[i] = velocity * ahead + state.positions[i];
+				rotAngles[i] = state.rotAngles[i] + state.spins[i] * ahead;
+			}
+		}
+	}
+
+	double time; // simulated time drawn (s)
+	std::vector<dvec3> positions;
+	std::vector<double> rotAngles;
+};
+
+// runs the physics on its own thread, independent of the frame rate.
+//
+// The body system belongs to the simulation thread while it runs; other threads change it only by
+// posting commands, which are applied between steps. After every tick the thread publishes a
+// snapshot through a lock-free triple buffer: it fills its back slot and swaps it with the shared
+// middle slot, and the reader swaps its front slot with the middle one whenever a newer snapshot
+// is there. Neither side ever waits for the other.
+//
+// The physics advances in steps of a fixed size, so results do not depend on the frame rate. Every
+// tick adds the wall-clock time since the previous one, times the time warp, to an accumulator
+// and takes as many whole steps as it holds. A tick stops stepping once it has used its budget of
+// wall-clock time; the steps left over are dropped rather than caught up later, which lowers the
+// achieved warp to what the machine can afford instead of making ticks ever longer.
+class Simulation
+{
+public:
+	Simulation() : solver(nullptr), integrator(nullptr), recorder(nullptr), trajectory(nullptr), timeline(nullptr), checkpoints(nullptr), catalog(nullptr), timeScale(1e5), stepSize(3600), budget(0.003), tickInterval(1.0 / 240), paused(false), running(false), time(0),
+		target(0), kept(false), checkpointLoads(0), generation(1), publishedBodies(0), accumulator(0), windowTime(0), windowSimulated(0), windowLimited(false), warp(0), limited(false), rate(0), recentTime(0), previousTime(0), back(0), front(1), middle(2)
+	{
+	}
+
+	~Simulation()
+	{
+		stop();
+	}
+
+	void start()
+	{
+		if (running)
+			return;
+		publish(steadyTime());
+		running = true;
+		thread = std::thread(&Simulation::run, this);
+	}
+
+	void stop()
+	{
+		if (!running)
+			return;
+		running = false;
+		thread.join();
+	}
+
+	// queues a change of the bodies or the solvers for the simulation thread
+	void post(const std::function<void(BodySystem&)>& command)
+	{
+		std::lock_guard<std::mutex> lock(commandMutex);
+		commands.push_back(command);
+	}
+
+	// simulated time, for commands; setting it starts the drawn state over, as after replacing the
+	// whole state
+	double getTime() const
+	{
+		return time;
+	}
+
+	void setTime(double newTime)
+	{
+		time = newTime;
+		target = newTime;
+		accumulator = 0;
+		previousPositions.clear();
+		placeCatalog();
+	}
+
+	// for commands after which the state of the integrators still fits the bodies, as after saving a
+	// checkpoint or loading one with both, so that it is not reset unless other commands ran too
+	void keepIntegrator()
+	{
+		kept = true;
+	}
+
+	// for commands that load a checkpoint: hands what the controls need of it, serialized, or null
+	// if it could not be read, to the reader of the snapshots
+	void loadedCheckpoint(const std::shared_ptr<const std::vector<unsigned char> >& controls)
+	{
+		checkpointLoads++;
+		checkpoint = controls;
+	}
+
+	// goes to a simulated time, for commands, also while paused: an earlier one restores the latest
+	// keyframe of the timeline before it, and the steps from there, or from now for a later one, are
+	// taken in the following ticks within their budget, the last one shortened to end on the target
+	void seek(double newTarget)
+	{
+		double restored;
+		if (newTarget < time && timeline && timeline->restore(newTarget, bodies, restored))
+			setTime(restored);
+		target = std::max(newTarget, time);
+	}
+
+	// most recent snapshot, valid until the next call; only one thread may read snapshots
+	const Snapshot& latest()
+	{
+		if (middle.load() & fresh)
+			front = middle.exchange(front) & ~fresh;
+		return snapshots[front];
+	}
+
+	BodySystem bodies;             // owned by the simulation thread while it runs
+	GravitySolver* solver;         // change through a command while running
+	Integrator* integrator;        // change through a command while running
+	EphemerisRecorder* recorder;   // gets the state after every step, or null; change through a command
+	TrajectoryWriter* trajectory;  // the same
+	Timeline* timeline;            // keeps keyframes for seeking back, or null; change through a command
+	CheckpointWriter* checkpoints; // saves the state at its intervals, or null; change through a command
+	KeplerCatalog* catalog;        // moves the catalog bodies along fixed orbits, or null; change through a command
+	BodySystem catalogBodies;      // never integrated, only placed by the catalog at each step; the same
+	std::shared_ptr<const Ephemeris> ephemeris; // read for seeking by commands, or null; the same
+	double timeScale;              // time warp: simulated seconds per wall-clock second
+	double stepSize;               // simulated time of one integration step (s)
+	double budget;                 // wall-clock time the steps of one tick may take (s)
+	double tickInterval;           // shortest wall-clock time between ticks (s)
+	std::atomic<bool> paused;
+
+private:
+	static const int fresh = 4; // flag on the middle slot index: not read yet
+
+	void run()
+	{
+		typedef std::chrono::steady_clock Clock;
+		Clock::time_point last = Clock::now();
+		std::vector<std::function<void(BodySystem&)> > pending;
+
+		while (running)
+		{
+			Clock::time_point tickStart = Clock::now();
+
+			// apply commands queued since the previous tick
+			{
+				std::lock_guard<std::mutex> lock(commandMutex);
+				pending.swap(commands);
+			}
+			bool reset = false;
+			for (const std::function<void(BodySystem&)>& command : pending)
+			{
+				kept = false;
+				command(bodies);
+				reset |= !kept;
+			}
+			if (reset && integrator)
+				integrator->reset();
+			if (!pending.empty())
+			{
+				placeCatalog();
+				generation++;
+			}
+			pending.clear();
+
+			// advance by the wall-clock time since the previous tick
+			double elapsed = std::chrono::duration<double>(tickStart - last).count();
+			last = tickStart;
+			double simulated = 0;
+			bool dropped = false;
+			Clock::time_point deadline = tickStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(budget));
+			if (target > time && solver && integrator && stepSize > 0)
+			{
+				catchUp(deadline);
+				accumulator = 0;
+			}
+			else if (!paused && solver && integrator && stepSize > 0)
+				simulated = advance(elapsed * timeScale, deadline, dropped);
+			else
+				accumulator = 0;
+			measure(elapsed, simulated, dropped);
+			rate = elapsed > 0 ? simulated / elapsed : 0;
+			publish(std::chrono::duration<double>(tickStart.time_since_epoch()).count());
+
+			// leave the core to others when the physics is fast
+			std::this_thread::sleep_until(tickStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(tickInterval)));
+		}
+	}
+
+	// takes the whole steps owed until the deadline; returns the simulated time owed minus the dropped part
+	double advance(double owed, std::chrono::steady_clock::time_point deadline, bool& dropped)
+	{
+		accumulator += owed;
+		while (accumulator >= stepSize)
+		{
+			step(time + stepSize);
+			accumulator -= stepSize;
+			if (std::chrono::steady_clock::now() >= deadline)
+				break;
+		}
+
+		// over budget: keep only the fraction of a step
+		dropped = accumulator >= stepSize;
+		if (!dropped)
+			return owed;
+		double kept = fmod(accumulator, stepSize);
+		owed -= accumulator - kept;
+		accumulator = kept;
+		return owed;
+	}
+
+	// steps toward the target of a seek until the deadline
+	void catchUp(std::chrono::steady_clock::time_point deadline)
+	{
+		while (target > time)
+		{
+			step(target - time > stepSize ? time + stepSize : target);
+			if (std::chrono::steady_clock::now() >= deadline)
+				break;
+		}
+	}
+
+	// integrates up to the given time and hands the state on
+	void step(double end)
+	{
+		integrator->step(bodies, *solver, end - time);
+		time = end;
+		placeCatalog();
+		if (recorder && !recorder->sample(bodies, time))
+			recorder = nullptr;
+		if (trajectory && !trajectory->sample(bodies, time))
+			trajectory = nullptr;
+		if (timeline)
+			timeline->record(bodies, time);
+		if (checkpoints)
+			checkpoints->update(time);
+	}
+
+	// the catalog bodies at the current time, around the current state of their central body
+	void placeCatalog()
+	{
+		if (catalog && catalog->central < bodies.size())
+			catalog->evaluate(time, bodies.position(catalog->central), bodies.velocity(catalog->central), catalogBodies, solver ? solver->pool : nullptr);
+	}
+
+	// achieved warp over windows of half a second
+	void measure(double elapsed, double simulated, bool dropped)
+	{
+		windowTime += elapsed;
+		windowSimulated += simulated;
+		windowLimited |= dropped;
+		if (windowTime >= 0.5)
+		{
+			warp = windowSimulated / windowTime;
+			limited = windowLimited;
+			windowTime = 0;
+			windowSimulated = 0;
+			windowLimited = false;
+		}
+	}
+
+	// copies the state of the tick started at the given time into the back slot and hands it to the reader
+	void publish(double tickTime)
+	{
+		Snapshot& snapshot = snapshots[back];
+		const int integrated = bodies.size(), n = integrated + catalogBodies.size();
+		snapshot.time = time;
+		snapshot.integrated = integrated;
+		snapshot.checkpointLoads = checkpointLoads;
+		snapshot.checkpoint = checkpoint;
+		snapshot.ephemeris = ephemeris;
+		snapshot.history = timeline && timeline->size() > 0 ? timeline->begin() : time;
+		snapshot.forceEvaluations = integrator ? integrator->forceEvaluations : 0;
+		snapshot.evaluationsPerStep = integrator ? integrator->evaluationsPerStep() : 0;
+		snapshot.warp = warp;
+		snapshot.limited = limited;
+		snapshot.positions.resize(n);
+		snapshot.velocities.resize(n);
+		snapshot.rotAngles.resize(n);
+		snapshot.masses.resize(n);
+		snapshot.spins.resize(n);
+		for (int i = 0; i < n; i++)
+		{
+			const BodySystem& system = i < integrated ? bodies : catalogBodies;
+			const int k = i < integrated ? i : i - integrated;
+			snapshot.positions[i] = system.position(k);
+			snapshot.velocities[i] = system.velocity(k);
+			snapshot.rotAngles[i] = system.rotAngle[k];
+			snapshot.masses[i] = system.m[k];
+			snapshot.spins[i] = system.rotSpeed[k];
+		}
+
+		// names and the other properties only into slots that do not have them yet
+		if (n != publishedBodies)
+		{
+			publishedBodies = n;
+			generation++;
+		}
+		if (snapshot.generation != generation)
+		{
+			snapshot.properties.resize(n);
+			for (int i = 0; i < n; i++)
+				snapshot.properties[i] = i < integrated ? bodies.properties(i) : catalogBodies.properties(i - integrated);
+			snapshot.generation = generation;
+		}
+
+		// the previously published state becomes the previous one once the time moved on; pausing
+		// or changing the number of bodies starts over from the current state, with nothing to
+		// interpolate
+		if (time != recentTime)
+		{
+			previousTime = recentTime;
+			previousPositions.swap(recentPositions);
+			previousVelocities.swap(recentVelocities);
+			previousRotAngles.swap(recentRotAngles);
+		}
+		recentTime = time;
+		recentPositions = snapshot.positions;
+		recentVelocities = snapshot.velocities;
+		recentRotAngles = snapshot.rotAngles;
+		if (paused || (int)previousPositions.size() != n)
+			previousTime = time;
+		snapshot.previousTime = previousTime;
+		if (previousTime != time)
+		{
+			snapshot.previousPositions = previousPositions;
+			snapshot.previousVelocities = previousVelocities;
+			snapshot.previousRotAngles = previousRotAngles;
+		}
+		snapshot.owed = accumulator;
+		snapshot.rate = rate;
+		snapshot.published = tickTime;
+
+		back = middle.exchange(back | fresh) & ~fresh;
+	}
+
+	std::atomic<bool> running;
+	std::thread thread;
+	double time;
+	double target;          // simulated time a seek goes to (s)
+	bool kept;              // the running command keeps the state of the integrators
+	int checkpointLoads;
+	int generation;         // of the bodies and their properties, advanced by commands
+	int publishedBodies;    // in the latest snapshot
+	std::shared_ptr<const std::vector<unsigned char> > checkpoint; // the controls of the latest one loaded
+	double accumulator;     // simulated time owed but not stepped yet (s)
+	double windowTime;      // wall-clock time of the current measuring window (s)
+	double windowSimulated; // simulated time in it (s)
+	bool windowLimited;
+	double warp;
+	bool limited;
+	double rate;            // simulated seconds per wall-clock second in the latest tick
+
+	// states published last and before the latest steps
+	double recentTime, previousTime;
+	std::vector<dvec3> recentPositions, recentVelocities, previousPositions, previousVelocities;
+	std::vector<double> recentRotAngles, previousRotAngles;
+
+	std::mutex commandMutex;
+	std::vector<std::function<void(BodySystem&)> > commands;
+
+	Snapshot snapshots[3];
+	int back, front;         // slots owned by the simulation thread and by the reader
+	std::atomic<int> middle; // shared slot
+};
@@ -0,0 +1,272 @@
+// planet-moon groups integrated as subsystems in their own frames.
+//
+// Every body with satellites (bodies whose host chain leads to it) forms a group. The outer system
+// holds the other bodies and one point at the barycenter of each group, and is advanced by the
+// outer integrator with the selected solver. The members of a group move in a local frame centered
+// on that barycenter, where coordinates stay small and precise, by a Wisdom-Holman integrator of
+// their own with steps of a fraction of the shortest moon orbit. The gravity of the outer bodies
+// couples both levels as tides: half kicks before and after each step give the members the
+// difference between the outer attraction at their position and at the barycenter, and give the
+// barycenter the mean of that difference. Adding moons therefore leaves the outer steps alone.
+//
+// The local state persists between steps and the body system is written from it; it is rebuilt
+// from the body system after a reset, which the simulation does whenever the bodies were changed.
+class SubsystemIntegrator : public Integrator
+{
+public:
+	SubsystemIntegrator() : outer(nullptr), orbitFraction(1.0 / 32), built(false), count(-1)
+	{
+	}
+
+	const char* name() const override
+	{
+		return outer ? outer->name() : "subsystems";
+	}
+
+	int order() const override
+	{
+		return outer ? outer->order() : 0;
+	}
+
+	// of the outer integrator; groups use their own direct summation
+	int evaluationsPerStep() const override
+	{
+		return outer ? outer->evaluationsPerStep() : 0;
+	}
+
+	void reset() override
+	{
+		built = false;
+		if (outer)
+			outer->reset();
+	}
+
+	// the outer integrator is saved on its own
+	void serialize(Archive& archive) override
+	{
+		Integrator::serialize(archive);
+		archive.value(orbitFraction);
+		archive.value(built);
+		archive.value(count);
+		top.serialize(archive);
+		archive.value(topBodies);
+		uint64_t size = groups.size();
+		archive.value(size);
+		if (!archive.isWriting())
+			groups.resize(archive.isValid() && size <= (uint64_t)count ? (size_t)size : 0);
+		for (Group& group : groups)
+		{
+			archive.value(group.outerIndex);
+			archive.value(group.members);
+			group.local.serialize(archive);
+			group.integrator.serialize(archive);
+			archive.value(group.innerStep);
+		}
+	}
+
+	void step(BodySystem& bodies, GravitySolver& solver, double dt) override
+	{
+		if (!outer)
+			return;
+		if (!built || bodies.size() != count)
+			build(bodies);
+
+		if (groups.empty())
+		{
+			// nothing to nest
+			outer->step(bodies, solver, dt);
+		}
+		else
+		{
+			tidalKick(0.5 * dt);
+			for (Group& group : groups)
+			{
+				int steps = std::max(1, (int)ceil(fabs(dt) / group.innerStep));
+				for (int k = 0; k < steps; k++)
+					group.integrator.step(group.local, group.solver, dt / steps);
+			}
+			outer->step(top, solver, dt);
+			tidalKick(0.5 * dt);
+			store(bodies);
+		}
+		forceEvaluations = outer->forceEvaluations;
+	}
+
+	Integrator* outer;    // advances the outer system
+	double orbitFraction; // inner step as a fraction of the shortest moon orbit of a group
+
+private:
+	struct Group
+	{
+		int outerIndex;           // barycenter in the outer system
+		std::vector<int> members; // bodies of the group, the host first
+		BodySystem local;         // members relative to the barycenter
+		DirectSolver solver;
+		WisdomHolmanIntegrator integrator;
+		double innerStep;
+	};
+
+	// splits the bodies into the outer system and groups
+	void build(BodySystem& bodies)
+	{
+		const int n = bodies.size();
+		count = n;
+		built = true;
+		groups.clear();
+		top.clear();
+		topBodies.clear();
+		outer->reset();
+
+		// root of each body: follow hosts up to a body without one
+		std::vector<int> root(n), groupOf(n, -1);
+		for (int i = 0; i < n; i++)
+		{
+			int r = i;
+			for (int depth = 0; depth < n && bodies.properties(r).host >= 0 && bodies.properties(r).host < n; depth++)
+				r = bodies.properties(r).host;
+			root[i] = r;
+		}
+		for (int i = 0; i < n; i++)
+			if (root[i] != i && groupOf[root[i]] < 0)
+			{
+				groupOf[root[i]] = (int)groups.size();
+				groups.push_back(Group());
+				groups.back().members.push_back(root[i]);
+			}
+		for (int i = 0; i < n; i++)
+			if (root[i] != i)
+				groups[groupOf[root[i]]].members.push_back(i);
+
+		for (int i = 0; i < n; i++)
+		{
+			if (root[i] != i)
+				continue;
+			if (groupOf[i] < 0)
+			{
+				top.add(bodies.get(i));
+				topBodies.push_back(i);
+				continue;
+			}
+
+			// barycenter in place of the host, members around it
+			Group& group = groups[groupOf[i]];
+			double mass = 0;
+			dvec3 center(0, 0, 0), velocity(0, 0, 0);
+			for (int member : group.members)
+			{
+				mass += bodies.m[member];
+				center = center + bodies.position(member) * bodies.m[member];
+				velocity = velocity + bodies.velocity(member) * bodies.m[member];
+			}
+			center = center * (1 / mass);
+			velocity = velocity * (1 / mass);
+
+			Body barycenter = bodies.get(i);
+			barycenter.mass = mass;
+			barycenter.position = center;
+			barycenter.velocity = velocity;
+			barycenter.rotSpeed = 0;
+			group.outerIndex = top.size();
+			top.add(barycenter);
+			topBodies.push_back(-1);
+
+			double shortest = 0;
+			for (int member : group.members)
+			{
+				Body body = bodies.get(member);
+				body.position = body.position - center;
+				body.velocity = body.velocity - velocity;
+				group.local.add(body);
+				if (member != i)
+				{
+					// period of the member around the host
+					double r = (bodies.position(member) - bodies.position(i)).length();
+					double period = 2 * 3.14159265358979323846 * sqrt(r * r * r / (gravity * (bodies.m[i] + bodies.m[member])));
+					shortest = shortest == 0 ? period : std::min(shortest, period);
+				}
+			}
+			group.innerStep = orbitFraction * shortest;
+		}
+	}
+
+	// tidal velocity changes of the members and the matching change of their barycenter
+	void tidalKick(double dt)
+	{
+		for (Group& group : groups)
+		{
+			const int b = group.outerIndex;
+			const int members = group.local.size();
+			dvec3 center = top.position(b);
+			dvec3 atCenter = outerAcceleration(center, b);
+
+			accelerations.resize(members);
+			double mass = 0;
+			dvec3 mean(0, 0, 0);
+			for (int k = 0; k < members; k++)
+			{
+				accelerations[k] = outerAcceleration(center + group.local.position(k), b);
+				mass += group.local.m[k];
+				mean = mean + accelerations[k] * group.local.m[k];
+			}
+			mean = mean * (1 / mass);
+
+			for (int k = 0; k < members; k++)
+				group.local.setVelocity(k, group.local.velocity(k) + (accelerations[k] - mean) * dt);
+			top.setVelocity(b, top.velocity(b) + (mean - atCenter) * dt);
+		}
+	}
+
+	// attraction of the outer bodies except one at a point
+	dvec3 outerAcceleration(const dvec3& point, int except) const
+	{
+		double a[3] = { 0, 0, 0 };
+		for (int j = 0; j < top.size(); j++)
+		{
+			if (j == except)
+				continue;
+			double dx = top.x[j] - point.x;
+			double dy = top.y[j] - point.y;
+			double dz = top.z[j] - point.z;
+			double r2 = dx * dx + dy * dy + dz * dz;
+			if (r2 == 0)
+				continue;
+			double s = gravity * top.m[j] / (r2 * sqrt(r2));
+			a[0] += dx * s;
+			a[1] += dy * s;
+			a[2] += dz * s;
+		}
+		return dvec3(a[0], a[1], a[2]);
+	}
+
+	// writes the outer and local state back to the bodies
+	void store(BodySystem& bodies) const
+	{
+		for (int j = 0; j < top.size(); j++)
+		{
+			const int i = topBodies[j];
+			if (i < 0)
+				continue;
+			bodies.setPosition(i, top.position(j));
+			bodies.setVelocity(i, top.velocity(j));
+			bodies.rotAngle[i] = top.rotAngle[j];
+		}
+		for (const Group& group : groups)
+		{
+			const int b = group.outerIndex;
+			for (int k = 0; k < (int)group.members.size(); k++)
+			{
+				const int i = group.members[k];
+				bodies.setPosition(i, top.position(b) + group.local.position(k));
+				bodies.setVelocity(i, top.velocity(b) + group.local.velocity(k));
+				bodies.rotAngle[i] = group.local.rotAngle[k];
+			}
+		}
+	}
+
+	bool built;                 // the outer system and groups belong to the current bodies
+	int count;
+	BodySystem top;             // bodies without host and group barycenters
+	std::vector<int> topBodies; // body of each outer entry, -1 for barycenters
+	std::vector<Group> groups;
+	std::vector<dvec3> accelerations;
+};
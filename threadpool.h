@@ -0,0 +1,180 @@
+// persistent pool of worker threads for parallel loops over blocks of indices.
+//
+// The workers are started once and sleep between loops. Each loop splits its blocks into one
+// contiguous range per thread; a thread takes blocks from the front of its own range and, when it
+// runs out, steals from the back of the ranges of the others. The calling thread works as thread 0.
+class ThreadPool
+{
+public:
+	static const int maxThreads = 256;
+
+	ThreadPool(int threads = defaultThreadCount()) : threadCount(0), generation(0), busy(0), stopping(false), task(nullptr)
+	{
+		setThreadCount(threads);
+	}
+
+	~ThreadPool()
+	{
+		stop();
+	}
+
+	static int defaultThreadCount()
+	{
+		return std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	// restarts the workers with a new thread count, including the calling thread
+	void setThreadCount(int threads)
+	{
+		threads = std::max(1, std::min(threads, maxThreads));
+		if (threads == threadCount)
+			return;
+		stop();
+		stopping = false;
+		threadCount = threads;
+		for (int t = 1; t < threadCount; t++)
+			workers.push_back(std::thread(&ThreadPool::work, this, t));
+	}
+
+	int getThreadCount() const
+	{
+		return threadCount;
+	}
+
+	// calls task(begin, end, thread) for blocks of blockSize indices covering [0, count) and returns
+	// when all are done; which thread runs a block varies, so a block must only write its own results
+	void parallelFor(int count, int blockSize, const std::function<void(int, int, int)>& task_)
+	{
+		int blocks = (count + blockSize - 1) / blockSize;
+		if (threadCount == 1 || blocks <= 1)
+		{
+			for (int b = 0; b < blocks; b++)
+				task_(b * blockSize, std::min(count, (b + 1) * blockSize), 0);
+			return;
+		}
+
+		task = &task_;
+		total = count;
+		size = blockSize;
+		for (int t = 0; t < threadCount; t++)
+			queues[t].range = pack((int)((long long)blocks * t / threadCount), (int)((long long)blocks * (t + 1) / threadCount));
+
+		busy = threadCount - 1;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			generation++;
+		}
+		wake.notify_all();
+		runBlocks(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return busy == 0; });
+		task = nullptr;
+	}
+
+private:
+	// remaining blocks of one thread as [front, back), padded to its own cache line
+	struct Queue
+	{
+		std::atomic<uint64_t> range;
+		char padding[64 - sizeof(std::atomic<uint64_t>)];
+	};
+
+	static uint64_t pack(int front, int back)
+	{
+		return (uint64_t)front << 32 | (uint32_t)back;
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+		workers.clear();
+	}
+
+	void work(int thread)
+	{
+		int seen = 0;
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+			}
+
+			runBlocks(thread);
+			if (--busy == 0)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done.notify_one();
+			}
+		}
+	}
+
+	void runBlocks(int thread)
+	{
+		int block;
+		while (take(thread, block) || steal(thread, block))
+			(*task)(block * size, std::min(total, (block + 1) * size), thread);
+	}
+
+	// next block from the front of the thread's own range
+	bool take(int thread, int& block)
+	{
+		uint64_t range = queues[thread].range;
+		for (;;)
+		{
+			int front = (int)(range >> 32), back = (int)(uint32_t)range;
+			if (front >= back)
+				return false;
+			if (queues[thread].range.compare_exchange_weak(range, pack(front + 1, back)))
+			{
+				block = front;
+				return true;
+			}
+		}
+	}
+
+	// last block of another thread's range, visiting the others in a fixed order
+	bool steal(int thread, int& block)
+	{
+		for (int k = 1; k < threadCount; k++)
+		{
+			Queue& victim = queues[(thread + k) % threadCount];
+			uint64_t range = victim.range;
+			for (;;)
+			{
+				int front = (int)(range >> 32), back = (int)(uint32_t)range;
+				if (front >= back)
+					break;
+				if (victim.range.compare_exchange_weak(range, pack(front, back - 1)))
+				{
+					block = back - 1;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	int threadCount;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	int generation;
+	std::atomic<int> busy;
+	bool stopping;
+
+	// current loop
+	const std::function<void(int, int, int)>* task;
+	int total, size;
+	Queue queues[maxThreads];
+};
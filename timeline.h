@@ -0,0 +1,246 @@
+// keyframes of past states, for going back in time without running the simulation again from the start.
+//
+// Every few steps the full state of the bodies is kept as a keyframe. Keyframes come in groups: the
+// first of a group stores each value as it is, the others only the bits that differ from the
+// keyframe before, as the exclusive or of the two, with the positions moved on along the velocities
+// first. Values change little between keyframes, so the sign, the exponent, and the leading bits of
+// the mantissa cancel, and only the low bytes that are not zero are stored, behind a count per
+// value. Nothing is rounded, so a restored state is the same to the last bit. Restoring decodes the
+// group up to the keyframe, except for the latest keyframe, which is kept decoded. When the
+// keyframes use more memory than the budget, whole groups are dropped from the oldest end, like in
+// a ring buffer.
+
+const int timelineGroup = 16; // keyframes per group, a full one and the changes after it
+const int timelineValues = 9; // per body: position, velocity, mass, spin angle and speed
+
+class Timeline
+{
+public:
+	Timeline() : interval(16), budget(64 << 20), steps(0), groups(0), grouped(0), bytes(0), continued(false)
+	{
+	}
+
+	// takes a keyframe every interval of steps; call after every step. Keyframes at or after the time
+	// are dropped first, since after going back they belong to a history that did not happen.
+	void record(const BodySystem& bodies, double time)
+	{
+		while (!frames.empty() && frames.back().time >= time)
+			drop(false);
+
+		if (!frames.empty() && ++steps < interval)
+			return;
+		steps = 0;
+
+		// a new group when the previous one is full or the bodies changed
+		const int count = bodies.size();
+		gather(bodies, current);
+		Keyframe frame;
+		frame.time = time;
+		frame.count = count;
+		frame.full = !continued || frames.back().count != count || grouped == timelineGroup;
+		if (!frame.full)
+			predict(reference, count, time - frames.back().time);
+		else
+		{
+			reference.assign(current.size(), 0);
+			frame.info.resize(count);
+			for (int i = 0; i < count; i++)
+				frame.info[i] = bodies.properties(i);
+			groups++;
+			grouped = 0;
+		}
+		encode(current, reference, buffer);
+		frame.data.assign(buffer.begin(), buffer.end());
+		reference.swap(current);
+		bytes += size(frame);
+		frames.push_back(std::move(frame));
+		grouped++;
+		continued = true;
+
+		// oldest groups first, but never the one in progress
+		while (bytes > budget && groups > 1)
+		{
+			do
+				drop(true);
+			while (!frames.front().full);
+		}
+	}
+
+	// sets the bodies to the latest keyframe at or before the target, or the oldest if there is none
+	// that early, and its time; false if there are no keyframes. The steps are counted from there.
+	bool restore(double target, BodySystem& bodies, double& time)
+	{
+		if (frames.empty())
+			return false;
+		size_t index = std::upper_bound(frames.begin(), frames.end(), target, [](double t, const Keyframe& frame) { return t < frame.time; }) - frames.begin();
+		index = index > 0 ? index - 1 : 0;
+
+		// decode from the start of the group, unless it is the latest keyframe
+		size_t start = index;
+		while (!frames[start].full)
+			start--;
+		if (index + 1 < frames.size())
+		{
+			reference.assign((size_t)frames[index].count * timelineValues, 0);
+			for (size_t k = start; k <= index; k++)
+			{
+				if (k > start)
+					predict(reference, frames[k].count, frames[k].time - frames[k - 1].time);
+				decode(frames[k].data, reference);
+			}
+		}
+
+		const Keyframe& frame = frames[index];
+		const std::vector<BodyInfo>& info = frames[start].info;
+		const int n = frame.count;
+		if (bodies.size() != n)
+		{
+			bodies.clear();
+			for (int i = 0; i < n; i++)
+				bodies.add(Body(info[i].name, 0, 0, info[i].radius, 0, info[i].tilt, 0, info[i].moonOption, info[i].texture));
+		}
+		AlignedArray* arrays[timelineValues] = { &bodies.x, &bodies.y, &bodies.z, &bodies.vx, &bodies.vy, &bodies.vz, &bodies.m, &bodies.rotAngle, &bodies.rotSpeed };
+		for (int a = 0; a < timelineValues; a++)
+			for (int i = 0; i < n; i++)
+				(*arrays[a])[i] = reference[(size_t)a * n + i];
+		for (int i = 0; i < n; i++)
+			bodies.properties(i) = info[i];
+
+		// the later keyframes belong to the history that is undone, and the next one continues this one
+		time = frame.time;
+		while (frames.size() > index + 1)
+			drop(false);
+		steps = 0;
+		grouped = (int)(index - start) + 1;
+		continued = true;
+		return true;
+	}
+
+	void clear()
+	{
+		frames.clear();
+		groups = 0;
+		bytes = 0;
+		continued = false;
+	}
+
+	int size() const
+	{
+		return (int)frames.size();
+	}
+
+	// time of the oldest keyframe (s)
+	double begin() const
+	{
+		return frames.empty() ? 0 : frames.front().time;
+	}
+
+	// bytes used by the keyframes
+	size_t memory() const
+	{
+		return bytes;
+	}
+
+	int interval;  // steps between keyframes
+	size_t budget; // bytes the keyframes may use
+
+private:
+	struct Keyframe
+	{
+		double time;
+		int count;
+		bool full;                        // stores the values, not the changes
+		std::vector<unsigned char> data;  // per pair of values a byte with the two counts, then their bytes
+		std::vector<BodyInfo> info;       // properties of the bodies, in full keyframes only
+	};
+
+	static size_t size(const Keyframe& frame)
+	{
+		return sizeof(Keyframe) + frame.data.capacity() + frame.info.capacity() * sizeof(BodyInfo);
+	}
+
+	// values of all bodies, one component after another
+	static void gather(const BodySystem& bodies, std::vector<double>& state)
+	{
+		const int n = bodies.size();
+		const AlignedArray* arrays[timelineValues] = { &bodies.x, &bodies.y, &bodies.z, &bodies.vx, &bodies.vy, &bodies.vz, &bodies.m, &bodies.rotAngle, &bodies.rotSpeed };
+		state.resize((size_t)n * timelineValues);
+		for (int a = 0; a < timelineValues; a++)
+			std::copy(arrays[a]->data(), arrays[a]->data() + n, state.begin() + (size_t)a * n);
+	}
+
+	// positions after the given time at the velocities, which are closer to the next keyframe
+	static void predict(std::vector<double>& state, int n, double dt)
+	{
+		for (size_t i = 0; i < (size_t)3 * n; i++)
+			state[i] += state[i + (size_t)3 * n] * dt;
+	}
+
+	static void encode(const std::vector<double>& state, const std::vector<double>& reference, std::vector<unsigned char>& data)
+	{
+		data.clear();
+		for (size_t i = 0; i < state.size(); i += 2)
+		{
+			size_t counts = data.size();
+			data.push_back(0);
+			for (size_t j = i; j < i + 2 && j < state.size(); j++)
+			{
+				uint64_t value, previous;
+				memcpy(&value, &state[j], sizeof(value));
+				memcpy(&previous, &reference[j], sizeof(previous));
+				uint64_t change = value ^ previous;
+				int length = 0;
+				while (length < 8 && change >> (8 * length) != 0)
+					length++;
+				data[counts] |= length << (4 * (j - i));
+				for (int b = 0; b < length; b++)
+					data.push_back((unsigned char)(change >> (8 * b)));
+			}
+		}
+	}
+
+	// applies the changes to the state of the keyframe before
+	static void decode(const std::vector<unsigned char>& data, std::vector<double>& state)
+	{
+		const unsigned char* in = data.data();
+		for (size_t i = 0; i < state.size(); i += 2)
+		{
+			int counts = *in++;
+			for (size_t j = i; j < i + 2 && j < state.size(); j++)
+			{
+				int length = (counts >> (4 * (j - i))) & 15;
+				uint64_t change = 0;
+				for (int b = 0; b < length; b++)
+					change |= (uint64_t)*in++ << (8 * b);
+				uint64_t value;
+				memcpy(&value, &state[j], sizeof(value));
+				value ^= change;
+				memcpy(&state[j], &value, sizeof(value));
+			}
+		}
+	}
+
+	void drop(bool front)
+	{
+		Keyframe& frame = front ? frames.front() : frames.back();
+		bytes -= size(frame);
+		groups -= frame.full;
+		if (front)
+			frames.pop_front();
+		else
+		{
+			frames.pop_back();
+			continued = false;
+		}
+	}
+
+	std::deque<Keyframe> frames;
+	int steps;                         // since the latest keyframe
+	int groups;                        // full keyframes
+	int grouped;                       // keyframes in the latest group
+	size_t bytes;
+	bool continued;                    // the next keyframe may store changes against the latest one
+	std::vector<double> reference;     // state of the latest keyframe
+	std::vector<double> current;
+	std::vector<unsigned char> buffer; // encoded keyframe, before it is copied to its exact size
+};
@@ -0,0 +1,788 @@
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// trajectory store: the full state history of a run in a compressed columnar file, for offline analysis.
+//
+// The simulation thread copies the time and the positions and velocities of all bodies into a chunk
+// in memory and, once the chunk is full, hands it to a writer thread, which never makes the
+// simulation wait: full chunks are queued under a short lock in buffers allocated when the file is
+// opened, and when the writer falls so far behind that the queue exceeds its memory limit, the chunk
+// is dropped and counted instead, unless batch runs ask to wait, and the file marks the samples as
+// missing. The writer stores each chunk column by column, the times first and then
+// x, y, z, vx, vy, vz of each body, so that one body can be read without touching the others. Each
+// column is compressed like the Gorilla time series: every value is predicted from the two before
+// it by a straight line, and only the bits of the exclusive or of value and prediction between its
+// leading and trailing zeros are stored, or a single bit when they are equal, as for evenly spaced
+// times. Nothing is rounded.
+//
+// File layout (host byte order): the magic "TRAJECT", a version byte, int32 body count, int32 samples
+// per chunk, the body names (int32 length and characters each), and then the chunks, each with
+// uint64 size in bytes, double first and last time, int32 samples, int32 columns, uint64 offsets of
+// the columns and of their end relative to the data, and the data. A chunk of zero samples and zero
+// columns, without offsets and data, marks the samples between its times as dropped. Closing
+// appends the index of the chunks (double first and last time and uint64 file position each), its
+// uint64 position, uint64 chunk count, and the magic again. Without it, as after a crash, a reader
+// finds the whole chunks by their sizes.
+
+const char trajectoryMagic[8] = { 'T', 'R', 'A', 'J', 'E', 'C', 'T', 2 };
+const int trajectoryChunkBytes = 4 << 20;  // uncompressed size a chunk aims for
+const int trajectoryQueueBytes = 64 << 20; // uncompressed chunks waiting for the writer at most
+
+// zero bits above and below the highest and lowest one of a value that is not zero
+int leadingZeroBits(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, x);
+	return 63 - (int)index;
+#else
+	return __builtin_clzll(x);
+#endif
+}
+
+int trailingZeroBits(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (int)index;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+// appends bits to bytes, the highest bits first
+class BitWriter
+{
+public:
+	BitWriter(std::vector<unsigned char>& bytes) : bytes(bytes), buffer(0), filled(0)
+	{
+	}
+
+	void write(uint64_t value, int bits)
+	{
+		if (bits < 64)
+			value &= ((uint64_t)1 << bits) - 1;
+		const int space = 64 - filled;
+		if (bits < space)
+		{
+			buffer = buffer << bits | value;
+			filled += bits;
+			return;
+		}
+
+		// fill the buffer, append it, and keep the rest of the value
+		const int rest = bits - space;
+		buffer = space == 64 ? value : buffer << space | value >> rest;
+		for (int shift = 56; shift >= 0; shift -= 8)
+			bytes.push_back((unsigned char)(buffer >> shift));
+		buffer = rest > 0 ? value & (((uint64_t)1 << rest) - 1) : 0;
+		filled = rest;
+	}
+
+	// appends the bits left, the last byte filled up with zeros
+	void align()
+	{
+		const int padding = (8 - filled % 8) % 8;
+		buffer <<= padding;
+		filled += padding;
+		for (int shift = filled - 8; shift >= 0; shift -= 8)
+			bytes.push_back((unsigned char)(buffer >> shift));
+		buffer = 0;
+		filled = 0;
+	}
+
+private:
+	std::vector<unsigned char>& bytes;
+	uint64_t buffer; // bits not yet appended, in the low end
+	int filled;
+};
+
+// reads bits in the order of BitWriter; zeros past the end
+class BitReader
+{
+public:
+	BitReader(const unsigned char* data, size_t size) : data(data), size(size), position(0)
+	{
+	}
+
+	uint64_t read(int bits)
+	{
+		if (bits == 0)
+			return 0;
+		if (bits > 56)
+		{
+			uint64_t high = read(bits - 32);
+			return high << 32 | read(32);
+		}
+
+		// the eight bytes starting at the byte of the position hold all the bits
+		const size_t first = position / 8;
+		uint64_t word = 0;
+		for (size_t b = first; b < first + 8; b++)
+			word = word << 8 | (b < size ? data[b] : 0);
+		const int offset = (int)(position % 8);
+		position += bits;
+		return word << offset >> (64 - bits);
+	}
+
+private:
+	const unsigned char* data;
+	size_t size;
+	size_t position; // in bits
+};
+
+// value predicted from the ones before it: a straight line through the last two
+double trajectoryPrediction(const double* values, int k)
+{
+	return k == 0 ? 0 : k == 1 ? values[0] : 2 * values[k - 1] - values[k - 2];
+}
+
+void encodeSeries(const double* values, int count, BitWriter& out)
+{
+	int leading = -1, trailing = 0; // zeros around the stored bits of the latest value that had some
+	for (int k = 0; k < count; k++)
+	{
+		double predicted = trajectoryPrediction(values, k);
+		uint64_t value, guess;
+		memcpy(&value, &values[k], sizeof(value));
+		memcpy(&guess, &predicted, sizeof(guess));
+		uint64_t change = value ^ guess;
+		if (change == 0)
+		{
+			out.write(0, 1);
+			continue;
+		}
+
+		// the bits between the zeros of the latest value, when they hold them and that is shorter
+		// than new counts of zeros and the bits between those
+		int lz = std::min(31, leadingZeroBits(change)), tz = trailingZeroBits(change);
+		if (leading >= 0 && lz >= leading && tz >= trailing && 64 - leading - trailing <= 11 + 64 - lz - tz)
+		{
+			out.write(2, 2);
+			out.write(change >> trailing, 64 - leading - trailing);
+		}
+		else
+		{
+			out.write(3, 2);
+			out.write(lz, 5);
+			out.write(64 - lz - tz - 1, 6);
+			out.write(change >> tz, 64 - lz - tz);
+			leading = lz;
+			trailing = tz;
+		}
+	}
+}
+
+void decodeSeries(BitReader& in, double* values, int count)
+{
+	int leading = 0, trailing = 0;
+	for (int k = 0; k < count; k++)
+	{
+		double predicted = trajectoryPrediction(values, k);
+		uint64_t change = 0;
+		if (in.read(1))
+		{
+			if (in.read(1))
+			{
+				leading = (int)in.read(5);
+				int length = (int)in.read(6) + 1;
+				trailing = 64 - leading - length;
+			}
+			change = in.read(64 - leading - trailing) << trailing;
+		}
+		uint64_t value;
+		memcpy(&value, &predicted, sizeof(value));
+		value ^= change;
+		memcpy(&values[k], &value, sizeof(value));
+	}
+}
+
+// streams the states of a run into a trajectory file on a thread of its own
+class TrajectoryWriter
+{
+public:
+	TrajectoryWriter() : interval(1), lossless(false), active(false), file(nullptr), count(0), columns(0), chunkSamples(0), queueLimit(0), steps(0), last(0), gap(false),
+		gapBegin(0), gapEnd(0), closing(false), dropped(0), position(0)
+	{
+	}
+
+	~TrajectoryWriter()
+	{
+		close();
+		finish();
+	}
+
+	// starts a file for the bodies with their state at the given time as the first sample; waits
+	// for a previous file to be finished
+	bool open(const char* path, const BodySystem& bodies, double time)
+	{
+		close();
+		finish();
+		file = fopen(path, "wb");
+		if (!file)
+			return false;
+		count = bodies.size();
+		columns = 1 + 6 * count;
+		chunkSamples = std::max(16, std::min(1024, trajectoryChunkBytes / (columns * (int)sizeof(double))));
+		queueLimit = std::max<size_t>(2, trajectoryQueueBytes / ((size_t)chunkSamples * columns * sizeof(double)));
+
+		fwrite(trajectoryMagic, 1, sizeof(trajectoryMagic), file);
+		fwrite(&count, sizeof(count), 1, file);
+		fwrite(&chunkSamples, sizeof(chunkSamples), 1, file);
+		for (int i = 0; i < count; i++)
+		{
+			const std::string& name = bodies.properties(i).name;
+			int length = (int)name.size();
+			fwrite(&length, sizeof(length), 1, file);
+			fwrite(name.data(), 1, length, file);
+		}
+		position = ftell(file);
+
+		// a buffer for every queued chunk, the one being written and the one being filled, so that
+		// handing over never allocates
+		spare.clear();
+		spare.reserve(queueLimit + 1);
+		for (size_t i = 0; i < queueLimit + 1; i++)
+			spare.push_back(std::vector<double>((size_t)chunkSamples * columns));
+		current = Chunk();
+		current.values.resize((size_t)chunkSamples * columns);
+		gap = false;
+
+		index.clear();
+		closing = false;
+		dropped = 0;
+		active = true;
+		thread = std::thread(&TrajectoryWriter::run, this);
+
+		steps = interval - 1;
+		last = time;
+		sample(bodies, time);
+		return true;
+	}
+
+	// adds the state after a step, every interval of steps; only copies it, or hands over a full
+	// chunk. Stops recording and returns false when bodies were added or removed or the time went back.
+	bool sample(const BodySystem& bodies, double time)
+	{
+		if (!active)
+			return false;
+		if (bodies.size() != count || time < last)
+		{
+			close();
+			return false;
+		}
+		last = time;
+		if (++steps < interval)
+			return true;
+		steps = 0;
+
+		double* row = &current.values[(size_t)current.samples * columns];
+		row[0] = time;
+		for (int i = 0; i < count; i++)
+		{
+			double* state = row + 1 + 6 * i;
+			state[0] = bodies.x[i];
+			state[1] = bodies.y[i];
+			state[2] = bodies.z[i];
+			state[3] = bodies.vx[i];
+			state[4] = bodies.vy[i];
+			state[5] = bodies.vz[i];
+		}
+		if (++current.samples == chunkSamples)
+			handOver();
+		return true;
+	}
+
+	// hands the unfinished chunk to the writer thread, which then appends the index and closes the
+	// file; does not wait for it
+	void close()
+	{
+		if (!active)
+			return;
+		active = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (current.samples > 0 || gap)
+			{
+				markGap();
+				queue.push_back(std::move(current));
+			}
+			current = Chunk();
+			closing = true;
+		}
+		ready.notify_one();
+	}
+
+	// waits until the writer thread has finished the file
+	void finish()
+	{
+		if (thread.joinable())
+			thread.join();
+	}
+
+	bool isOpen() const
+	{
+		return active;
+	}
+
+	// chunks left out because the writer thread fell behind
+	long long droppedChunks() const
+	{
+		return dropped;
+	}
+
+	int interval;  // steps per sample; change while closed
+	bool lossless; // waits for room in the queue instead of dropping chunks, for batch runs
+
+private:
+	struct Chunk
+	{
+		Chunk() : samples(0), gap(false), gapBegin(0), gapEnd(0)
+		{
+		}
+
+		std::vector<double> values; // sample by sample: time and the states of all bodies
+		int samples;
+		bool gap;                   // samples between the two times were dropped before this chunk
+		double gapBegin, gapEnd;
+	};
+
+	struct IndexEntry
+	{
+		double begin, end;
+		uint64_t position;
+	};
+
+	// queues the full chunk and continues in a spare buffer, or drops it when the queue is full and
+	// reuses its buffer
+	void handOver()
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (lossless)
+				room.wait(lock, [this]() { return queue.size() < queueLimit; });
+			if (queue.size() < queueLimit && !spare.empty())
+			{
+				markGap();
+				queue.push_back(std::move(current));
+				current.values.swap(spare.back());
+				spare.pop_back();
+				current.gap = false;
+			}
+			else
+			{
+				if (!gap)
+					gapBegin = current.values[0];
+				gapEnd = current.values[(size_t)(current.samples - 1) * columns];
+				gap = true;
+				dropped++;
+			}
+		}
+		ready.notify_one();
+		current.samples = 0;
+	}
+
+	// passes the dropped samples on to the writer with the chunk after them
+	void markGap()
+	{
+		current.gap = gap;
+		current.gapBegin = gapBegin;
+		current.gapEnd = gapEnd;
+		gap = false;
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			ready.wait(lock, [this]() { return !queue.empty() || closing; });
+			if (queue.empty())
+				break;
+			Chunk chunk = std::move(queue.front());
+			queue.pop_front();
+			lock.unlock();
+			room.notify_one();
+			write(chunk);
+			lock.lock();
+			spare.push_back(std::move(chunk.values));
+		}
+		lock.unlock();
+
+		for (const IndexEntry& entry : index)
+		{
+			fwrite(&entry.begin, sizeof(entry.begin), 1, file);
+			fwrite(&entry.end, sizeof(entry.end), 1, file);
+			fwrite(&entry.position, sizeof(entry.position), 1, file);
+		}
+		uint64_t chunks = index.size();
+		fwrite(&position, sizeof(position), 1, file);
+		fwrite(&chunks, sizeof(chunks), 1, file);
+		fwrite(trajectoryMagic, 1, sizeof(trajectoryMagic), file);
+		fclose(file);
+		file = nullptr;
+	}
+
+	// compresses the chunk column by column and appends it to the file, after the mark of the
+	// samples dropped before it
+	void write(const Chunk& chunk)
+	{
+		if (chunk.gap)
+		{
+			IndexEntry entry = { chunk.gapBegin, chunk.gapEnd, position };
+			const int none = 0;
+			uint64_t size = sizeof(uint64_t) + 2 * sizeof(double) + 2 * sizeof(int);
+			fwrite(&size, sizeof(size), 1, file);
+			fwrite(&entry.begin, sizeof(entry.begin), 1, file);
+			fwrite(&entry.end, sizeof(entry.end), 1, file);
+			fwrite(&none, sizeof(none), 1, file);
+			fwrite(&none, sizeof(none), 1, file);
+			index.push_back(entry);
+			position += size;
+		}
+		const int samples = chunk.samples;
+		if (samples == 0)
+		{
+			fflush(file);
+			return;
+		}
+		bytes.clear();
+		offsets.resize(columns + 1);
+		column.resize(samples);
+		BitWriter out(bytes);
+		for (int c = 0; c < columns; c++)
+		{
+			offsets[c] = bytes.size();
+			for (int k = 0; k < samples; k++)
+				column[k] = chunk.values[(size_t)k * columns + c];
+			encodeSeries(column.data(), samples, out);
+			out.align();
+		}
+		offsets[columns] = bytes.size();
+
+		IndexEntry entry = { chunk.values[0], chunk.values[(size_t)(samples - 1) * columns], position };
+		uint64_t size = sizeof(uint64_t) + 2 * sizeof(double) + 2 * sizeof(int) + offsets.size() * sizeof(uint64_t) + bytes.size();
+		fwrite(&size, sizeof(size), 1, file);
+		fwrite(&entry.begin, sizeof(entry.begin), 1, file);
+		fwrite(&entry.end, sizeof(entry.end), 1, file);
+		fwrite(&samples, sizeof(samples), 1, file);
+		fwrite(&columns, sizeof(columns), 1, file);
+		fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file);
+		fwrite(bytes.data(), 1, bytes.size(), file);
+		fflush(file);
+		index.push_back(entry);
+		position += size;
+	}
+
+	// owned by the thread that records
+	bool active;
+	FILE* file;
+	int count, columns, chunkSamples;
+	size_t queueLimit; // chunks
+	int steps;         // since the latest sample
+	double last;       // time of the latest step
+	Chunk current;
+	bool gap;                  // chunks were dropped since the latest queued one
+	double gapBegin, gapEnd;   // their first and last time
+
+	// shared with the writer thread
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable ready, room; // chunks to write, and space in the queue
+	std::deque<Chunk> queue;
+	std::vector<std::vector<double> > spare; // buffers that hold no chunk
+	bool closing;
+	std::atomic<long long> dropped;
+
+	// owned by the writer thread
+	uint64_t position; // in the file
+	std::vector<IndexEntry> index;
+	std::vector<unsigned char> bytes;
+	std::vector<uint64_t> offsets;
+	std::vector<double> column;
+};
+
+// read-only view of a whole file, mapped into memory
+class MappedFile
+{
+public:
+	MappedFile() : view(nullptr), length(0)
+	{
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	bool open(const char* path)
+	{
+		close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		HANDLE mapping = GetFileSizeEx(file, &size) && size.QuadPart > 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+		view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		length = view ? (size_t)size.QuadPart : 0;
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+#else
+		int file = ::open(path, O_RDONLY);
+		if (file < 0)
+			return false;
+		struct stat status;
+		if (fstat(file, &status) == 0 && status.st_size > 0)
+		{
+			view = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (view == MAP_FAILED)
+				view = nullptr;
+			length = view ? (size_t)status.st_size : 0;
+		}
+		::close(file);
+#endif
+		return view != nullptr;
+	}
+
+	void close()
+	{
+		if (!view)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(view);
+#else
+		munmap(view, length);
+#endif
+		view = nullptr;
+		length = 0;
+	}
+
+	const unsigned char* data() const
+	{
+		return (const unsigned char*)view;
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+	void* view;
+	size_t length;
+};
+
+// samples left out of a trajectory file between two times, inclusive, because the writer fell behind
+struct TrajectoryGap
+{
+	double begin, end;
+};
+
+// maps a trajectory file and decodes only the chunks and columns asked for
+class TrajectoryReader
+{
+public:
+	TrajectoryReader() : count(0), chunkSamples(0)
+	{
+	}
+
+	// false if the file cannot be mapped or is not a trajectory
+	bool open(const char* path)
+	{
+		count = 0;
+		names.clear();
+		index.clear();
+		if (!file.open(path))
+			return false;
+
+		size_t at = 0;
+		char magic[8];
+		bool valid = get(at, magic, sizeof(magic)) && std::equal(magic, magic + 8, trajectoryMagic) && get(at, &count, sizeof(count)) &&
+			get(at, &chunkSamples, sizeof(chunkSamples)) && count > 0 && chunkSamples > 0;
+		for (int i = 0; valid && i < count; i++)
+		{
+			int length = 0;
+			valid = get(at, &length, sizeof(length)) && length >= 0 && length < 4096 && at + length <= file.size();
+			if (valid)
+				names.push_back(std::string((const char*)file.data() + at, length));
+			at += length;
+		}
+		if (!valid)
+		{
+			close();
+			return false;
+		}
+
+		// the index at the end, or the whole chunks one after another
+		const size_t footer = 2 * sizeof(uint64_t) + sizeof(trajectoryMagic);
+		const size_t entrySize = 2 * sizeof(double) + sizeof(uint64_t);
+		uint64_t indexPosition = 0, chunks = 0;
+		size_t tail = file.size() >= at + footer ? file.size() - footer : file.size();
+		if (file.size() >= at + footer && get(tail, &indexPosition, sizeof(indexPosition)) && get(tail, &chunks, sizeof(chunks)) &&
+			std::equal(trajectoryMagic, trajectoryMagic + 8, (const char*)file.data() + tail) && indexPosition + chunks * entrySize + footer == file.size())
+		{
+			size_t entryAt = (size_t)indexPosition;
+			index.resize((size_t)chunks);
+			for (Entry& entry : index)
+			{
+				get(entryAt, &entry.begin, sizeof(entry.begin));
+				get(entryAt, &entry.end, sizeof(entry.end));
+				get(entryAt, &entry.position, sizeof(entry.position));
+			}
+		}
+		else
+		{
+			uint64_t size = 0;
+			for (size_t chunk = at; get(chunk, &size, sizeof(size)) && size > sizeof(size) && chunk - sizeof(size) + size <= file.size(); chunk += size - sizeof(size))
+			{
+				Entry entry;
+				entry.position = chunk - sizeof(size);
+				size_t times = chunk;
+				get(times, &entry.begin, sizeof(entry.begin));
+				get(times, &entry.end, sizeof(entry.end));
+				index.push_back(entry);
+			}
+		}
+		return true;
+	}
+
+	void close()
+	{
+		file.close();
+		count = 0;
+		names.clear();
+		index.clear();
+	}
+
+	int size() const
+	{
+		return count;
+	}
+
+	const std::string& name(int i) const
+	{
+		return names[i];
+	}
+
+	int chunks() const
+	{
+		return (int)index.size();
+	}
+
+	// samples in the file, not counting the dropped ones
+	long long samples() const
+	{
+		long long total = 0;
+		for (const Entry& entry : index)
+		{
+			size_t at = (size_t)entry.position + sizeof(uint64_t) + 2 * sizeof(double);
+			int inChunk = 0;
+			if (get(at, &inChunk, sizeof(inChunk)))
+				total += inChunk;
+		}
+		return total;
+	}
+
+	// time of the first and last sample, recorded or dropped (s)
+	double begin() const
+	{
+		return index.empty() ? 0 : index.front().begin;
+	}
+
+	double end() const
+	{
+		return index.empty() ? 0 : index.back().end;
+	}
+
+	// appends the samples of a body between two times, inclusive, and the ranges of dropped samples
+	// that overlap them, and returns the number of samples
+	int read(int body, double from, double to, std::vector<double>& times, std::vector<dvec3>& positions, std::vector<dvec3>& velocities,
+		std::vector<TrajectoryGap>& gaps)
+	{
+		int found = 0;
+		if (body < 0 || body >= count)
+			return 0;
+		size_t first = std::lower_bound(index.begin(), index.end(), from, [](const Entry& entry, double t) { return entry.end < t; }) - index.begin();
+		for (size_t c = first; c < index.size() && index[c].begin <= to; c++)
+		{
+			// chunk header: size, first and last time, samples, columns, then the offsets of the columns
+			size_t at = (size_t)index[c].position + sizeof(uint64_t) + 2 * sizeof(double);
+			int samples = 0, chunkColumns = 0;
+			if (!get(at, &samples, sizeof(samples)) || !get(at, &chunkColumns, sizeof(chunkColumns)))
+				break;
+			if (samples == 0 && chunkColumns == 0)
+			{
+				TrajectoryGap gap = { index[c].begin, index[c].end };
+				gaps.push_back(gap);
+				continue;
+			}
+			if (samples <= 0 || chunkColumns != 1 + 6 * count)
+				break;
+			const size_t data = at + (chunkColumns + 1) * sizeof(uint64_t);
+			if (data > file.size())
+				break;
+
+			const int wanted[7] = { 0, 1 + 6 * body, 2 + 6 * body, 3 + 6 * body, 4 + 6 * body, 5 + 6 * body, 6 + 6 * body };
+			series.resize((size_t)7 * samples);
+			for (int w = 0; w < 7; w++)
+			{
+				uint64_t offsets[2];
+				size_t offsetAt = at + wanted[w] * sizeof(uint64_t);
+				get(offsetAt, offsets, sizeof(offsets));
+				size_t start = data + (size_t)offsets[0];
+				size_t length = offsets[1] >= offsets[0] && start <= file.size() ? std::min((size_t)(offsets[1] - offsets[0]), file.size() - start) : 0;
+				BitReader in(file.data() + std::min(start, file.size()), length);
+				decodeSeries(in, &series[(size_t)w * samples], samples);
+			}
+
+			const double* state = series.data();
+			for (int k = 0; k < samples; k++)
+			{
+				if (state[k] < from || state[k] > to)
+					continue;
+				times.push_back(state[k]);
+				positions.push_back(dvec3(state[samples + k], state[2 * samples + k], state[3 * samples + k]));
+				velocities.push_back(dvec3(state[4 * samples + k], state[5 * samples + k], state[6 * samples + k]));
+				found++;
+			}
+		}
+		return found;
+	}
+
+private:
+	struct Entry
+	{
+		double begin, end;
+		uint64_t position;
+	};
+
+	// copies bytes from the file and moves past them; false past the end
+	bool get(size_t& at, void* value, size_t size) const
+	{
+		if (at + size > file.size())
+			return false;
+		memcpy(value, file.data() + at, size);
+		at += size;
+		return true;
+	}
+
+	MappedFile file;
+	int count, chunkSamples;
+	std::vector<std::string> names;
+	std::vector<Entry> index;
+	std::vector<double> series; // decoded columns of one chunk
+};